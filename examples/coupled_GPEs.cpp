@@ -44,7 +44,8 @@ int main(int argc, char** argv) {
     double omega_i = 0.;
     double omega_r = 2.*M_PI / 20.;
 #ifdef HAVE_MPI
-    MPI_Init(&argc, &argv);
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 #endif
     //set lattice
     Lattice2D *grid = new Lattice2D(DIM, length);
@@ -48,7 +48,8 @@ int main(int argc, char** argv) {
     int angular_momentum = int(ANGULAR_MOMENTUM);
 
 #ifdef HAVE_MPI
-    MPI_Init(&argc, &argv);
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 #endif
 
     //set lattice
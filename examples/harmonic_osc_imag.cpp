@@ -43,7 +43,8 @@ int main(int argc, char** argv) {
     double length = double(EDGE_LENGTH);
     double coupling_const = double(COUPLING_CONST_2D);
 #ifdef HAVE_MPI
-    MPI_Init(&argc, &argv);
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 #endif
 
     //set lattice
@@ -49,7 +49,8 @@ int main(int argc, char** argv) {
     bool imag_time = true;
 
 #ifdef HAVE_MPI
-    MPI_Init(&argc, &argv);
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 #endif
 
     //set lattice
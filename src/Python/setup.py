@@ -95,6 +95,12 @@ if sys.platform.startswith('win') and os.path.exists(win_cuda_dir):
                                          'trottersuzuki/src/cpukernel.obj',
                                          'trottersuzuki/src/cpucartesian.obj',
                                          'trottersuzuki/src/cpucylindrical.obj',
+                                        'trottersuzuki/src/stencil.obj',
+                                        'trottersuzuki/src/minimizer.obj',
+                                        'trottersuzuki/src/eigenstates.obj',
+                                        'trottersuzuki/src/chebyshev.obj',
+                                        'trottersuzuki/src/adi.obj',
+                                        'trottersuzuki/src/fft.obj',
                                          'trottersuzuki/src/gpukernel.obj',
                                          'trottersuzuki/src/gpucartesian.obj',
                                          'trottersuzuki/src/model.obj',
@@ -120,6 +126,12 @@ else:
                      'trottersuzuki/src/cpukernel.cpp',
                      'trottersuzuki/src/cpucartesian.cpp',
                      'trottersuzuki/src/cpucylindrical.cpp',
+                     'trottersuzuki/src/stencil.cpp',
+                     'trottersuzuki/src/minimizer.cpp',
+                     'trottersuzuki/src/eigenstates.cpp',
+                     'trottersuzuki/src/chebyshev.cpp',
+                     'trottersuzuki/src/adi.cpp',
+                     'trottersuzuki/src/fft.cpp',
                      'trottersuzuki/src/model.cpp',
                      'trottersuzuki/src/solver.cpp',
                      'trottersuzuki/trottersuzuki_wrap.cxx']
@@ -8,6 +8,7 @@ from .trottersuzuki import ExponentialState as _ExponentialState
 from .trottersuzuki import BesselState as _BesselState
 from .trottersuzuki import Potential as _Potential
 from .trottersuzuki import Solver as _Solver
+from .trottersuzuki import StateVector, DoubleVector
 from .tools import map_lattice_to_coordinate_space, imprint
 
 
@@ -38,14 +39,16 @@ class Lattice2D(_Lattice2D):
 
     def __init__(self, dim_x, length_x, dim_y=None, length_y=None,
                  periodic_x_axis=False, periodic_y_axis=False,
-                 angular_velocity=0., coordinate_system="cartesian"):
+                 angular_velocity=0., coordinate_system="cartesian",
+                 steps_per_block=1, kinetic_order=2):
         if dim_y is None:
             dim_y = dim_x
         if length_y is None:
             length_y = length_x
         super(Lattice2D, self).__init__(dim_x, length_x, dim_y, length_y,
                                         periodic_x_axis, periodic_y_axis,
-                                        angular_velocity, coordinate_system)
+                                        angular_velocity, coordinate_system,
+                                        steps_per_block, kinetic_order)
 
     def get_x_axis(self):
         """
@@ -401,3 +404,11 @@ class Solver(_Solver):
         super(Solver, self).set_exp_potential(np.ravel(exp_pot.real),
                                               np.ravel(exp_pot.imag), 0)
         super(Solver, self).evolve(1, imag_time)
+
+    def find_eigenstates(self, states, tolerance, max_iterations,
+                         orthogonalization_steps=10, check_steps=100):
+        energies = DoubleVector()
+        iterations = super(Solver, self).find_eigenstates(StateVector(states), energies, tolerance,
+                                                          max_iterations, orthogonalization_steps,
+                                                          check_steps)
+        return iterations, list(energies)
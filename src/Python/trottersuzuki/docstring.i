@@ -476,6 +476,20 @@ Parameters
     Boundary condition along the x axis (false=closed, true=periodic).  
 * `periodic_y_axis` : bool,optional (default: False) 
     Boundary condition along the y axis (false=closed, true=periodic).
+* `angular_velocity` : float,optional (default: 0.)
+    Angular velocity of the frame of reference.
+* `coordinate_system` : string,optional (default: "cartesian")
+    Type of the coordinate system used ("cartesian" or "cylindrical").
+* `steps_per_block` : integer,optional (default: 1)
+    Number of time steps evolved on a cached block between two halo
+    exchanges (temporal blocking). The halos grow linearly with it.
+    Above 1, the solver needs a single component, a static potential and
+    the splitting of order 2, and in imaginary time a linear Hamiltonian
+    in cartesian coordinates.
+* `kinetic_order` : integer,optional (default: 2)
+    Order of the finite differences of the kinetic term in the CPU kernels,
+    2 or 4 (cartesian coordinates only). The fourth order allows coarser
+    lattices for the same error, with three times wider halos.
 
 Returns
 -------
@@ -712,6 +726,279 @@ Example
     0.5
 ";
 
+%feature("docstring") Solver::set_sincos_accuracy "
+
+Set the accuracy of the phase of the nonlinear and external potential
+operator in real time evolution (CPU kernel only).
+
+Parameters
+----------
+* `accuracy` : string
+    Either 'double' (default, in-tree polynomial accurate to a few ulp),
+    'single' (faster polynomial accurate to single precision) or
+    'exact' (standard library).
+";
+
+%feature("docstring") Solver::get_kernel_allocations "
+
+Get the number of buffers the kernel allocated on the heap. The count does
+not change while the solver evolves with the same parameters.
+
+Returns
+-------
+* `get_kernel_allocations` : integer
+    Number of heap allocations made by the kernel since its construction.
+";
+
+%feature("docstring") Solver::set_autotune_cache "
+
+Set the file storing the geometries of the cached blocks found by the
+cpu-auto kernel, by CPU model and tile shape. Later solvers read it instead
+of timing the candidates again.
+
+Parameters
+----------
+* `file_name` : string
+    Name of the file; empty (default) does not store the geometries.
+";
+
+%feature("docstring") Solver::set_in_place "
+
+Set whether the CPU kernel evolves the states in place. In place, the kernel
+does not allocate a second buffer for each wave function, only strips around
+the boundaries of its cached blocks, so that larger lattices fit in memory.
+The evolution is the same.
+
+Parameters
+----------
+* `in_place` : bool
+    True to evolve in place; False (default) to use a second buffer.
+";
+
+%feature("docstring") Solver::set_splitting_order "
+
+Set the order of the splitting of the evolution operator in real time. The
+fourth order splitting composes three steps of the second order one, with the
+time step weighted by 1/(2-2^(1/3)), -2^(1/3)/(2-2^(1/3)) and 1/(2-2^(1/3))
+(Yoshida): each time step costs three steps of the second order splitting, and
+reaches the same accuracy with a much larger time step. The rotating frame of
+reference and the coupling between two components are not split symmetrically,
+so with them the error is smaller but still of second order. Imaginary time
+evolution always uses the second order splitting. The gpu kernel only supports
+the second order splitting.
+
+Parameters
+----------
+* `order` : integer
+    2 (default) or 4.
+";
+
+%feature("docstring") Solver::set_mixed_precision "
+
+Evolve in imaginary time with the wave functions stored in single precision
+(the cpu-float kernel) until the total energy changes by less than a relative
+tolerance over 100 steps, counted across calls to evolve(), then refine the
+state in double precision until the parameters of the solver change. It
+applies to the cpu and cpu-auto kernels, and not to two-component systems with
+a Rabi coupling.
+
+Parameters
+----------
+* `energy_tolerance` : float
+    Relative change of the energy below which the evolution switches to
+    double precision; 0 (default) evolves in double precision only.
+";
+
+%feature("docstring") Solver::set_delta_t "
+
+Set the time step of the next evolutions. The CPU kernel keeps its buffers and
+only rebuilds the evolution operators that depend on the time step; the GPU
+kernel is rebuilt at the next evolution.
+
+Parameters
+----------
+* `delta_t` : float
+    The new time step.
+";
+
+%feature("docstring") Solver::get_delta_t "
+
+Get the time step of the evolution.
+
+Returns
+-------
+* `get_delta_t` : float
+    The time step.
+";
+
+%feature("docstring") Solver::find_ground_state "
+
+Evolve in imaginary time until the ground state is reached. Every `check_steps`
+time steps, the total energy and the residual norm, estimated by the change of
+the normalized wave function over the imaginary time evolved, are compared
+with the tolerance. The time step of the solver sets the accuracy of the
+ground state: the schedule starts from a larger time step, which relaxes the
+state in fewer steps, and multiplies it by `time_step_factor` each time the
+state is stationary within the square root of the tolerance, or its energy
+rises, down to the time step of the solver. The time step of the solver is
+restored at the end; the mixed precision is not applied.
+
+Parameters
+----------
+* `tolerance` : float
+    Relative change of the energy over `check_steps` and relative squared
+    residual norm below which the state is stationary.
+* `max_iterations` : integer
+    Maximum number of time steps.
+* `check_steps` : integer,optional (default: 100)
+    Time steps between two checks of the energy and of the residual norm.
+* `time_step_levels` : integer,optional (default: 3)
+    Number of time steps of the schedule; 1 evolves with the time step of the
+    solver only.
+* `time_step_factor` : float,optional (default: 0.5)
+    Factor multiplying the time step from a level of the schedule to the next.
+
+Returns
+-------
+* `find_ground_state` : integer
+    The number of time steps evolved, negative if the ground state was not
+    reached within `max_iterations`.
+";
+
+%feature("docstring") Solver::find_ground_state_multilevel "
+
+Find the ground state on coarser lattices first. Each coarser level halves the
+dimensions of the lattice, with the same physical size, boundary conditions and
+MPI processes. The coarsest level starts from the initial state averaged over
+its cells and descends the schedule of the time step of `find_ground_state`;
+each finer level starts from the bilinear interpolation of the ground state of
+the coarser one, with the initial norm. The time step is four times larger on
+each coarser level, as the square of the lattice spacing, and the coarser
+levels stop at the square root of the tolerance. The Hamiltonian and its
+potentials are evaluated on each level: potentials given as matrices are
+averaged over the cells of the coarser lattices. Only 2D lattices in cartesian
+coordinates are supported.
+
+Parameters
+----------
+* `levels` : integer
+    Number of levels, the lattice of the solver included; its dimensions must
+    be divisible by 2^(levels - 1).
+* `tolerance` : float
+    Tolerance of `find_ground_state` on the lattice of the solver.
+* `max_iterations` : integer
+    Maximum number of time steps on each level.
+* `check_steps` : integer,optional (default: 100)
+    Time steps between two checks of the energy and of the residual norm.
+* `time_step_levels` : integer,optional (default: 3)
+    Number of time steps of the schedule on the coarsest level.
+* `time_step_factor` : float,optional (default: 0.5)
+    Factor multiplying the time step from a level of the schedule to the next.
+
+Returns
+-------
+* `find_ground_state_multilevel` : integer
+    The number of time steps evolved on the lattice of the solver, negative if
+    the ground state was not reached; `get_coarse_iterations` returns those of
+    the coarser levels.
+";
+
+%feature("docstring") Solver::get_coarse_iterations "
+
+Get the number of time steps evolved on the coarser levels by the last call of
+`find_ground_state_multilevel`.
+
+Returns
+-------
+* `get_coarse_iterations` : integer
+    Time steps of the coarser levels.
+";
+
+%feature("docstring") Solver::minimize_energy "
+
+Find the ground state by minimizing the energy functional directly, with the
+preconditioned nonlinear conjugate gradient, at the squared norm of each
+component of the initial state (of the total state with a Rabi coupling). The
+Hamiltonian is discretized as in the energy expectation values, without time
+step: the result does not depend on `delta_t`. The preconditioner approximates
+the inverse of the kinetic term with a few Chebyshev steps. Only lattices in
+cartesian coordinates are supported.
+
+Parameters
+----------
+* `tolerance` : float
+    Squared norm of the residual H psi - mu psi per particle, relative to the
+    squared energy per particle, below which the state is the ground state.
+* `max_iterations` : integer
+    Maximum number of iterations of the conjugate gradient.
+* `preconditioner_steps` : integer,optional (default: 4)
+    Steps of the Chebyshev iteration of the preconditioner; 0 for none.
+
+Returns
+-------
+* `minimize_energy` : integer
+    The number of iterations, negative if the ground state was not reached
+    within `max_iterations`.
+";
+
+%feature("docstring") Solver::find_eigenstates "
+
+Find the lowest eigenstates of a linear single-component Hamiltonian without
+rotation: the states of the block evolve together in imaginary time, with the
+exponentials of the potential and the cached blocks of a single kernel, and are
+orthonormalized by Gram-Schmidt in their order every `orthogonalization_steps`
+time steps, with the overlaps of all the pairs from a single reduction. Every
+`check_steps` time steps they are rotated to the eigenstates of the Hamiltonian
+within the block, which also resolves degenerate levels. Only lattices in
+cartesian coordinates are supported.
+
+Parameters
+----------
+* `states` : list of State objects
+    The initial guesses, linearly independent, on the lattice of the solver;
+    on return, the eigenstates sorted by energy and normalized to one.
+* `tolerance` : float
+    Relative change of every energy over `check_steps` below which the block
+    is converged.
+* `max_iterations` : integer
+    Maximum number of time steps.
+* `orthogonalization_steps` : integer,optional (default: 10)
+    Time steps between two orthonormalizations of the block.
+* `check_steps` : integer,optional (default: 100)
+    Time steps between two checks of the energies.
+
+Returns
+-------
+* `iterations` : integer
+    The number of time steps evolved, negative if the block did not converge
+    within `max_iterations`.
+* `energies` : list of floats
+    The energies of the eigenstates, in ascending order.
+";
+
+%feature("docstring") pin_threads "
+
+Pin each OpenMP thread to a core: the physical cores first, one NUMA node
+after the other. The buffers of the states, of the solver and of the kernel
+are first touched by the threads that later evolve them, so pin the threads
+before creating the states.
+
+Returns
+-------
+* `pin_threads` : string
+    The placement of the threads (see `get_thread_placement`).
+";
+
+%feature("docstring") get_thread_placement "
+
+Report the core and NUMA node each OpenMP thread runs on.
+
+Returns
+-------
+* `get_thread_placement` : string
+    One line for each thread.
+";
+
 %feature("docstring") Solver::get_rabi_energy "
 
 Get the Rabi energy of the system.
@@ -851,7 +1138,16 @@ Parameters
 * `delta_t` : float 
     A single evolution iteration, evolves the state for this time.  
 * `kernel_type` : string,optional (default: 'cpu') 
-    Which kernel to use (either cpu or gpu).  
+    Which kernel to use (cpu, cpu-auto, cpu-float, adi, chebyshev, fft or gpu). The
+    cpu-auto kernel times a few geometries of the cached blocks in the first
+    steps and keeps the fastest. The cpu-float kernel stores the wave functions
+    in single precision between the steps, and evolves them in double precision.
+    The adi kernel evolves a single component without rotation by implicit
+    Crank-Nicolson kinetic steps, stable for any time step.
+    The chebyshev kernel expands the evolution operator of a linear Hamiltonian
+    with a static potential in Chebyshev polynomials, exact at any time step.
+    The fft kernel evolves a single component without rotation on a periodic
+    lattice by the split-step Fourier method, with the exact kinetic term.  
 
 Returns
 -------
@@ -900,7 +1196,10 @@ Parameters
 * `delta_t` : float
     A single evolution iteration, evolves the state for this time.  
 * `kernel_type` : string,optional (default: 'cpu') 
-    Which kernel to use (either cpu or gpu).  
+    Which kernel to use (cpu, cpu-auto, cpu-float or gpu). The cpu-auto
+    kernel times a few geometries of the cached blocks in the first steps and
+    keeps the fastest. The cpu-float kernel stores the wave functions in
+    single precision between the steps, and evolves them in double precision.  
 
 Returns
 -------
@@ -1,5 +1,6 @@
 %module trottersuzuki
 %include <std_string.i>
+%include <std_vector.i>
 %include "docstring.i"
 %{
 #define SWIG_FILE_WITH_INIT
@@ -46,7 +47,7 @@ public:
 
 class Lattice1D: public Lattice {
 public:
-    Lattice1D(int dim, double length, bool periodic_x_axis=false, std::string coordinate_system="cartesian");
+    Lattice1D(int dim, double length, bool periodic_x_axis=false, std::string coordinate_system="cartesian", int kinetic_order=2);
 };
 
 
@@ -54,7 +55,8 @@ class Lattice2D: public Lattice {
 public:
     Lattice2D(int dim_x, double length_x, int dim_y, double length_y,
               bool periodic_x_axis=false, bool periodic_y_axis=false,
-              double angular_velocity=0., std::string coordinate_system="cartesian");
+              double angular_velocity=0., std::string coordinate_system="cartesian",
+              int steps_per_block=1, int kinetic_order=2);
 };
 
 class State{
@@ -142,6 +144,9 @@ protected:
     double norm2;
 };
 
+%template(StateVector) std::vector<State*>;
+%template(DoubleVector) std::vector<double>;
+
 class ExponentialState: public State {
 public:
     ExponentialState(Lattice1D *grid, int n_x = 1, double norm = 1, double phase = 0, double *p_real = 0, double *p_imag = 0);
@@ -216,6 +221,7 @@ public:
     }
     virtual double get_value(int x, int y);
     bool update(double t);
+    void set_lattice(Lattice *grid);
     bool updated_potential_matrix;
 protected:
     double current_evolution_time;
@@ -223,6 +229,9 @@ protected:
     double (*evolving_potential)(double x, double y, double t);
     bool self_init;
     bool is_static;
+    Lattice *matrix_grid;
+    double *lattice_matrix;
+    double *level_matrix;
 };
 
 class HarmonicPotential: public Potential {
@@ -251,6 +260,7 @@ public:
                 double _angular_velocity=0.,
                 double _rot_coord_x=0, double _rot_coord_y=0);
     ~Hamiltonian();
+    virtual void set_lattice(Lattice *grid);
 
 protected:
     bool self_init;
@@ -276,6 +286,7 @@ public:
                           double _rot_coord_x=0,
                           double _rot_coord_y=0);
     ~Hamiltonian2Component();
+    void set_lattice(Lattice *grid);
 };
 
 class Solver {
@@ -305,6 +316,22 @@ public:
     double get_rabi_energy(void);
     void set_exp_potential(double *exp_pot_real, int exp_pot_real_length, double *exp_pot_imag,
                            int exp_pot_imag_length, int which);
+    void set_sincos_accuracy(std::string accuracy);
+    size_t get_kernel_allocations(void);
+    void set_autotune_cache(std::string file_name);
+    void set_in_place(bool in_place);
+    void set_splitting_order(int order);
+    void set_mixed_precision(double energy_tolerance);
+    void set_delta_t(double delta_t);
+    double get_delta_t(void);
+    int find_ground_state(double tolerance, int max_iterations, int check_steps = 100,
+                          int time_step_levels = 3, double time_step_factor = 0.5);
+    int find_ground_state_multilevel(int levels, double tolerance, int max_iterations, int check_steps = 100,
+                                     int time_step_levels = 3, double time_step_factor = 0.5);
+    int get_coarse_iterations(void);
+    int minimize_energy(double tolerance, int max_iterations, int preconditioner_steps = 4);
+    int find_eigenstates(std::vector<State*> &states, std::vector<double> &energies, double tolerance, int max_iterations,
+                         int orthogonalization_steps = 10, int check_steps = 100);
 private:
     bool imag_time;
     double **external_pot_real;
@@ -313,8 +340,20 @@ private:
     double norm2[2];
     bool single_component;
     std::string kernel_type;
-    void initialize_exp_potential(double time_single_it, int which);
+    std::string sincos_accuracy;
+    std::string autotune_cache;
+    bool in_place;
+    double mixed_precision_tolerance;
+    int splitting_order;
+    double *middle_pot_real[2];
+    double *middle_pot_imag[2];
+    void initialize_exp_potential(double time_single_it, int which, double *pot_real, double *pot_imag);
+    void initialize_exp_potentials(int which);
     void init_kernel();
+    void evolve_mixed_precision(int iterations);
+    double update_snapshot(double *snapshot);
+    void rescale_state(State *level_state, double norm2);
+    void delete_level_lattice(Lattice2D *level_grid);
     double total_energy;
     double kinetic_energy[2];
     double tot_kinetic_energy;
@@ -331,3 +370,6 @@ private:
     bool energy_expected_values_updated;
     void calculate_energy_expected_values(void);
 };
+
+std::string pin_threads();
+std::string get_thread_placement();
@@ -0,0 +1,397 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+#include "kernel.h"
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// Systems swept together by the Thomas algorithm, one per SIMD lane
+#define ADI_BATCH 8
+
+// LU factorization with partial pivoting of a dense complex matrix, row-major
+static void factor_lu(int n, complex<double> *matrix, int *permutation) {
+    for (int k = 0; k < n; k++) {
+        int pivot = k;
+        for (int i = k + 1; i < n; i++) {
+            if (abs(matrix[i * n + k]) > abs(matrix[pivot * n + k])) {
+                pivot = i;
+            }
+        }
+        if (abs(matrix[pivot * n + k]) == 0.) {
+            my_abort("The reduced system of the implicit kernel is singular.");
+        }
+        permutation[k] = pivot;
+        for (int j = 0; j < n; j++) {
+            swap(matrix[k * n + j], matrix[pivot * n + j]);
+        }
+        for (int i = k + 1; i < n; i++) {
+            matrix[i * n + k] /= matrix[k * n + k];
+            for (int j = k + 1; j < n; j++) {
+                matrix[i * n + j] -= matrix[i * n + k] * matrix[k * n + j];
+            }
+        }
+    }
+}
+
+static void solve_lu(int n, const complex<double> *matrix, const int *permutation, complex<double> *values) {
+    for (int k = 0; k < n; k++) {
+        swap(values[k], values[permutation[k]]);
+        for (int i = k + 1; i < n; i++) {
+            values[i] -= matrix[i * n + k] * values[k];
+        }
+    }
+    for (int k = n - 1; k >= 0; k--) {
+        for (int j = k + 1; j < n; j++) {
+            values[k] -= matrix[k * n + j] * values[j];
+        }
+        values[k] /= matrix[k * n + k];
+    }
+}
+
+ADIKernel::ADIKernel(Lattice *_grid, State *state, Hamiltonian *_hamiltonian, double *_external_pot_real, double *_external_pot_imag,
+                     double delta_t, double _norm, bool _imag_time, int _sincos_accuracy):
+    grid(_grid), hamiltonian(_hamiltonian), imag_time(_imag_time), sincos_accuracy(_sincos_accuracy), norm(_norm),
+    external_pot_real(_external_pot_real), external_pot_imag(_external_pot_imag), steps_per_call(1), allocations(0) {
+    halos = new StencilHamiltonian(grid, hamiltonian, false);
+    int tile_width = grid->end_x - grid->start_x;
+    int tile_height = grid->end_y - grid->start_y;
+    int inner_x = grid->inner_start_x - grid->start_x;
+    int inner_y = grid->inner_start_y - grid->start_y;
+    directions = grid->global_no_halo_dim_y > 1 ? 2 : 1;
+    for (int d = 0; d < directions; d++) {
+        implicit_direction &solver = direction[d];
+        // Rows solve along x, the second axis of the MPI topology; columns along y, the first one
+        bool along_x = d == 0;
+        solver.length = along_x ? grid->inner_end_x - grid->inner_start_x : grid->inner_end_y - grid->inner_start_y;
+        solver.systems = along_x ? grid->inner_end_y - grid->inner_start_y : grid->inner_end_x - grid->inner_start_x;
+        solver.offset = inner_y * tile_width + inner_x;
+        solver.step = along_x ? 1 : tile_width;
+        solver.system_step = along_x ? tile_width : 1;
+        solver.before = along_x ? inner_x > 0 : inner_y > 0;
+        solver.after = along_x ? grid->inner_end_x < grid->end_x : grid->inner_end_y < grid->end_y;
+        solver.ranks = 1;
+        solver.rank = 0;
+#ifdef HAVE_MPI
+        int remain[2] = {along_x ? 0 : 1, along_x ? 1 : 0};
+        MPI_Cart_sub(grid->cartcomm, remain, &solver.comm);
+        MPI_Comm_size(solver.comm, &solver.ranks);
+        MPI_Comm_rank(solver.comm, &solver.rank);
+#endif
+        bool periodic = grid->periods[along_x ? 1 : 0] != 0;
+        solver.seams = periodic ? solver.ranks : solver.ranks - 1;
+        solver.block = solver.rank < solver.seams ? solver.length - 1 : solver.length;
+        if (solver.block < 1) {
+            my_abort("The tiles are too narrow for the implicit kernel.");
+        }
+        solver.local.resize(6 * solver.systems);
+        solver.gathered.resize(6 * solver.systems * solver.ranks);
+    }
+
+    size_t tile_size = tile_width * tile_height;
+    buffers = allocate_aligned(2 * tile_size);
+    ++allocations;
+    for (int k = 0; k < 2; k++) {
+        psi[k] = buffers + k * tile_size;
+        first_touch(psi[k], tile_width, tile_height);
+    }
+    memcpy(psi[0], state->p_real, tile_size * sizeof(double));
+    memcpy(psi[1], state->p_imag, tile_size * sizeof(double));
+    halos->exchange_halos(psi[0], psi[1]);
+    set_time_step(delta_t);
+}
+
+ADIKernel::~ADIKernel() {
+    free_aligned(buffers);
+    delete halos;
+#ifdef HAVE_MPI
+    for (int d = 0; d < directions; d++) {
+        MPI_Comm_free(&direction[d].comm);
+    }
+#endif
+}
+
+void ADIKernel::set_time_step(double delta_t) {
+    coupling = hamiltonian->coupling_a * delta_t;
+    LeeHuangYang_coupling = hamiltonian->LeeHuangYang_coupling_a * delta_t;
+    // Half a time step of kinetic evolution on either side of the potential
+    init_direction(direction[0], 0.5 * delta_t, grid->delta_x);
+    if (directions == 2) {
+        init_direction(direction[1], 0.5 * delta_t, grid->delta_y);
+    }
+}
+
+/**
+ * The Crank-Nicolson step of duration tau along a direction solves
+ * (1 + i tau K / 2) psi' = (1 - i tau K / 2) psi, with tau K / 2 = beta (2 - S - S^-1)
+ * for the shifts S along the direction, and beta = tau / (4 m h^2); imaginary
+ * time drops the factor i. The block of each tile has zero values beyond its
+ * ends, and its response to unit values there enters the reduced system of the
+ * seams: the equation of each seam involves the last dot of the block before it
+ * and the first one of the block after it.
+ */
+void ADIKernel::init_direction(implicit_direction &solver, double tau, double spacing) {
+    double beta = tau / (4. * hamiltonian->mass * spacing * spacing);
+    complex<double> gamma = imag_time ? complex<double>(beta, 0.) : complex<double>(0., beta);
+    solver.diagonal = 1. + 2. * gamma;
+    solver.off_diagonal = -gamma;
+    int block = solver.block;
+    complex<double> off = solver.off_diagonal;
+    solver.pivots.resize(block);
+    solver.pivots[0] = 1. / solver.diagonal;
+    for (int j = 1; j < block; j++) {
+        solver.pivots[j] = 1. / (solver.diagonal - off * off * solver.pivots[j - 1]);
+    }
+    // Responses to a unit value before the first dot and after the last one
+    vector<complex<double> > *responses[2] = {&solver.left_response, &solver.right_response};
+    for (int side = 0; side < 2; side++) {
+        vector<complex<double> > &x = *responses[side];
+        x.assign(block, 0.);
+        x[side == 0 ? 0 : block - 1] = -off;
+        x[0] *= solver.pivots[0];
+        for (int j = 1; j < block; j++) {
+            x[j] = (x[j] - off * x[j - 1]) * solver.pivots[j];
+        }
+        for (int j = block - 2; j >= 0; j--) {
+            x[j] -= off * solver.pivots[j] * x[j + 1];
+        }
+    }
+
+    int ranks = solver.ranks, seams = solver.seams;
+    if (seams == 0) {
+        return;
+    }
+    double responses_local[8] = {solver.left_response[0].real(), solver.left_response[0].imag(),
+                                 solver.left_response[block - 1].real(), solver.left_response[block - 1].imag(),
+                                 solver.right_response[0].real(), solver.right_response[0].imag(),
+                                 solver.right_response[block - 1].real(), solver.right_response[block - 1].imag()
+                                };
+    vector<double> responses_all(8 * ranks);
+#ifdef HAVE_MPI
+    MPI_Allgather(responses_local, 8, MPI_DOUBLE, &responses_all[0], 8, MPI_DOUBLE, solver.comm);
+#else
+    memcpy(&responses_all[0], responses_local, 8 * sizeof(double));
+#endif
+    solver.reduced.assign(seams * seams, 0.);
+    for (int p = 0; p < seams; p++) {
+        int q = (p + 1) % ranks;
+        const double *own = &responses_all[8 * p], *next = &responses_all[8 * q];
+        complex<double> left_last(own[2], own[3]), right_last(own[6], own[7]);
+        complex<double> left_first(next[0], next[1]), right_first(next[4], next[5]);
+        solver.reduced[p * seams + p] += solver.diagonal + off * right_last + off * left_first;
+        if (p > 0 || seams == ranks) {
+            solver.reduced[p * seams + (p + ranks - 1) % ranks] += off * left_last;
+        }
+        if (q < seams) {
+            solver.reduced[p * seams + q] += off * right_first;
+        }
+    }
+    solver.permutation.resize(seams);
+    factor_lu(seams, &solver.reduced[0], &solver.permutation[0]);
+}
+
+/**
+ * Batches of ADI_BATCH systems are swept together, so that the steps of the
+ * Thomas algorithm along the columns load contiguous dots. The right-hand side
+ * is formed on the fly from the previous values of the neighbour dots, the
+ * halos at the ends of the tile. With seams, the first and last dot of each
+ * block and the right-hand side of the seam are gathered from the processes
+ * sharing the systems, each of which solves the reduced system of every system
+ * and adds the responses to the values of the seams around its block.
+ */
+void ADIKernel::solve_direction(implicit_direction &solver) {
+    int block = solver.block, length = solver.length, step = solver.step;
+    int seams = solver.seams, ranks = solver.ranks, rank = solver.rank;
+    bool seam = rank < seams;
+    double diagonal_real = solver.diagonal.real(), diagonal_imag = solver.diagonal.imag();
+    double off_real = solver.off_diagonal.real(), off_imag = solver.off_diagonal.imag();
+    const complex<double> *pivots = &solver.pivots[0];
+    int batches = (solver.systems + ADI_BATCH - 1) / ADI_BATCH;
+
+    #pragma omp parallel for
+    for (int batch = 0; batch < batches; batch++) {
+        int first = batch * ADI_BATCH;
+        int count = min(ADI_BATCH, solver.systems - first);
+        double *real[ADI_BATCH], *imag[ADI_BATCH];
+        double previous_real[ADI_BATCH], previous_imag[ADI_BATCH];
+        double solved_real[ADI_BATCH], solved_imag[ADI_BATCH];
+        for (int b = 0; b < count; b++) {
+            size_t start = solver.offset + (first + b) * solver.system_step;
+            real[b] = psi[0] + start;
+            imag[b] = psi[1] + start;
+            previous_real[b] = solver.before ? real[b][-step] : 0.;
+            previous_imag[b] = solver.before ? imag[b][-step] : 0.;
+            solved_real[b] = solved_imag[b] = 0.;
+        }
+        if (seam) {
+            // Right-hand side of the seam, before its neighbour in the block is overwritten
+            for (int b = 0; b < count; b++) {
+                double *re = real[b] + block * step, *im = imag[b] + block * step;
+                double next_real = block + 1 < length || solver.after ? re[step] : 0.;
+                double next_imag = block + 1 < length || solver.after ? im[step] : 0.;
+                double sum_real = re[-step] + next_real, sum_imag = im[-step] + next_imag;
+                double *rhs = &solver.local[6 * (first + b) + 4];
+                rhs[0] = (2. - diagonal_real) * re[0] + diagonal_imag * im[0] - off_real * sum_real + off_imag * sum_imag;
+                rhs[1] = (2. - diagonal_real) * im[0] - diagonal_imag * re[0] - off_real * sum_imag - off_imag * sum_real;
+            }
+        }
+        // Forward elimination, the right-hand side (2 - D) psi - O (psi_-1 + psi_+1) formed on the fly
+        for (int j = 0; j < block; j++) {
+            bool next_inside = j + 1 < length || solver.after;
+            double pivot_real = pivots[j].real(), pivot_imag = pivots[j].imag();
+            size_t index = j * step;
+            for (int b = 0; b < count; b++) {
+                double re = real[b][index], im = imag[b][index];
+                double sum_real = previous_real[b] + (next_inside ? real[b][index + step] : 0.);
+                double sum_imag = previous_imag[b] + (next_inside ? imag[b][index + step] : 0.);
+                double rhs_real = (2. - diagonal_real) * re + diagonal_imag * im - off_real * sum_real + off_imag * sum_imag;
+                double rhs_imag = (2. - diagonal_real) * im - diagonal_imag * re - off_real * sum_imag - off_imag * sum_real;
+                rhs_real -= off_real * solved_real[b] - off_imag * solved_imag[b];
+                rhs_imag -= off_real * solved_imag[b] + off_imag * solved_real[b];
+                solved_real[b] = rhs_real * pivot_real - rhs_imag * pivot_imag;
+                solved_imag[b] = rhs_real * pivot_imag + rhs_imag * pivot_real;
+                previous_real[b] = re;
+                previous_imag[b] = im;
+                real[b][index] = solved_real[b];
+                imag[b][index] = solved_imag[b];
+            }
+        }
+        // Back substitution
+        for (int j = block - 2; j >= 0; j--) {
+            complex<double> factor = solver.off_diagonal * pivots[j];
+            double factor_real = factor.real(), factor_imag = factor.imag();
+            size_t index = j * step;
+            for (int b = 0; b < count; b++) {
+                double next_real = real[b][index + step], next_imag = imag[b][index + step];
+                real[b][index] -= factor_real * next_real - factor_imag * next_imag;
+                imag[b][index] -= factor_real * next_imag + factor_imag * next_real;
+            }
+        }
+        for (int b = 0; b < count; b++) {
+            double *values = &solver.local[6 * (first + b)];
+            values[0] = real[b][0];
+            values[1] = imag[b][0];
+            values[2] = real[b][(block - 1) * step];
+            values[3] = imag[b][(block - 1) * step];
+        }
+    }
+    if (seams == 0) {
+        return;
+    }
+
+#ifdef HAVE_MPI
+    MPI_Allgather(&solver.local[0], solver.local.size(), MPI_DOUBLE, &solver.gathered[0], solver.local.size(), MPI_DOUBLE, solver.comm);
+#else
+    memcpy(&solver.gathered[0], &solver.local[0], solver.local.size() * sizeof(double));
+#endif
+    int left_seam = rank > 0 || seams == ranks ? (rank + ranks - 1) % ranks : -1;
+    complex<double> off = solver.off_diagonal;
+    size_t stride = solver.local.size();
+    #pragma omp parallel
+    {
+        vector<complex<double> > values(seams);
+        #pragma omp for
+        for (int system = 0; system < solver.systems; system++) {
+            for (int p = 0; p < seams; p++) {
+                const double *own = &solver.gathered[p * stride + 6 * system];
+                const double *next = &solver.gathered[((p + 1) % ranks) * stride + 6 * system];
+                values[p] = complex<double>(own[4], own[5]) - off * complex<double>(own[2], own[3]) - off * complex<double>(next[0], next[1]);
+            }
+            solve_lu(seams, &solver.reduced[0], &solver.permutation[0], &values[0]);
+            complex<double> left = left_seam >= 0 ? values[left_seam] : 0.;
+            complex<double> right = seam ? values[rank] : 0.;
+            double *re = psi[0] + solver.offset + system * solver.system_step;
+            double *im = psi[1] + solver.offset + system * solver.system_step;
+            for (int j = 0; j < block; j++) {
+                complex<double> correction = left * solver.left_response[j] + right * solver.right_response[j];
+                re[j * step] += correction.real();
+                im[j * step] += correction.imag();
+            }
+            if (seam) {
+                re[block * step] = right.real();
+                im[block * step] = right.imag();
+            }
+        }
+    }
+}
+
+void ADIKernel::apply_potential() {
+    int tile_width = grid->end_x - grid->start_x;
+    int width = grid->inner_end_x - grid->inner_start_x;
+    int offset = (grid->inner_start_y - grid->start_y) * tile_width + grid->inner_start_x - grid->start_x;
+    #pragma omp parallel for
+    for (int i = 0; i < grid->inner_end_y - grid->inner_start_y; ++i) {
+        size_t index = offset + i * tile_width;
+        if (imag_time) {
+            block_kernel_potential_imaginary(false, tile_width, width, 1, coupling, 0., LeeHuangYang_coupling, tile_width,
+                                             external_pot_real + index, external_pot_imag + index, NULL, NULL, psi[0] + index, psi[1] + index);
+        }
+        else {
+            block_kernel_potential(sincos_accuracy, false, tile_width, width, 1, coupling, 0., LeeHuangYang_coupling, tile_width,
+                                   external_pot_real + index, external_pot_imag + index, NULL, NULL, psi[0] + index, psi[1] + index);
+        }
+    }
+}
+
+void ADIKernel::run_kernel_on_halo() {}
+
+/**
+ * Half a kinetic step along x and y, the potential, and the other half in the
+ * reverse order; each kinetic step reads the halos the previous one left stale.
+ */
+void ADIKernel::run_kernel() {
+    for (int step_index = 0; step_index < steps_per_call; step_index++) {
+        solve_direction(direction[0]);
+        if (directions == 2) {
+            halos->exchange_halos(psi[0], psi[1]);
+            solve_direction(direction[1]);
+        }
+        apply_potential();
+        halos->exchange_halos(psi[0], psi[1]);
+        if (directions == 2) {
+            solve_direction(direction[1]);
+            halos->exchange_halos(psi[0], psi[1]);
+        }
+        solve_direction(direction[0]);
+        halos->exchange_halos(psi[0], psi[1]);
+    }
+}
+
+void ADIKernel::set_steps_per_call(int steps) {
+    steps_per_call = steps;
+}
+
+void ADIKernel::update_potential(double *_external_pot_real, double *_external_pot_imag, int which) {
+    external_pot_real = _external_pot_real;
+    external_pot_imag = _external_pot_imag;
+}
+
+double ADIKernel::calculate_squared_norm(bool global) const {
+    return halos->squared_norm(psi[0], psi[1], global);
+}
+
+void ADIKernel::wait_for_completion() {
+    if (imag_time && norm != 0) {
+        halos->normalize(psi[0], psi[1], norm);
+    }
+}
+
+void ADIKernel::get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2, double * dest_imag2) const {
+    halos->get_sample(psi[0], psi[1], dest_stride, x, y, width, height, dest_real, dest_imag);
+}
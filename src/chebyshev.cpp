@@ -0,0 +1,207 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+#include "kernel.h"
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// Coefficients below this modulus end the expansion: the Chebyshev polynomials
+// of the rescaled Hamiltonian have norm at most one
+#define CHEBYSHEV_TOLERANCE 1.e-16
+// Rescaling of the backward recurrences of the Bessel functions before they overflow
+#define BESSEL_OVERFLOW 1.e250
+
+/**
+ * Bessel functions J_k(z) in real time, or the scaled modified ones
+ * exp(-z) I_k(z) in imaginary time, for k = 0, ..., count - 1, by the backward
+ * recurrence from an order well beyond the decay of both, normalized by the
+ * identities J_0 + 2 sum J_2k = 1 and I_0 + 2 sum I_k = exp(z).
+ */
+static void bessel_functions(bool modified, double z, int count, double *values) {
+    int start = count + 20;
+    double next = 0., current = 1.e-300, sum = 0.;
+    for (int k = start; k > 0; k--) {
+        double previous = 2. * k / z * current + (modified ? next : -next);
+        next = current;
+        current = previous;
+        if (k - 1 < count) {
+            values[k - 1] = current;
+        }
+        if (modified || (k - 1) % 2 == 0) {
+            sum += k - 1 == 0 ? current : 2. * current;
+        }
+        if (fabs(current) > BESSEL_OVERFLOW) {
+            next /= BESSEL_OVERFLOW;
+            current /= BESSEL_OVERFLOW;
+            sum /= BESSEL_OVERFLOW;
+            for (int j = k - 1; j < min(start, count); j++) {
+                values[j] /= BESSEL_OVERFLOW;
+            }
+        }
+    }
+    for (int k = 0; k < count; k++) {
+        values[k] /= sum;
+    }
+}
+
+ChebyshevKernel::ChebyshevKernel(Lattice *_grid, State *state, Hamiltonian *hamiltonian, double delta_t,
+                                 double _norm, bool _imag_time):
+    grid(_grid), imag_time(_imag_time), norm(_norm), steps_per_call(1), allocations(0) {
+    stencil = new StencilHamiltonian(grid, hamiltonian, false);
+    double lower, upper;
+    stencil->get_spectral_bounds(0, &lower, &upper);
+    center = 0.5 * (upper + lower);
+    half_width = 0.5 * (upper - lower);
+
+    size_t tile_size = stencil->get_tile_size();
+    int tile_width = grid->end_x - grid->start_x;
+    buffers = allocate_aligned(8 * tile_size);
+    ++allocations;
+    double **fields[4] = {psi, previous, current, h};
+    for (int f = 0; f < 4; f++) {
+        for (int k = 0; k < 2; k++) {
+            fields[f][k] = buffers + (2 * f + k) * tile_size;
+            first_touch(fields[f][k], tile_width, tile_size / tile_width);
+        }
+    }
+    memcpy(psi[0], state->p_real, tile_size * sizeof(double));
+    memcpy(psi[1], state->p_imag, tile_size * sizeof(double));
+    set_time_step(delta_t);
+}
+
+ChebyshevKernel::~ChebyshevKernel() {
+    free_aligned(buffers);
+    delete stencil;
+}
+
+/**
+ * exp(-i H dt) = exp(-i a dt) (J_0(b dt) + 2 sum (-i)^k J_k(b dt) T_k((H - a) / b))
+ * and exp(-H dt) = exp(-a dt) (I_0(b dt) + 2 sum (-1)^k I_k(b dt) T_k((H - a) / b)),
+ * with a the center of the spectrum and b its half width; both Bessel series
+ * fall off faster than exponentially beyond the order b dt.
+ */
+void ChebyshevKernel::set_time_step(double delta_t) {
+    double z = half_width * delta_t;
+    int count = (int)(z + 10. * sqrt(z)) + 40;
+    vector<double> bessel(count);
+    if (z > 0.) {
+        bessel_functions(imag_time, z, count, &bessel[0]);
+    }
+    else {
+        bessel[0] = 1.;
+    }
+    // The modified Bessel functions come scaled by exp(-z), which moves the
+    // prefactor to the bottom of the spectrum
+    complex<double> prefactor = imag_time ? exp(-(center - half_width) * delta_t) : exp(complex<double>(0., -center * delta_t));
+    complex<double> power = 1.;
+    coefficients.clear();
+    for (int k = 0; k < count; k++) {
+        complex<double> coefficient = prefactor * power * (k == 0 ? 1. : 2.) * bessel[k];
+        coefficients.push_back(coefficient.real());
+        coefficients.push_back(coefficient.imag());
+        power *= imag_time ? complex<double>(-1., 0.) : complex<double>(0., -1.);
+    }
+    while (coefficients.size() > 2 &&
+            abs(complex<double>(coefficients[coefficients.size() - 2], coefficients.back())) < CHEBYSHEV_TOLERANCE * abs(prefactor)) {
+        coefficients.resize(coefficients.size() - 2);
+    }
+}
+
+void ChebyshevKernel::set_steps_per_call(int steps) {
+    steps_per_call = steps;
+}
+
+/**
+ * The three term recurrence T_k+1 = 2 H' T_k - T_k-1 of the rescaled
+ * Hamiltonian H' = (H - a) / b overwrites the vector of order k - 1 with that
+ * of order k + 1, and adds it to the wave function in the same pass.
+ */
+void ChebyshevKernel::step() {
+    int tile_width = grid->end_x - grid->start_x;
+    size_t tile_size = stencil->get_tile_size();
+    int terms = coefficients.size() / 2;
+    const double *c = &coefficients[0];
+    memcpy(current[0], psi[0], tile_size * sizeof(double));
+    memcpy(current[1], psi[1], tile_size * sizeof(double));
+    for (int k = 1; k < terms; k++) {
+        stencil->apply(0, current[0], current[1], h[0], h[1]);
+        double scale = (k == 1 ? 1. : 2.) / half_width;
+        double keep = k == 1 ? 0. : -1.;
+        double c_real = c[2 * k], c_imag = c[2 * k + 1];
+        double c0_real = c[0], c0_imag = c[1];
+        #pragma omp parallel for
+        for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
+            for (int j = grid->inner_start_x - grid->start_x; j < grid->inner_end_x - grid->start_x; ++j) {
+                size_t index = i * tile_width + j;
+                if (k == 1) {
+                    // The term of order zero, before the wave function is overwritten
+                    double re = psi[0][index], im = psi[1][index];
+                    psi[0][index] = c0_real * re - c0_imag * im;
+                    psi[1][index] = c0_real * im + c0_imag * re;
+                }
+                double next_real = scale * (h[0][index] - center * current[0][index]) + keep * previous[0][index];
+                double next_imag = scale * (h[1][index] - center * current[1][index]) + keep * previous[1][index];
+                previous[0][index] = next_real;
+                previous[1][index] = next_imag;
+                psi[0][index] += c_real * next_real - c_imag * next_imag;
+                psi[1][index] += c_real * next_imag + c_imag * next_real;
+            }
+        }
+        swap(previous[0], current[0]);
+        swap(previous[1], current[1]);
+        if (k < terms - 1) {
+            stencil->exchange_halos(current[0], current[1]);
+        }
+    }
+    if (terms == 1) {
+        #pragma omp parallel for
+        for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
+            for (int j = grid->inner_start_x - grid->start_x; j < grid->inner_end_x - grid->start_x; ++j) {
+                size_t index = i * tile_width + j;
+                double re = psi[0][index], im = psi[1][index];
+                psi[0][index] = c[0] * re - c[1] * im;
+                psi[1][index] = c[0] * im + c[1] * re;
+            }
+        }
+    }
+    stencil->exchange_halos(psi[0], psi[1]);
+}
+
+void ChebyshevKernel::run_kernel_on_halo() {}
+
+void ChebyshevKernel::run_kernel() {
+    for (int step_index = 0; step_index < steps_per_call; step_index++) {
+        step();
+    }
+}
+
+double ChebyshevKernel::calculate_squared_norm(bool global) const {
+    return stencil->squared_norm(psi[0], psi[1], global);
+}
+
+void ChebyshevKernel::wait_for_completion() {
+    if (imag_time && norm != 0) {
+        stencil->normalize(psi[0], psi[1], norm);
+    }
+}
+
+void ChebyshevKernel::get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2, double * dest_imag2) const {
+    stencil->get_sample(psi[0], psi[1], dest_stride, x, y, width, height, dest_real, dest_imag);
+}
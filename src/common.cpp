@@ -20,6 +20,21 @@
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#endif
 #include "trottersuzuki.h"
 #include "common.h"
 
@@ -116,6 +131,419 @@ void my_abort(string err) {
 #endif
 }
 
+#ifdef HAVE_MPI
+// The OpenMP threads of a process never call MPI, so the funneled level is enough
+void check_mpi_thread_support() {
+#ifdef _OPENMP
+    static bool checked = false;
+    if (checked) {
+        return;
+    }
+    checked = true;
+    int provided = MPI_THREAD_SINGLE, rank = 0;
+    MPI_Query_thread(&provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (provided < MPI_THREAD_FUNNELED && omp_get_max_threads() > 1 && rank == 0) {
+        cerr << "Warning: MPI was initialized without thread support; "
+             << "call MPI_Init_thread with MPI_THREAD_FUNNELED to run OpenMP threads in each process." << endl;
+    }
+#endif
+}
+#endif
+
+double *allocate_aligned(size_t count) {
+    void *buffer = NULL;
+#ifdef _WIN32
+    buffer = _aligned_malloc(count * sizeof(double), MEMORY_ALIGNMENT);
+#else
+    if (posix_memalign(&buffer, MEMORY_ALIGNMENT, count * sizeof(double)) != 0) {
+        buffer = NULL;
+    }
+#endif
+    if (buffer == NULL) {
+        my_abort("Unable to allocate an aligned buffer.");
+    }
+    return static_cast<double *>(buffer);
+}
+
+// Zero a buffer of height rows with the static partition of the rows among the
+// threads that the CPU kernel uses for its bands: the pages of a band are then
+// placed on the NUMA node of the thread that evolves it. A single row is a 1D
+// chain, whose segments are statically partitioned instead.
+template <typename T>
+static void first_touch_values(T *buffer, size_t width, size_t height) {
+    if (height == 1) {
+        #pragma omp parallel for schedule(static)
+        for (int x = 0; x < int(width); ++x) {
+            buffer[x] = 0;
+        }
+        return;
+    }
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < int(height); ++y) {
+        memset(&buffer[y * width], 0, width * sizeof(T));
+    }
+}
+
+void first_touch(double *buffer, size_t width, size_t height) {
+    first_touch_values(buffer, width, height);
+}
+
+void first_touch(float *buffer, size_t width, size_t height) {
+    first_touch_values(buffer, width, height);
+}
+
+#ifdef __linux__
+// NUMA node of a core, -1 when the system does not tell
+static int numa_node(int cpu) {
+    for (int node = 0; ; ++node) {
+        stringstream node_path, cpu_path;
+        node_path << "/sys/devices/system/node/node" << node;
+        if (access(node_path.str().c_str(), F_OK) != 0) {
+            return -1;
+        }
+        cpu_path << node_path.str() << "/cpu" << cpu;
+        if (access(cpu_path.str().c_str(), F_OK) == 0) {
+            return node;
+        }
+    }
+}
+
+// Whether a core is the first hardware thread of its physical core
+static bool first_sibling(int cpu) {
+    stringstream path;
+    path << "/sys/devices/system/cpu/cpu" << cpu << "/topology/thread_siblings_list";
+    ifstream siblings(path.str().c_str());
+    int first = cpu;
+    siblings >> first;
+    return first == cpu;
+}
+#endif
+
+string pin_threads() {
+#if defined(__linux__) && defined(_OPENMP)
+    // The cores the process was allowed to run on at the first call
+    static cpu_set_t allowed;
+    static bool allowed_set = false;
+    if (!allowed_set) {
+        CPU_ZERO(&allowed);
+        sched_getaffinity(0, sizeof(allowed), &allowed);
+        allowed_set = true;
+    }
+    // Physical cores first, then their siblings, each group node after node
+    vector<vector<int> > cores;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            vector<int> core(3);
+            core[0] = first_sibling(cpu) ? 0 : 1;
+            core[1] = numa_node(cpu);
+            core[2] = cpu;
+            cores.push_back(core);
+        }
+    }
+    sort(cores.begin(), cores.end());
+    if (!cores.empty()) {
+        #pragma omp parallel
+        {
+            cpu_set_t core;
+            CPU_ZERO(&core);
+            CPU_SET(cores[omp_get_thread_num() % cores.size()][2], &core);
+            sched_setaffinity(0, sizeof(core), &core);
+        }
+    }
+#endif
+    return get_thread_placement();
+}
+
+string get_thread_placement() {
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    vector<int> cpus(threads, -1);
+#if defined(__linux__)
+    #pragma omp parallel
+    {
+        int thread = 0;
+#ifdef _OPENMP
+        thread = omp_get_thread_num();
+#endif
+        cpus[thread] = sched_getcpu();
+    }
+#endif
+    stringstream placement;
+#ifdef HAVE_MPI
+    int rank = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    placement << "Process " << rank << "\n";
+#endif
+    for (int thread = 0; thread < threads; ++thread) {
+        placement << "Thread " << thread << ": core ";
+        if (cpus[thread] < 0) {
+            placement << "unknown\n";
+            continue;
+        }
+        placement << cpus[thread];
+#ifdef __linux__
+        int node = numa_node(cpus[thread]);
+        if (node >= 0) {
+            placement << ", NUMA node " << node;
+        }
+#endif
+        placement << "\n";
+    }
+    return placement.str();
+}
+
+void free_aligned(double *buffer) {
+#ifdef _WIN32
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+// Global index of a dot of the tile, wrapped around periodic boundaries
+static int global_index(int start, int x, int length) {
+    return ((start + x) % length + length) % length;
+}
+
+// Inner dots that a tile owns along an axis: the inner dots of the last two
+// tiles overlap when the last one is narrower than the halo
+static void owned_dots(int inner_start, int inner_end, int length, int dims, int *start, int *end) {
+    *start = inner_start;
+    *end = max(min(inner_end, inner_start + (length + dims - 1) / dims), inner_start);
+}
+
+// Coarse dots around a fine one, between whose cell centers it is interpolated:
+// the interpolation wraps around periodic boundaries and is constant beyond
+// closed ones
+static void coarse_neighbours(int fine_index, int factor, int coarse_length, bool periodic,
+                              int *i0, int *i1, double *weight) {
+    double u = (fine_index + 0.5) / factor - 0.5;
+    *i0 = int(floor(u));
+    *i1 = *i0 + 1;
+    *weight = u - *i0;
+    if (periodic) {
+        *i0 = (*i0 + coarse_length) % coarse_length;
+        *i1 = *i1 % coarse_length;
+    }
+    else {
+        *i0 = max(*i0, 0);
+        *i1 = min(*i1, coarse_length - 1);
+    }
+}
+
+// Sorted global coarse indices along an axis that a tile reads: its own dots
+// when it is coarse, the neighbours of its dots when it is fine (factor > 1)
+static vector<int> read_indices(int start, int dim, int length, int factor, int coarse_length, bool periodic) {
+    vector<int> indices;
+    for (int x = 0; x < dim; ++x) {
+        int index = global_index(start, x, length);
+        if (factor == 1) {
+            indices.push_back(index);
+        }
+        else {
+            int i0, i1;
+            double weight;
+            coarse_neighbours(index, factor, coarse_length, periodic, &i0, &i1, &weight);
+            indices.push_back(i0);
+            indices.push_back(i1);
+        }
+    }
+    sort(indices.begin(), indices.end());
+    indices.erase(unique(indices.begin(), indices.end()), indices.end());
+    return indices;
+}
+
+// Position of each dot of a tile along an axis in the sorted indices it reads
+static vector<int> positions(const vector<int> &indices, int start, int dim, int length) {
+    vector<int> position(dim);
+    for (int x = 0; x < dim; ++x) {
+        position[x] = lower_bound(indices.begin(), indices.end(), global_index(start, x, length)) - indices.begin();
+    }
+    return position;
+}
+
+/**
+ * Every process holds the values of a rectangle of the global coarse lattice,
+ * [x0, x1) x [y0, y1) in rects, and reads the coarse dots listed in the sorted
+ * indices of its window. Each process sends every other one only the part of
+ * its rectangle within the window of the other, and sums what it receives
+ * into its window: the rectangles of the processes may share their edges.
+ */
+static void exchange_window(Lattice *grid, const vector<int> &rects, const double *values, int stride,
+                            const vector< vector<int> > &window_x, const vector< vector<int> > &window_y,
+                            double *window) {
+    int rank = grid->mpi_rank, procs = grid->mpi_procs;
+    const vector<int> &own_x = window_x[rank], &own_y = window_y[rank];
+    memset(window, 0, own_x.size() * own_y.size() * sizeof(double));
+    // Slice [lo, hi) of the sorted indices within [start, end)
+    const int *own = &rects[4 * rank];
+    vector<int> send_slices(4 * procs), receive_slices(4 * procs);
+    for (int r = 0; r < procs; r++) {
+        const int *other = &rects[4 * r];
+        send_slices[4 * r] = lower_bound(window_x[r].begin(), window_x[r].end(), own[0]) - window_x[r].begin();
+        send_slices[4 * r + 1] = lower_bound(window_x[r].begin(), window_x[r].end(), own[1]) - window_x[r].begin();
+        send_slices[4 * r + 2] = lower_bound(window_y[r].begin(), window_y[r].end(), own[2]) - window_y[r].begin();
+        send_slices[4 * r + 3] = lower_bound(window_y[r].begin(), window_y[r].end(), own[3]) - window_y[r].begin();
+        receive_slices[4 * r] = lower_bound(own_x.begin(), own_x.end(), other[0]) - own_x.begin();
+        receive_slices[4 * r + 1] = lower_bound(own_x.begin(), own_x.end(), other[1]) - own_x.begin();
+        receive_slices[4 * r + 2] = lower_bound(own_y.begin(), own_y.end(), other[2]) - own_y.begin();
+        receive_slices[4 * r + 3] = lower_bound(own_y.begin(), own_y.end(), other[3]) - own_y.begin();
+    }
+    const int *slice = &receive_slices[4 * rank];
+    for (int j = slice[2]; j < slice[3]; ++j) {
+        for (int i = slice[0]; i < slice[1]; ++i) {
+            window[j * own_x.size() + i] += values[(own_y[j] - own[2]) * stride + own_x[i] - own[0]];
+        }
+    }
+#ifdef HAVE_MPI
+    vector<int> send_counts(procs, 0), send_offsets(procs, 0), receive_counts(procs, 0), receive_offsets(procs, 0);
+    int send_total = 0, receive_total = 0;
+    for (int r = 0; r < procs; r++) {
+        if (r == rank) {
+            continue;
+        }
+        const int *send_slice = &send_slices[4 * r], *receive_slice = &receive_slices[4 * r];
+        send_offsets[r] = send_total;
+        send_counts[r] = max(send_slice[1] - send_slice[0], 0) * max(send_slice[3] - send_slice[2], 0);
+        send_total += send_counts[r];
+        receive_offsets[r] = receive_total;
+        receive_counts[r] = max(receive_slice[1] - receive_slice[0], 0) * max(receive_slice[3] - receive_slice[2], 0);
+        receive_total += receive_counts[r];
+    }
+    vector<double> send(send_total + 1), receive(receive_total + 1);
+    for (int r = 0; r < procs; r++) {
+        if (send_counts[r] == 0) {
+            continue;
+        }
+        const int *send_slice = &send_slices[4 * r];
+        double *packed = &send[send_offsets[r]];
+        for (int j = send_slice[2]; j < send_slice[3]; ++j) {
+            for (int i = send_slice[0]; i < send_slice[1]; ++i) {
+                *packed++ = values[(window_y[r][j] - own[2]) * stride + window_x[r][i] - own[0]];
+            }
+        }
+    }
+    MPI_Alltoallv(&send[0], &send_counts[0], &send_offsets[0], MPI_DOUBLE,
+                  &receive[0], &receive_counts[0], &receive_offsets[0], MPI_DOUBLE, grid->cartcomm);
+    for (int r = 0; r < procs; r++) {
+        if (receive_counts[r] == 0) {
+            continue;
+        }
+        const int *receive_slice = &receive_slices[4 * r];
+        const double *packed = &receive[receive_offsets[r]];
+        for (int j = receive_slice[2]; j < receive_slice[3]; ++j) {
+            for (int i = receive_slice[0]; i < receive_slice[1]; ++i) {
+                window[j * own_x.size() + i] += *packed++;
+            }
+        }
+    }
+#endif
+}
+
+// Gather the four integers of every process
+static vector<int> gather_rects(Lattice *grid, const int *rect) {
+    vector<int> rects(4 * grid->mpi_procs);
+#ifdef HAVE_MPI
+    MPI_Allgather(const_cast<int *>(rect), 4, MPI_INT, &rects[0], 4, MPI_INT, grid->cartcomm);
+#else
+    copy(rect, rect + 4, rects.begin());
+#endif
+    return rects;
+}
+
+void restrict_lattice(Lattice *fine, const double *fine_values, Lattice *coarse, double *coarse_values) {
+    int factor = fine->global_no_halo_dim_x / coarse->global_no_halo_dim_x;
+    int coarse_width = coarse->global_no_halo_dim_x;
+    int coarse_height = coarse->global_no_halo_dim_y;
+    // Each coarse dot is the average of the fine dots of its cell; a cell can
+    // be split between the tiles of two processes, which add their parts
+    int x0, x1, y0, y1;
+    owned_dots(fine->inner_start_x, fine->inner_end_x, fine->global_no_halo_dim_x, fine->mpi_dims[1], &x0, &x1);
+    owned_dots(fine->inner_start_y, fine->inner_end_y, fine->global_no_halo_dim_y, fine->mpi_dims[0], &y0, &y1);
+    int rect[4] = {0, 0, 0, 0};
+    if (x1 > x0 && y1 > y0) {
+        rect[0] = x0 / factor;
+        rect[1] = (x1 - 1) / factor + 1;
+        rect[2] = y0 / factor;
+        rect[3] = (y1 - 1) / factor + 1;
+    }
+    int width = rect[1] - rect[0];
+    vector<double> partial(width * (rect[3] - rect[2]), 0.);
+    double weight = 1. / double(factor * factor);
+    for (int y = y0; y < y1; ++y) {
+        for (int x = x0; x < x1; ++x) {
+            partial[(y / factor - rect[2]) * width + x / factor - rect[0]] +=
+                weight * fine_values[(y - fine->start_y) * fine->dim_x + x - fine->start_x];
+        }
+    }
+    // The coarse tile, halos included, reads its own dots
+    int tile[4] = {coarse->start_x, coarse->dim_x, coarse->start_y, coarse->dim_y};
+    vector<int> rects = gather_rects(coarse, rect), tiles = gather_rects(coarse, tile);
+    vector< vector<int> > window_x(coarse->mpi_procs), window_y(coarse->mpi_procs);
+    for (int r = 0; r < coarse->mpi_procs; r++) {
+        window_x[r] = read_indices(tiles[4 * r], tiles[4 * r + 1], coarse_width, 1, coarse_width, coarse->periods[1]);
+        window_y[r] = read_indices(tiles[4 * r + 2], tiles[4 * r + 3], coarse_height, 1, coarse_height, coarse->periods[0]);
+    }
+    const vector<int> &own_x = window_x[coarse->mpi_rank], &own_y = window_y[coarse->mpi_rank];
+    vector<double> window(own_x.size() * own_y.size());
+    exchange_window(coarse, rects, &partial[0], width, window_x, window_y, &window[0]);
+    vector<int> position_x = positions(own_x, coarse->start_x, coarse->dim_x, coarse_width);
+    vector<int> position_y = positions(own_y, coarse->start_y, coarse->dim_y, coarse_height);
+    #pragma omp parallel for
+    for (int y = 0; y < coarse->dim_y; ++y) {
+        for (int x = 0; x < coarse->dim_x; ++x) {
+            coarse_values[y * coarse->dim_x + x] = window[position_y[y] * own_x.size() + position_x[x]];
+        }
+    }
+}
+
+void prolong_lattice(Lattice *coarse, const double *coarse_values, Lattice *fine, double *fine_values) {
+    int factor = fine->global_no_halo_dim_x / coarse->global_no_halo_dim_x;
+    int coarse_width = coarse->global_no_halo_dim_x;
+    int coarse_height = coarse->global_no_halo_dim_y;
+    int fine_width = fine->global_no_halo_dim_x;
+    int fine_height = fine->global_no_halo_dim_y;
+    // Each process holds the inner dots of its coarse tile, and the fine
+    // tile, halos included, reads the coarse neighbours of its dots
+    int rect[4];
+    owned_dots(coarse->inner_start_x, coarse->inner_end_x, coarse_width, coarse->mpi_dims[1], &rect[0], &rect[1]);
+    owned_dots(coarse->inner_start_y, coarse->inner_end_y, coarse_height, coarse->mpi_dims[0], &rect[2], &rect[3]);
+    int tile[4] = {fine->start_x, fine->dim_x, fine->start_y, fine->dim_y};
+    vector<int> rects = gather_rects(fine, rect), tiles = gather_rects(fine, tile);
+    vector< vector<int> > window_x(fine->mpi_procs), window_y(fine->mpi_procs);
+    for (int r = 0; r < fine->mpi_procs; r++) {
+        window_x[r] = read_indices(tiles[4 * r], tiles[4 * r + 1], fine_width, factor, coarse_width, fine->periods[1]);
+        window_y[r] = read_indices(tiles[4 * r + 2], tiles[4 * r + 3], fine_height, factor, coarse_height, fine->periods[0]);
+    }
+    const vector<int> &own_x = window_x[fine->mpi_rank], &own_y = window_y[fine->mpi_rank];
+    vector<double> window(own_x.size() * own_y.size());
+    exchange_window(fine, rects, coarse_values + (rect[2] - coarse->start_y) * coarse->dim_x + rect[0] - coarse->start_x,
+                    coarse->dim_x, window_x, window_y, &window[0]);
+    // Bilinear interpolation between the centers of the coarse cells
+    int window_width = own_x.size();
+    #pragma omp parallel for
+    for (int y = 0; y < fine->dim_y; ++y) {
+        int y0, y1;
+        double wy;
+        coarse_neighbours(global_index(fine->start_y, y, fine_height), factor, coarse_height, fine->periods[0], &y0, &y1, &wy);
+        y0 = lower_bound(own_y.begin(), own_y.end(), y0) - own_y.begin();
+        y1 = lower_bound(own_y.begin(), own_y.end(), y1) - own_y.begin();
+        for (int x = 0; x < fine->dim_x; ++x) {
+            int x0, x1;
+            double wx;
+            coarse_neighbours(global_index(fine->start_x, x, fine_width), factor, coarse_width, fine->periods[1], &x0, &x1, &wx);
+            x0 = lower_bound(own_x.begin(), own_x.end(), x0) - own_x.begin();
+            x1 = lower_bound(own_x.begin(), own_x.end(), x1) - own_x.begin();
+            fine_values[y * fine->dim_x + x] =
+                (1. - wy) * ((1. - wx) * window[y0 * window_width + x0] + wx * window[y0 * window_width + x1]) +
+                wy * ((1. - wx) * window[y1 * window_width + x0] + wx * window[y1 * window_width + x1]);
+        }
+    }
+}
+
 void add_padding(double *padded_matrix, double *matrix,
                  int padded_dim_x, int padded_dim_y,
                  int halo_x, int halo_y,
@@ -185,13 +613,17 @@ void print_matrix(string filename, double * matrix, size_t stride, size_t width,
 void memcpy2D(void * dst, size_t dstride, const void * src, size_t sstride, size_t width, size_t height) {
     char *d = reinterpret_cast<char *>(dst);
     const char *s = reinterpret_cast<const char *>(src);
-//#ifndef HAVE_MPI
-//    #pragma omp parallel for schedule(dynamic, 2) collapse(2)
-//#endif //wasn't worth it.
+    if (d == s && dstride == sstride) {
+        // The wave function of a kernel running in place, copied to its state
+        return;
+    }
+    if (dstride == width && sstride == width) {
+        // Contiguous rows
+        memcpy(d, s, width * height);
+        return;
+    }
     for (size_t i = 0; i < height; ++i) {
-        for (size_t j = 0; j < width; ++j) {
-            d[i * dstride + j] = s[i * sstride + j];
-        }
+        memcpy(&d[i * dstride], &s[i * sstride], width);
     }
 }
 
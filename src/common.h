@@ -21,13 +21,24 @@
 #include <limits>
 #include "trottersuzuki.h"
 
+#define MEMORY_ALIGNMENT 64u
+
 void print_matrix(string filename, double * matrix, size_t stride, size_t width, size_t height);
 void stamp(Lattice *grid, State *state, string fileprefix);
 void stamp_matrix(Lattice *grid, double *matrix, string filename);
 
 void calculate_borders(int coord, int dim, int * start, int *end, int *inner_start, int *inner_end, int length, int halo, int periodic_bound);
 void my_abort(string err);
+#ifdef HAVE_MPI
+void check_mpi_thread_support();
+#endif
 void memcpy2D(void * dst, size_t dstride, const void * src, size_t sstride, size_t width, size_t height);
 double bessel_j_zeros(int l, int x);
+double *allocate_aligned(size_t count);
+void first_touch(double *buffer, size_t width, size_t height);
+void first_touch(float *buffer, size_t width, size_t height);
+void free_aligned(double *buffer);
+void restrict_lattice(Lattice *fine, const double *fine_values, Lattice *coarse, double *coarse_values);
+void prolong_lattice(Lattice *coarse, const double *coarse_values, Lattice *fine, double *fine_values);
 
 #endif
@@ -1,21 +1,47 @@
-
 #include <string>
 #include <complex>
+#include <cmath>
+#include "kernel.h"
+#include "simd.h"
 
+/* The checkerboard kinetic sweeps update disjoint pairs of neighbouring dots.
+ * Along a row the pairs are adjacent, so both members of a pair are updated with
+ * the same formula applied to the swapped lanes (idx <-> peer). Along a column
+ * the pairs sit in two consecutive rows and only every other dot is touched, so
+ * the updated values are blended with the untouched ones.
+ * The vector width is chosen at compile time (see simd.h); the remainder of
+ * each row is handled by the scalar code.
+ */
 
-void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
-    for (size_t idx = start_offset, peer = idx + stride; idx < width; idx += 2, peer += 2) {
+// Update the adjacent pairs (0, 1), (2, 3), ... of a row segment of length count (even)
+template <bool imag_time>
+static inline void horizontal_pairs(size_t count, double a, double b, double * p_real, double * p_imag) {
+    size_t i = 0;
+#ifdef SIMD_WIDTH
+    simd_double va = simd_set1(a), vb = simd_set1(b);
+    for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+        simd_double re = simd_load(p_real + i);
+        simd_double im = simd_load(p_imag + i);
+        if (imag_time) {
+            simd_store(p_real + i, simd_add(simd_mul(va, re), simd_mul(vb, simd_swap_pairs(re))));
+            simd_store(p_imag + i, simd_add(simd_mul(va, im), simd_mul(vb, simd_swap_pairs(im))));
+        }
+        else {
+            simd_store(p_real + i, simd_sub(simd_mul(va, re), simd_mul(vb, simd_swap_pairs(im))));
+            simd_store(p_imag + i, simd_add(simd_mul(va, im), simd_mul(vb, simd_swap_pairs(re))));
+        }
+    }
+#endif
+    for (size_t idx = i, peer = idx + 1; idx < count; idx += 2, peer += 2) {
         double tmp_real = p_real[idx];
         double tmp_imag = p_imag[idx];
-        p_real[idx] = a * tmp_real - b * p_imag[peer];
-        p_imag[idx] = a * tmp_imag + b * p_real[peer];
-        p_real[peer] = a * p_real[peer] - b * tmp_imag;
-        p_imag[peer] = a * p_imag[peer] + b * tmp_real;
-    }
-    for (size_t y = 1; y < height - 1; ++y) {
-        for (size_t idx = y * stride + (start_offset + y) % 2, peer = idx + stride; idx < y * stride + width; idx += 2, peer += 2) {
-            double tmp_real = p_real[idx];
-            double tmp_imag = p_imag[idx];
+        if (imag_time) {
+            p_real[idx] = a * tmp_real + b * p_real[peer];
+            p_imag[idx] = a * tmp_imag + b * p_imag[peer];
+            p_real[peer] = a * p_real[peer] + b * tmp_real;
+            p_imag[peer] = a * p_imag[peer] + b * tmp_imag;
+        }
+        else {
             p_real[idx] = a * tmp_real - b * p_imag[peer];
             p_imag[idx] = a * tmp_imag + b * p_real[peer];
             p_real[peer] = a * p_real[peer] - b * tmp_imag;
@@ -24,32 +50,41 @@ void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, siz
     }
 }
 
-void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
-    for (size_t idx = start_offset, peer = idx + stride; idx < width; idx += 2, peer += 2) {
+// Update the pairs (idx, idx + stride) for idx = 0, 2, 4, ... < count
+template <bool imag_time>
+static inline void vertical_pairs(size_t count, size_t stride, double a, double b, double * p_real, double * p_imag) {
+    size_t i = 0;
+#ifdef SIMD_WIDTH
+    simd_double va = simd_set1(a), vb = simd_set1(b);
+    for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+        simd_double re = simd_load(p_real + i);
+        simd_double im = simd_load(p_imag + i);
+        simd_double peer_re = simd_load(p_real + stride + i);
+        simd_double peer_im = simd_load(p_imag + stride + i);
+        if (imag_time) {
+            simd_store(p_real + i, simd_blend_even(re, simd_add(simd_mul(va, re), simd_mul(vb, peer_re))));
+            simd_store(p_imag + i, simd_blend_even(im, simd_add(simd_mul(va, im), simd_mul(vb, peer_im))));
+            simd_store(p_real + stride + i, simd_blend_even(peer_re, simd_add(simd_mul(va, peer_re), simd_mul(vb, re))));
+            simd_store(p_imag + stride + i, simd_blend_even(peer_im, simd_add(simd_mul(va, peer_im), simd_mul(vb, im))));
+        }
+        else {
+            simd_store(p_real + i, simd_blend_even(re, simd_sub(simd_mul(va, re), simd_mul(vb, peer_im))));
+            simd_store(p_imag + i, simd_blend_even(im, simd_add(simd_mul(va, im), simd_mul(vb, peer_re))));
+            simd_store(p_real + stride + i, simd_blend_even(peer_re, simd_sub(simd_mul(va, peer_re), simd_mul(vb, im))));
+            simd_store(p_imag + stride + i, simd_blend_even(peer_im, simd_add(simd_mul(va, peer_im), simd_mul(vb, re))));
+        }
+    }
+#endif
+    for (size_t idx = i, peer = idx + stride; idx < count; idx += 2, peer += 2) {
         double tmp_real = p_real[idx];
         double tmp_imag = p_imag[idx];
-        p_real[idx] = a * tmp_real + b * p_real[peer];
-        p_imag[idx] = a * tmp_imag + b * p_imag[peer];
-        p_real[peer] = a * p_real[peer] + b * tmp_real;
-        p_imag[peer] = a * p_imag[peer] + b * tmp_imag;
-    }
-    for (size_t y = 1; y < height - 1; ++y) {
-        for (size_t idx = y * stride + (start_offset + y) % 2, peer = idx + stride; idx < y * stride + width; idx += 2, peer += 2) {
-            double tmp_real = p_real[idx];
-            double tmp_imag = p_imag[idx];
+        if (imag_time) {
             p_real[idx] = a * tmp_real + b * p_real[peer];
             p_imag[idx] = a * tmp_imag + b * p_imag[peer];
             p_real[peer] = a * p_real[peer] + b * tmp_real;
             p_imag[peer] = a * p_imag[peer] + b * tmp_imag;
         }
-    }
-}
-
-void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
-    for (size_t y = 0; y < height; ++y) {
-        for (size_t idx = y * stride + (start_offset + y) % 2, peer = idx + 1; idx < y * stride + width - 1; idx += 2, peer += 2) {
-            double tmp_real = p_real[idx];
-            double tmp_imag = p_imag[idx];
+        else {
             p_real[idx] = a * tmp_real - b * p_imag[peer];
             p_imag[idx] = a * tmp_imag + b * p_real[peer];
             p_real[peer] = a * p_real[peer] - b * tmp_imag;
@@ -58,59 +93,225 @@ void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, s
     }
 }
 
-void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
-    for (size_t y = 0; y < height; ++y) {
-        for (size_t idx = y * stride + (start_offset + y) % 2, peer = idx + 1; idx < y * stride + width - 1; idx += 2, peer += 2) {
-            double tmp_real = p_real[idx];
-            double tmp_imag = p_imag[idx];
+// Update the pairs (idx, idx + distance) for idx = 0, 1, ... < count
+template <bool imag_time>
+static inline void distant_pairs(size_t count, size_t distance, double a, double b, double * p_real, double * p_imag) {
+    size_t i = 0;
+#ifdef SIMD_WIDTH
+    simd_double va = simd_set1(a), vb = simd_set1(b);
+    for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+        simd_double re = simd_load(p_real + i);
+        simd_double im = simd_load(p_imag + i);
+        simd_double peer_re = simd_load(p_real + distance + i);
+        simd_double peer_im = simd_load(p_imag + distance + i);
+        if (imag_time) {
+            simd_store(p_real + i, simd_add(simd_mul(va, re), simd_mul(vb, peer_re)));
+            simd_store(p_imag + i, simd_add(simd_mul(va, im), simd_mul(vb, peer_im)));
+            simd_store(p_real + distance + i, simd_add(simd_mul(va, peer_re), simd_mul(vb, re)));
+            simd_store(p_imag + distance + i, simd_add(simd_mul(va, peer_im), simd_mul(vb, im)));
+        }
+        else {
+            simd_store(p_real + i, simd_sub(simd_mul(va, re), simd_mul(vb, peer_im)));
+            simd_store(p_imag + i, simd_add(simd_mul(va, im), simd_mul(vb, peer_re)));
+            simd_store(p_real + distance + i, simd_sub(simd_mul(va, peer_re), simd_mul(vb, im)));
+            simd_store(p_imag + distance + i, simd_add(simd_mul(va, peer_im), simd_mul(vb, re)));
+        }
+    }
+#endif
+    for (size_t idx = i, peer = idx + distance; idx < count; ++idx, ++peer) {
+        double tmp_real = p_real[idx];
+        double tmp_imag = p_imag[idx];
+        if (imag_time) {
             p_real[idx] = a * tmp_real + b * p_real[peer];
             p_imag[idx] = a * tmp_imag + b * p_imag[peer];
             p_real[peer] = a * p_real[peer] + b * tmp_real;
             p_imag[peer] = a * p_imag[peer] + b * tmp_imag;
         }
+        else {
+            p_real[idx] = a * tmp_real - b * p_imag[peer];
+            p_imag[idx] = a * tmp_imag + b * p_real[peer];
+            p_real[peer] = a * p_real[peer] - b * tmp_imag;
+            p_imag[peer] = a * p_imag[peer] + b * tmp_real;
+        }
     }
 }
 
-//double time potential
-void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
-                            const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag) {
-    if(two_wavefunctions) {
-        for (size_t y = 0; y < height; ++y) {
-            for (size_t idx = y * stride, idx_pot = y * tile_width; idx < y * stride + width; ++idx, ++idx_pot) {
-                double norm_2 = p_real[idx] * p_real[idx] + p_imag[idx] * p_imag[idx];
-                //double norm_3 = norm_2 * sqrt(norm_2);
-                double norm_2b = pb_real[idx_pot] * pb_real[idx_pot] + pb_imag[idx_pot] * pb_imag[idx_pot];
-                double c_cos = cos(coupling_a * norm_2 + coupling_b * norm_2b/* + coupling_aa * norm_3*/);
-                double c_sin = sin(coupling_a * norm_2 + coupling_b * norm_2b/* + coupling_aa * norm_3*/);
-                double tmp = p_real[idx];
-                p_real[idx] = external_pot_real[idx_pot] * tmp - external_pot_imag[idx_pot] * p_imag[idx];
-                p_imag[idx] = external_pot_real[idx_pot] * p_imag[idx] + external_pot_imag[idx_pot] * tmp;
+/* The next neighbour sweeps of the fourth order kinetic term pair each dot with
+ * the one two dots away. The pairs of a sweep must be disjoint: two consecutive
+ * pairs, (i, i + 2) and (i + 1, i + 3), every four dots, starting from the dot
+ * start_offset (0 to 3), so that the sweeps follow the lattice and not the
+ * block. Along a column these are two whole rows against the two rows below.
+ */
+template <bool imag_time>
+static inline void vertical_next(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    for (long y = long(start_offset) - 4; y + 2 < long(height); y += 4) {
+        for (long row = max(y, 0L); row < min(y + 2, long(height) - 2); ++row) {
+            distant_pairs<imag_time>(width, 2 * stride, a, b, p_real + row * stride, p_imag + row * stride);
+        }
+    }
+}
 
-                tmp = p_real[idx];
-                p_real[idx] = c_cos * tmp + c_sin * p_imag[idx];
-                p_imag[idx] = c_cos * p_imag[idx] - c_sin * tmp;
+template <bool imag_time>
+static inline void horizontal_next(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    for (size_t y = 0; y < height; ++y) {
+        double *row_real = p_real + y * stride, *row_imag = p_imag + y * stride;
+        for (long x = long(start_offset) - 4; x + 2 < long(width); x += 4) {
+            long first = max(x, 0L), last = min(x + 2, long(width) - 2);
+            if (last > first) {
+                distant_pairs<imag_time>(last - first, 2, a, b, row_real + first, row_imag + first);
             }
         }
     }
+}
+
+void block_kernel_vertical_next(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    vertical_next<false>(start_offset, stride, width, height, a, b, p_real, p_imag);
+}
+
+void block_kernel_vertical_next_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    vertical_next<true>(start_offset, stride, width, height, a, b, p_real, p_imag);
+}
+
+void block_kernel_horizontal_next(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    horizontal_next<false>(start_offset, stride, width, height, a, b, p_real, p_imag);
+}
+
+void block_kernel_horizontal_next_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    horizontal_next<true>(start_offset, stride, width, height, a, b, p_real, p_imag);
+}
+
+void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    for (size_t y = 0; y < height - 1; ++y) {
+        size_t offset = (start_offset + y) % 2;
+        if (offset < width)
+            vertical_pairs<false>(width - offset, stride, a, b, p_real + y * stride + offset, p_imag + y * stride + offset);
+    }
+}
+
+void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    for (size_t y = 0; y < height - 1; ++y) {
+        size_t offset = (start_offset + y) % 2;
+        if (offset < width)
+            vertical_pairs<true>(width - offset, stride, a, b, p_real + y * stride + offset, p_imag + y * stride + offset);
+    }
+}
+
+void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    for (size_t y = 0; y < height; ++y) {
+        size_t offset = (start_offset + y) % 2;
+        if (offset < width)
+            horizontal_pairs<false>((width - offset) & ~size_t(1), a, b, p_real + y * stride + offset, p_imag + y * stride + offset);
+    }
+}
+
+void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag) {
+    for (size_t y = 0; y < height; ++y) {
+        size_t offset = (start_offset + y) % 2;
+        if (offset < width)
+            horizontal_pairs<true>((width - offset) & ~size_t(1), a, b, p_real + y * stride + offset, p_imag + y * stride + offset);
+    }
+}
+
+/* Sine and cosine of the nonlinear phase.
+ * The argument is reduced to [-pi/4, pi/4] by subtracting the nearest multiple
+ * of pi/2 in two parts (Cody-Waite), then the polynomials of the Cephes library
+ * are evaluated: degree 13/14 for double precision, degree 7/8 for single
+ * precision. The quadrant is applied with selections instead of branches, so
+ * that the loops calling it are vectorized by the compiler.
+ */
+template <int accuracy>
+static inline void phase_sincos(double x, double &s, double &c) {
+    if (accuracy == SINCOS_EXACT) {
+        s = sin(x);
+        c = cos(x);
+        return;
+    }
+    const double two_over_pi = 6.36619772367581382433e-01;
+    const double pi_over_2_hi = 1.57079632679489655800e+00;
+    const double pi_over_2_lo = 6.12323399573676603587e-17;
+    double q = std::floor(x * two_over_pi + 0.5);
+    double r = std::fma(-q, pi_over_2_hi, x);
+    r = std::fma(-q, pi_over_2_lo, r);
+    double z = r * r;
+    double sin_r, cos_r;
+    if (accuracy == SINCOS_SINGLE) {
+        sin_r = r + r * z * (-1.6666654611e-1 + z * (8.3321608736e-3 + z * -1.9515295891e-4));
+        cos_r = 1. - 0.5 * z + z * z * (4.166664568298827e-2 + z * (-1.388731625493765e-3 + z * 2.443315711809948e-5));
+    }
     else {
-        for (size_t y = 0; y < height; ++y) {
-            for (size_t idx = y * stride, idx_pot = y * tile_width; idx < y * stride + width; ++idx, ++idx_pot) {
-                double norm_2 = p_real[idx] * p_real[idx] + p_imag[idx] * p_imag[idx];
-                double norm_3 = norm_2 * sqrt(norm_2);
-                double c_cos = cos(coupling_a * norm_2 + coupling_aa * norm_3);
-                double c_sin = sin(coupling_a * norm_2 + coupling_aa * norm_3);
-                double tmp = p_real[idx];
-                p_real[idx] = external_pot_real[idx_pot] * tmp - external_pot_imag[idx_pot] * p_imag[idx];
-                p_imag[idx] = external_pot_real[idx_pot] * p_imag[idx] + external_pot_imag[idx_pot] * tmp;
+        sin_r = r + r * z * (-1.66666666666666307295e-1 + z * (8.33333333332211858878e-3 + z * (-1.98412698295895385996e-4 +
+                             z * (2.75573136213857245213e-6 + z * (-2.50507477628578072866e-8 + z * 1.58962301576546568060e-10)))));
+        cos_r = 1. - 0.5 * z + z * z * (4.16666666666665929218e-2 + z * (-1.38888888888730564116e-3 + z * (2.48015872888517045348e-5 +
+                                        z * (-2.75573141792967388112e-7 + z * (2.08757008419747316778e-9 + z * -1.13585365213876817300e-11)))));
+    }
+    double quadrant = q - 4. * std::floor(0.25 * q);
+    bool odd = (quadrant == 1. || quadrant == 3.);
+    s = odd ? cos_r : sin_r;
+    c = odd ? sin_r : cos_r;
+    s = (quadrant >= 2.) ? -s : s;
+    c = (quadrant == 1. || quadrant == 2.) ? -c : c;
+}
 
-                tmp = p_real[idx];
-                p_real[idx] = c_cos * tmp + c_sin * p_imag[idx];
-                p_imag[idx] = c_cos * p_imag[idx] - c_sin * tmp;
+/* Multiply each dot by exp(-i (V + g |psi|^2 + g_LHY |psi|^3)): the exponential of
+ * the external potential, given, and the nonlinear phase are fused in a single
+ * factor. With two wave functions the phase has the inter-species term
+ * g_ab |psi_b|^2 instead of the Lee-Huang-Yang one.
+ */
+template <bool two_wavefunctions, int accuracy>
+static void potential_rows(size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
+                           const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag) {
+    for (size_t y = 0; y < height; ++y) {
+        double * __restrict__ row_real = &p_real[y * stride];
+        double * __restrict__ row_imag = &p_imag[y * stride];
+        const double *pot_real = &external_pot_real[y * tile_width];
+        const double *pot_imag = &external_pot_imag[y * tile_width];
+        const double *row_b_real = &pb_real[y * tile_width];
+        const double *row_b_imag = &pb_imag[y * tile_width];
+        for (size_t i = 0; i < width; ++i) {
+            double norm_2 = row_real[i] * row_real[i] + row_imag[i] * row_imag[i];
+            double phase;
+            if (two_wavefunctions) {
+                double norm_2b = row_b_real[i] * row_b_real[i] + row_b_imag[i] * row_b_imag[i];
+                phase = coupling_a * norm_2 + coupling_b * norm_2b;
+            }
+            else {
+                phase = coupling_a * norm_2 + coupling_aa * norm_2 * sqrt(norm_2);
             }
+            double c_sin, c_cos;
+            phase_sincos<accuracy>(phase, c_sin, c_cos);
+            double factor_real = pot_real[i] * c_cos + pot_imag[i] * c_sin;
+            double factor_imag = pot_imag[i] * c_cos - pot_real[i] * c_sin;
+            double tmp = row_real[i];
+            row_real[i] = factor_real * tmp - factor_imag * row_imag[i];
+            row_imag[i] = factor_real * row_imag[i] + factor_imag * tmp;
         }
     }
 }
 
+template <bool two_wavefunctions>
+static void potential_rows(int sincos_accuracy, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
+                           const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag) {
+    if (sincos_accuracy == SINCOS_EXACT) {
+        potential_rows<two_wavefunctions, SINCOS_EXACT>(stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+    }
+    else if (sincos_accuracy == SINCOS_SINGLE) {
+        potential_rows<two_wavefunctions, SINCOS_SINGLE>(stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+    }
+    else {
+        potential_rows<two_wavefunctions, SINCOS_DOUBLE>(stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+    }
+}
+
+void block_kernel_potential(int sincos_accuracy, bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
+                            const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag) {
+    if(two_wavefunctions) {
+        potential_rows<true>(sincos_accuracy, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+    }
+    else {
+        potential_rows<false>(sincos_accuracy, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, p_real, p_imag);
+    }
+}
+
 //double time potential
 void block_kernel_potential_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width,
                                       const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag) {
@@ -140,130 +341,72 @@ void block_kernel_potential_imaginary(bool two_wavefunctions, size_t stride, siz
 }
 
 //rotation
-void block_kernel_rotation(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag) {
-
-    double tmp_r, tmp_i;
-
-    for (int j = 0, y = offset_y; j < height; ++j, ++y) {
-        double alpha_yy = - 0.5 * alpha_y * y;
-        double a = cos(alpha_yy), b = sin(alpha_yy);
-        for (size_t i = 0, idx = j * stride, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_real[peer];
-            p_imag[idx] = a * p_imag[idx] + b * p_imag[peer];
-            p_real[peer] = a * p_real[peer] - b * tmp_r;
-            p_imag[peer] = a * p_imag[peer] - b * tmp_i;
-        }
-        for (size_t i = 1, idx = j * stride + 1, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_real[peer];
-            p_imag[idx] = a * p_imag[idx] + b * p_imag[peer];
-            p_real[peer] = a * p_real[peer] - b * tmp_r;
-            p_imag[peer] = a * p_imag[peer] - b * tmp_i;
-        }
+/* The coefficients of the rotation only depend on the coordinates, so they are
+ * tabulated by the kernel for each column (rot_ax, rot_bx) and each row
+ * (rot_ay, rot_by) of the tile. The pass along y couples pairs of rows, and it
+ * walks the block row by row like the others.
+ */
+template <bool imag_time>
+static inline void rotate_pair(double a, double b, double &real, double &imag, double &peer_real, double &peer_imag) {
+    double tmp_r = real, tmp_i = imag;
+    if (imag_time) {
+        real = a * tmp_r + b * peer_imag;
+        imag = a * tmp_i - b * peer_real;
+        peer_real = a * peer_real - b * tmp_i;
+        peer_imag = a * peer_imag + b * tmp_r;
     }
-
-    for (int i = 0, x = offset_x; i < width; ++i, ++x) {
-        double alpha_xx = alpha_x * x;
-        double a = cos(alpha_xx), b = sin(alpha_xx);
-        for (size_t j = 0, idx = i, peer = stride + idx; j < height - 1; j += 2, idx += 2 * stride, peer += 2 * stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_real[peer];
-            p_imag[idx] = a * p_imag[idx] + b * p_imag[peer];
-            p_real[peer] = a * p_real[peer] - b * tmp_r;
-            p_imag[peer] = a * p_imag[peer] - b * tmp_i;
-        }
-        for (size_t j = 1, idx = j * stride + i, peer = stride + idx; j < height - 1; j += 2, idx += 2 * stride, peer += 2 * stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_real[peer];
-            p_imag[idx] = a * p_imag[idx] + b * p_imag[peer];
-            p_real[peer] = a * p_real[peer] - b * tmp_r;
-            p_imag[peer] = a * p_imag[peer] - b * tmp_i;
-        }
+    else {
+        real = a * tmp_r + b * peer_real;
+        imag = a * tmp_i + b * peer_imag;
+        peer_real = a * peer_real - b * tmp_r;
+        peer_imag = a * peer_imag - b * tmp_i;
     }
+}
 
-    for (int j = 0, y = offset_y; j < height; ++j, ++y) {
-        double alpha_yy = - 0.5 * alpha_y * y;
-        double a = cos(alpha_yy), b = sin(alpha_yy);
-        for (size_t i = 0, idx = j * stride, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_real[peer];
-            p_imag[idx] = a * p_imag[idx] + b * p_imag[peer];
-            p_real[peer] = a * p_real[peer] - b * tmp_r;
-            p_imag[peer] = a * p_imag[peer] - b * tmp_i;
+template <bool imag_time>
+static void rotation_rows(size_t stride, size_t width, size_t height, const double *rot_ay, const double *rot_by, double * p_real, double * p_imag) {
+    for (size_t j = 0; j < height; ++j) {
+        double a = rot_ay[j], b = rot_by[j];
+        double *row_real = &p_real[j * stride];
+        double *row_imag = &p_imag[j * stride];
+        for (size_t i = 0; i + 1 < width; i += 2) {
+            rotate_pair<imag_time>(a, b, row_real[i], row_imag[i], row_real[i + 1], row_imag[i + 1]);
         }
-        for (size_t i = 1, idx = j * stride + 1, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_real[peer];
-            p_imag[idx] = a * p_imag[idx] + b * p_imag[peer];
-            p_real[peer] = a * p_real[peer] - b * tmp_r;
-            p_imag[peer] = a * p_imag[peer] - b * tmp_i;
+        for (size_t i = 1; i + 1 < width; i += 2) {
+            rotate_pair<imag_time>(a, b, row_real[i], row_imag[i], row_real[i + 1], row_imag[i + 1]);
         }
     }
 }
 
-void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag) {
-
-    double tmp_r, tmp_i;
-    for (int j = 0, y = offset_y; j < height; ++j, ++y) {
-        double alpha_yy = - 0.5 * alpha_y * y;
-        double a = cosh(alpha_yy), b = sinh(alpha_yy);
-        for (size_t i = 0, idx = j * stride, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_imag[peer];
-            p_imag[idx] = a * p_imag[idx] - b * p_real[peer];
-            p_real[peer] = - b * tmp_i + a * p_real[peer];
-            p_imag[peer] = b * tmp_r + a * p_imag[peer];
-        }
-        for (size_t i = 1, idx = j * stride + 1, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_imag[peer];
-            p_imag[idx] = a * p_imag[idx] - b * p_real[peer];
-            p_real[peer] = - b * tmp_i + a * p_real[peer];
-            p_imag[peer] = b * tmp_r + a * p_imag[peer];
+template <bool imag_time>
+static void rotation_columns(size_t stride, size_t width, size_t height, const double *rot_ax, const double *rot_bx, double * p_real, double * p_imag) {
+    for (size_t start_offset = 0; start_offset < 2; ++start_offset) {
+        for (size_t j = start_offset; j + 1 < height; j += 2) {
+            double * __restrict__ row_real = &p_real[j * stride];
+            double * __restrict__ row_imag = &p_imag[j * stride];
+            double * __restrict__ peer_real = row_real + stride;
+            double * __restrict__ peer_imag = row_imag + stride;
+            for (size_t i = 0; i < width; ++i) {
+                rotate_pair<imag_time>(rot_ax[i], rot_bx[i], row_real[i], row_imag[i], peer_real[i], peer_imag[i]);
+            }
         }
     }
+}
 
-    for (int i = 0, x = offset_x; i < width; ++i, ++x) {
-        double alpha_xx = alpha_x * x;
-        double a = cosh(alpha_xx), b = sinh(alpha_xx);
-        for (size_t j = 0, idx = i, peer = stride + idx; j < height - 1; j += 2, idx += 2 * stride, peer += 2 * stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_imag[peer];
-            p_imag[idx] = a * p_imag[idx] - b * p_real[peer];
-            p_real[peer] = - b * tmp_i + a * p_real[peer];
-            p_imag[peer] = b * tmp_r + a * p_imag[peer];
-        }
-        for (size_t j = 1, idx = j * stride + i, peer = stride + idx; j < height - 1; j += 2, idx += 2 * stride, peer += 2 * stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_imag[peer];
-            p_imag[idx] = a * p_imag[idx] - b * p_real[peer];
-            p_real[peer] = - b * tmp_i + a * p_real[peer];
-            p_imag[peer] = b * tmp_r + a * p_imag[peer];
-        }
-    }
+void block_kernel_rotation(size_t stride, size_t width, size_t height, const double *rot_ax, const double *rot_bx, const double *rot_ay, const double *rot_by, double * p_real, double * p_imag) {
+    rotation_rows<false>(stride, width, height, rot_ay, rot_by, p_real, p_imag);
+    rotation_columns<false>(stride, width, height, rot_ax, rot_bx, p_real, p_imag);
+    rotation_rows<false>(stride, width, height, rot_ay, rot_by, p_real, p_imag);
+}
 
-    for (int j = 0, y = offset_y; j < height; ++j, ++y) {
-        double alpha_yy = - 0.5 * alpha_y * y;
-        double a = cosh(alpha_yy), b = sinh(alpha_yy);
-        for (size_t i = 0, idx = j * stride, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_imag[peer];
-            p_imag[idx] = a * p_imag[idx] - b * p_real[peer];
-            p_real[peer] = - b * tmp_i + a * p_real[peer];
-            p_imag[peer] = b * tmp_r + a * p_imag[peer];
-        }
-        for (size_t i = 1, idx = j * stride + 1, peer = idx + 1; i < width - 1; i += 2, idx += 2, peer += 2) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * p_real[idx] + b * p_imag[peer];
-            p_imag[idx] = a * p_imag[idx] - b * p_real[peer];
-            p_real[peer] = - b * tmp_i + a * p_real[peer];
-            p_imag[peer] = b * tmp_r + a * p_imag[peer];
-        }
-    }
+void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, const double *rot_ax, const double *rot_bx, const double *rot_ay, const double *rot_by, double * p_real, double * p_imag) {
+    rotation_rows<true>(stride, width, height, rot_ay, rot_by, p_real, p_imag);
+    rotation_columns<true>(stride, width, height, rot_ax, rot_bx, p_real, p_imag);
+    rotation_rows<true>(stride, width, height, rot_ay, rot_by, p_real, p_imag);
 }
 
-void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag) {
+template <typename T>
+void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, T *p_real, T *p_imag, T *pb_real, T *pb_imag) {
     double real, imag;
     for(size_t i = 0; i < height; i++) {
         for(size_t j = 0, idx = i * stride; j < width; j++, idx++) {
@@ -277,7 +420,8 @@ void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, d
     }
 }
 
-void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag) {
+template <typename T>
+void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, T *p_real, T *p_imag, T *pb_real, T *pb_imag) {
     double real, imag;
     for(size_t i = 0; i < height; i++) {
         for(size_t j = 0, idx = i * stride; j < width; j++, idx++) {
@@ -290,3 +434,8 @@ void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double
         }
     }
 }
+
+template void rabi_coupling_real<double>(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag);
+template void rabi_coupling_real<float>(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, float *p_real, float *p_imag, float *pb_real, float *pb_imag);
+template void rabi_coupling_imaginary<double>(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag);
+template void rabi_coupling_imaginary<float>(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, float *p_real, float *p_imag, float *pb_real, float *pb_imag);
@@ -1,81 +1,67 @@
 #include <complex>
+#include "kernel.h"
+#include "simd.h"
 
-//real radial kinetic term
-void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height,
-                                 double offset_x, double _kin_radial,
-                                 double * p_real, double * p_imag) {
+/* The coefficients of the radial kinetic term only depend on the radial index,
+ * so they are tabulated by the kernel (see CPUBlock::init_radial_tables) for
+ * each column of the tile: radial_a is the diagonal term and radial_b the off
+ * diagonal one, expanded to both members of each pair. The pairs are adjacent
+ * along a row, and each row is swept like the horizontal kinetic term.
+ */
 
-    double tmp_r, tmp_i;
-    int start_i = 0;
-
-    // The first two points of the radial coordinate have a different coupling
-    if (offset_x + start_offset == 0) {
-        double kin_radial = 2 * _kin_radial;
-        double a = cos(kin_radial), b = - sin(kin_radial);
-        for (size_t j = 0, idx = 0, peer = idx + 1; j < height; j += 1, idx += stride, peer += stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * tmp_r - b * p_imag[peer];
-            p_imag[idx] = a * tmp_i + b * p_real[peer];
-            p_real[peer] = a * p_real[peer] - b * tmp_i;
-            p_imag[peer] = a * p_imag[peer] + b * tmp_r;
+// Update the adjacent pairs (0, 1), (2, 3), ... of a row segment of length count (even)
+template <bool imag_time>
+static inline void radial_pairs(size_t count, const double *a, const double *b, double * p_real, double * p_imag) {
+    size_t i = 0;
+#ifdef SIMD_WIDTH
+    for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH) {
+        simd_double va = simd_load(a + i);
+        simd_double vb = simd_load(b + i);
+        simd_double re = simd_load(p_real + i);
+        simd_double im = simd_load(p_imag + i);
+        if (imag_time) {
+            simd_store(p_real + i, simd_add(simd_mul(va, re), simd_mul(vb, simd_swap_pairs(re))));
+            simd_store(p_imag + i, simd_add(simd_mul(va, im), simd_mul(vb, simd_swap_pairs(im))));
+        }
+        else {
+            simd_store(p_real + i, simd_sub(simd_mul(va, re), simd_mul(vb, simd_swap_pairs(im))));
+            simd_store(p_imag + i, simd_add(simd_mul(va, im), simd_mul(vb, simd_swap_pairs(re))));
         }
-        start_i = 2;
     }
-
-    double x = double(start_i) + offset_x + start_offset;
-    for (int i = start_i + start_offset; i < width - 1; i += 2, x += 2) {
-        double kin_radial = _kin_radial / sqrt(x * x - 0.25);
-        double ratio = sqrt((2 * x + 1) / (2 * x - 1));
-        double sinh_kin_radial = sinh(kin_radial);
-        double a = cosh(kin_radial), b = sinh_kin_radial * ratio, c = - sinh_kin_radial / ratio;
-        for (size_t j = 0, idx = i, peer = idx + 1; j < height; j += 1, idx += stride, peer += stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * tmp_r - b * p_imag[peer];
-            p_imag[idx] = a * tmp_i + b * p_real[peer];
-            p_real[peer] = a * p_real[peer] - c * tmp_i;
-            p_imag[peer] = a * p_imag[peer] + c * tmp_r;
+#endif
+    for (size_t idx = i, peer = idx + 1; idx < count; idx += 2, peer += 2) {
+        double tmp_r = p_real[idx], tmp_i = p_imag[idx];
+        if (imag_time) {
+            p_real[idx] = a[idx] * tmp_r + b[idx] * p_real[peer];
+            p_imag[idx] = a[idx] * tmp_i + b[idx] * p_imag[peer];
+            p_real[peer] = a[peer] * p_real[peer] + b[peer] * tmp_r;
+            p_imag[peer] = a[peer] * p_imag[peer] + b[peer] * tmp_i;
+        }
+        else {
+            p_real[idx] = a[idx] * tmp_r - b[idx] * p_imag[peer];
+            p_imag[idx] = a[idx] * tmp_i + b[idx] * p_real[peer];
+            p_real[peer] = a[peer] * p_real[peer] - b[peer] * tmp_i;
+            p_imag[peer] = a[peer] * p_imag[peer] + b[peer] * tmp_r;
         }
     }
+}
 
-
+//real radial kinetic term
+void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height,
+                                 const double *radial_a, const double *radial_b,
+                                 double * p_real, double * p_imag) {
+    size_t count = (width - start_offset) & ~size_t(1);
+    for (size_t j = 0, row = start_offset; j < height; ++j, row += stride) {
+        radial_pairs<false>(count, &radial_a[start_offset], &radial_b[start_offset], &p_real[row], &p_imag[row]);
+    }
 }
 
 //imaginary radial kinetic term
 void block_kernel_radial_kinetic_imaginary(size_t start_offset, size_t stride, size_t width, size_t height,
-        double offset_x, double _kin_radial,
+        const double *radial_a, const double *radial_b,
         double * p_real, double * p_imag) {
-
-    double tmp_r, tmp_i;
-    int start_i = 0;
-
-    // The first two points of the radial coordinate have a different coupling
-    if (offset_x + start_offset == 0) {
-        double kin_radial = 2 * _kin_radial;
-        double a = cosh(kin_radial), b = -sinh(kin_radial);
-        for (size_t j = 0, idx = 0, peer = idx + 1; j < height; j += 1, idx += stride, peer += stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * tmp_r + b * p_real[peer];
-            p_imag[idx] = a * tmp_i + b * p_imag[peer];
-            p_real[peer] = a * p_real[peer] + b * tmp_r;
-            p_imag[peer] = a * p_imag[peer] + b * tmp_i;
-        }
-        start_i = 2;
+    size_t count = (width - start_offset) & ~size_t(1);
+    for (size_t j = 0, row = start_offset; j < height; ++j, row += stride) {
+        radial_pairs<true>(count, &radial_a[start_offset], &radial_b[start_offset], &p_real[row], &p_imag[row]);
     }
-
-    double x = double(start_i) + offset_x + start_offset;
-    for (int i = start_i + start_offset; i < width - 1; i += 2, x += 2) {
-        double kin_radial = _kin_radial / sqrt(x * x - 0.25);
-        double ratio = sqrt((2 * x + 1) / (2 * x - 1));
-        double sin_kin_radial = sin(kin_radial);
-        double a = cos(kin_radial), b = sin_kin_radial * ratio, c = - sin_kin_radial / ratio;
-        for (size_t j = 0, idx = i, peer = idx + 1; j < height; j += 1, idx += stride, peer += stride) {
-            tmp_r = p_real[idx], tmp_i = p_imag[idx];
-            p_real[idx] = a * tmp_r + b * p_real[peer];
-            p_imag[idx] = a * tmp_i + b * p_imag[peer];
-            p_real[peer] = a * p_real[peer] + c * tmp_r;
-            p_imag[peer] = a * p_imag[peer] + c * tmp_i;
-        }
-    }
-
-
 }
@@ -19,173 +19,322 @@
 #include "common.h"
 #include "kernel.h"
 #include <iostream>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <ctime>
 
 
-void full_step(bool two_wavefunctions, size_t stride, size_t width, size_t height,
-               double offset_x, double offset_y, double alpha_x, double alpha_y,
-               double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa,
+/**
+ * Evolve a cached block by a full time step.
+ *
+ * The template parameters select, at compile time, the kind of evolution: imaginary or real time,
+ * cylindrical or cartesian coordinates, one or two wave functions, rotating frame of reference,
+ * whether the block extends along the y axis (2D) or is a single row (1D), whether the kinetic
+ * term is of fourth order, and the accuracy of the nonlinear phase in real time.
+ *
+ * The fourth order kinetic term, 4/3 of the second order one minus 1/3 of the second order one
+ * on a lattice of twice the spacing, adds the sweeps of the pairs of next neighbours inside
+ * those of the pairs of neighbours.
+ */
+template <bool imag_time, bool cylindrical, bool two_wavefunctions, bool rotation, bool vertical, bool fourth_order, int sincos_accuracy>
+void full_step(size_t stride, size_t width, size_t height,
+               const double *rot_ax, const double *rot_bx, const double *rot_ay, const double *rot_by,
+               double aH, double bH, double aV, double bV, double aH2, double bH2, double aV2, double bV2, size_t origin_x, size_t origin_y,
+               const double *radial, double coupling_a, double coupling_b, double coupling_aa,
                size_t tile_width, const double *external_pot_real, const double *external_pot_imag,
-               const double *pb_real, const double *pb_imag, double * real, double * imag,
-               string coordinate_system) {
-    if (height > 1 ) {
-        block_kernel_vertical  (0u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical  (1u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal(1u, stride, width, height, aH, bH, real, imag);
-    if (coordinate_system == "cylindrical") {
-        block_kernel_radial_kinetic(0u, stride, width, height, offset_x, kin_radial, real, imag);
-        block_kernel_radial_kinetic(1u, stride, width, height, offset_x, kin_radial, real, imag);
-    }
-    block_kernel_potential (two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, real, imag);
-    if (alpha_x != 0. && alpha_y != 0.) {
-        block_kernel_rotation  (stride, width, height, offset_x, offset_y, alpha_x, alpha_y, real, imag);
-    }
-    if (coordinate_system == "cylindrical") {
-        block_kernel_radial_kinetic(1u, stride, width, height, offset_x, kin_radial, real, imag);
-        block_kernel_radial_kinetic(0u, stride, width, height, offset_x, kin_radial, real, imag);
-    }
-    block_kernel_horizontal(1u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical  (1u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical  (0u, stride, width, height, aV, bV, real, imag);
-    }
-}
-
-void full_step_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height,
-                         double offset_x, double offset_y, double alpha_x, double alpha_y,
-                         double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa,
-                         size_t tile_width, const double *external_pot_real, const double *external_pot_imag,
-                         const double *pb_real, const double *pb_imag, double * real, double * imag,
-                         string coordinate_system) {
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (0u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal_imaginary(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (1u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal_imaginary(1u, stride, width, height, aH, bH, real, imag);
-    if (coordinate_system == "cylindrical") {
-        block_kernel_radial_kinetic_imaginary(0u, stride, width, height, offset_x, kin_radial, real, imag);
-        block_kernel_radial_kinetic_imaginary(1u, stride, width, height, offset_x, kin_radial, real, imag);
-    }
-    block_kernel_potential_imaginary (two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, real, imag);
-    if (alpha_x != 0. && alpha_y != 0.) {
-        block_kernel_rotation_imaginary(stride, width, height, offset_x, offset_y, alpha_x, alpha_y, real, imag);
-    }
-    if (coordinate_system == "cylindrical") {
-        block_kernel_radial_kinetic_imaginary(1u, stride, width, height, offset_x, kin_radial, real, imag);
-        block_kernel_radial_kinetic_imaginary(0u, stride, width, height, offset_x, kin_radial, real, imag);
-    }
-    block_kernel_horizontal_imaginary(1u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (1u, stride, width, height, aV, bV, real, imag);
-    }
-    block_kernel_horizontal_imaginary(0u, stride, width, height, aH, bH, real, imag);
-    if (height > 1 ) {
-        block_kernel_vertical_imaginary  (0u, stride, width, height, aV, bV, real, imag);
-    }
-}
-
-void process_sides(bool two_wavefunctions, double offset_tile_x, double offset_tile_y, double alpha_x, double alpha_y, size_t tile_width, size_t block_width, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height,
-                   double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa, const double *external_pot_real, const double *external_pot_imag,
-                   const double * p_real, const double * p_imag, const double * pb_real, const double * pb_imag,
-                   double * next_real, double * next_imag, double * block_real, double * block_imag, bool imag_time, string coordinate_system) {
-
-    // First block [0..block_width - halo_x]
-    memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width], tile_width * sizeof(double), block_width * sizeof(double), read_height);
-    memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width], tile_width * sizeof(double), block_width * sizeof(double), read_height);
-    if(imag_time)
-        full_step_imaginary(two_wavefunctions, block_width, block_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                            &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
-    else
-        full_step(two_wavefunctions, block_width, block_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                  &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
-    memcpy2D(&next_real[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_real[write_offset * block_width], block_width * sizeof(double), (block_width - halo_x) * sizeof(double), write_height);
-    memcpy2D(&next_imag[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_imag[write_offset * block_width], block_width * sizeof(double), (block_width - halo_x) * sizeof(double), write_height);
-
-    size_t block_start = ((tile_width - block_width) / (block_width - 2 * halo_x) + 1) * (block_width - 2 * halo_x);
-    // Last block
-    memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width + block_start], tile_width * sizeof(double), (tile_width - block_start) * sizeof(double), read_height);
-    memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width + block_start], tile_width * sizeof(double), (tile_width - block_start) * sizeof(double), read_height);
-    if(imag_time)
-        full_step_imaginary(two_wavefunctions, block_width, tile_width - block_start, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                            &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
-    else
-        full_step(two_wavefunctions, block_width, tile_width - block_start, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                  &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
-    memcpy2D(&next_real[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_real[write_offset * block_width + halo_x], block_width * sizeof(double), (tile_width - block_start - halo_x) * sizeof(double), write_height);
-    memcpy2D(&next_imag[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_imag[write_offset * block_width + halo_x], block_width * sizeof(double), (tile_width - block_start - halo_x) * sizeof(double), write_height);
-}
-
-void process_band(bool two_wavefunctions, double offset_tile_x, double offset_tile_y, double alpha_x, double alpha_y, size_t tile_width, size_t block_width, size_t block_height, size_t halo_x, size_t read_y, size_t read_height, size_t write_offset, size_t write_height,
-                  double aH, double bH, double aV, double bV, double kin_radial, double coupling_a, double coupling_b, double coupling_aa, const double *external_pot_real, const double *external_pot_imag, const double * p_real, const double * p_imag,
-                  const double * pb_real, const double * pb_imag, double * next_real, double * next_imag, int inner, int sides, bool imag_time, string coordinate_system) {
-    double *block_real = new double[block_height * block_width];
-    double *block_imag = new double[block_height * block_width];
-
-    if (tile_width <= block_width) {
-        if (sides) {
-            // One full block
-            memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width], tile_width * sizeof(double), tile_width * sizeof(double), read_height);
-            memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width], tile_width * sizeof(double), tile_width * sizeof(double), read_height);
-            if(imag_time)
-                full_step_imaginary(two_wavefunctions, block_width, tile_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                                    &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
-            else
-                full_step(two_wavefunctions, block_width, tile_width, read_height, offset_tile_x, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                          &external_pot_real[read_y * tile_width], &external_pot_imag[read_y * tile_width], &pb_real[read_y * tile_width], &pb_imag[read_y * tile_width], block_real, block_imag, coordinate_system);
-            memcpy2D(&next_real[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_real[write_offset * block_width], block_width * sizeof(double), tile_width * sizeof(double), write_height);
-            memcpy2D(&next_imag[(read_y + write_offset) * tile_width], tile_width * sizeof(double), &block_imag[write_offset * block_width], block_width * sizeof(double), tile_width * sizeof(double), write_height);
+               const double *pb_real, const double *pb_imag, double * real, double * imag) {
+    // First dot of the two sweeps of next neighbours along each axis, from the
+    // coordinates modulo 4 of the block in the lattice
+    const size_t next_x[2] = {(4 - origin_x) % 4, (6 - origin_x) % 4};
+    const size_t next_y[2] = {(4 - origin_y) % 4, (6 - origin_y) % 4};
+    if (imag_time) {
+        if (vertical) {
+            block_kernel_vertical_imaginary  (0u, stride, width, height, aV, bV, real, imag);
+        }
+        block_kernel_horizontal_imaginary(0u, stride, width, height, aH, bH, real, imag);
+        if (vertical) {
+            block_kernel_vertical_imaginary  (1u, stride, width, height, aV, bV, real, imag);
+        }
+        block_kernel_horizontal_imaginary(1u, stride, width, height, aH, bH, real, imag);
+        if (fourth_order) {
+            if (vertical) {
+                block_kernel_vertical_next_imaginary(next_y[0], stride, width, height, aV2, bV2, real, imag);
+            }
+            block_kernel_horizontal_next_imaginary(next_x[0], stride, width, height, aH2, bH2, real, imag);
+            if (vertical) {
+                block_kernel_vertical_next_imaginary(next_y[1], stride, width, height, aV2, bV2, real, imag);
+            }
+            block_kernel_horizontal_next_imaginary(next_x[1], stride, width, height, aH2, bH2, real, imag);
+        }
+        if (cylindrical) {
+            block_kernel_radial_kinetic_imaginary(0u, stride, width, height, radial, radial + tile_width, real, imag);
+            block_kernel_radial_kinetic_imaginary(1u, stride, width, height, radial + 2 * tile_width, radial + 3 * tile_width, real, imag);
+        }
+        block_kernel_potential_imaginary (two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, real, imag);
+        if (rotation) {
+            block_kernel_rotation_imaginary(stride, width, height, rot_ax, rot_bx, rot_ay, rot_by, real, imag);
+        }
+        if (cylindrical) {
+            block_kernel_radial_kinetic_imaginary(1u, stride, width, height, radial + 2 * tile_width, radial + 3 * tile_width, real, imag);
+            block_kernel_radial_kinetic_imaginary(0u, stride, width, height, radial, radial + tile_width, real, imag);
+        }
+        if (fourth_order) {
+            block_kernel_horizontal_next_imaginary(next_x[1], stride, width, height, aH2, bH2, real, imag);
+            if (vertical) {
+                block_kernel_vertical_next_imaginary(next_y[1], stride, width, height, aV2, bV2, real, imag);
+            }
+            block_kernel_horizontal_next_imaginary(next_x[0], stride, width, height, aH2, bH2, real, imag);
+            if (vertical) {
+                block_kernel_vertical_next_imaginary(next_y[0], stride, width, height, aV2, bV2, real, imag);
+            }
+        }
+        block_kernel_horizontal_imaginary(1u, stride, width, height, aH, bH, real, imag);
+        if (vertical) {
+            block_kernel_vertical_imaginary  (1u, stride, width, height, aV, bV, real, imag);
+        }
+        block_kernel_horizontal_imaginary(0u, stride, width, height, aH, bH, real, imag);
+        if (vertical) {
+            block_kernel_vertical_imaginary  (0u, stride, width, height, aV, bV, real, imag);
         }
     }
     else {
-        if (sides) {
-            process_sides(two_wavefunctions, offset_tile_x, offset_tile_y, alpha_x, alpha_y, tile_width, block_width, halo_x, read_y, read_height, write_offset, write_height, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, external_pot_real, external_pot_imag, p_real, p_imag, pb_real, pb_imag, next_real, next_imag, block_real, block_imag, imag_time, coordinate_system);
-        }
-        if (inner) {
-            for (size_t block_start = block_width - 2 * halo_x; block_start < tile_width - block_width; block_start += block_width - 2 * halo_x) {
-                memcpy2D(block_real, block_width * sizeof(double), &p_real[read_y * tile_width + block_start], tile_width * sizeof(double), block_width * sizeof(double), read_height);
-                memcpy2D(block_imag, block_width * sizeof(double), &p_imag[read_y * tile_width + block_start], tile_width * sizeof(double), block_width * sizeof(double), read_height);
-                if(imag_time)
-                    full_step_imaginary(two_wavefunctions, block_width, block_width, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                                        &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
-                else
-                    full_step(two_wavefunctions, block_width, block_width, read_height, offset_tile_x + block_start, offset_tile_y + read_y, alpha_x, alpha_y, aH, bH, aV, bV, kin_radial, coupling_a, coupling_b, coupling_aa, tile_width,
-                              &external_pot_real[read_y * tile_width + block_start], &external_pot_imag[read_y * tile_width + block_start], &pb_real[read_y * tile_width + block_start], &pb_imag[read_y * tile_width + block_start], block_real, block_imag, coordinate_system);
-                memcpy2D(&next_real[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_real[write_offset * block_width + halo_x], block_width * sizeof(double), (block_width - 2 * halo_x) * sizeof(double), write_height);
-                memcpy2D(&next_imag[(read_y + write_offset) * tile_width + block_start + halo_x], tile_width * sizeof(double), &block_imag[write_offset * block_width + halo_x], block_width * sizeof(double), (block_width - 2 * halo_x) * sizeof(double), write_height);
+        if (vertical) {
+            block_kernel_vertical  (0u, stride, width, height, aV, bV, real, imag);
+        }
+        block_kernel_horizontal(0u, stride, width, height, aH, bH, real, imag);
+        if (vertical) {
+            block_kernel_vertical  (1u, stride, width, height, aV, bV, real, imag);
+        }
+        block_kernel_horizontal(1u, stride, width, height, aH, bH, real, imag);
+        if (fourth_order) {
+            if (vertical) {
+                block_kernel_vertical_next(next_y[0], stride, width, height, aV2, bV2, real, imag);
+            }
+            block_kernel_horizontal_next(next_x[0], stride, width, height, aH2, bH2, real, imag);
+            if (vertical) {
+                block_kernel_vertical_next(next_y[1], stride, width, height, aV2, bV2, real, imag);
             }
+            block_kernel_horizontal_next(next_x[1], stride, width, height, aH2, bH2, real, imag);
+        }
+        if (cylindrical) {
+            block_kernel_radial_kinetic(0u, stride, width, height, radial, radial + tile_width, real, imag);
+            block_kernel_radial_kinetic(1u, stride, width, height, radial + 2 * tile_width, radial + 3 * tile_width, real, imag);
+        }
+        block_kernel_potential (sincos_accuracy, two_wavefunctions, stride, width, height, coupling_a, coupling_b, coupling_aa, tile_width, external_pot_real, external_pot_imag, pb_real, pb_imag, real, imag);
+        if (rotation) {
+            block_kernel_rotation  (stride, width, height, rot_ax, rot_bx, rot_ay, rot_by, real, imag);
+        }
+        if (cylindrical) {
+            block_kernel_radial_kinetic(1u, stride, width, height, radial + 2 * tile_width, radial + 3 * tile_width, real, imag);
+            block_kernel_radial_kinetic(0u, stride, width, height, radial, radial + tile_width, real, imag);
+        }
+        if (fourth_order) {
+            block_kernel_horizontal_next(next_x[1], stride, width, height, aH2, bH2, real, imag);
+            if (vertical) {
+                block_kernel_vertical_next(next_y[1], stride, width, height, aV2, bV2, real, imag);
+            }
+            block_kernel_horizontal_next(next_x[0], stride, width, height, aH2, bH2, real, imag);
+            if (vertical) {
+                block_kernel_vertical_next(next_y[0], stride, width, height, aV2, bV2, real, imag);
+            }
+        }
+        block_kernel_horizontal(1u, stride, width, height, aH, bH, real, imag);
+        if (vertical) {
+            block_kernel_vertical  (1u, stride, width, height, aV, bV, real, imag);
+        }
+        block_kernel_horizontal(0u, stride, width, height, aH, bH, real, imag);
+        if (vertical) {
+            block_kernel_vertical  (0u, stride, width, height, aV, bV, real, imag);
+        }
+    }
+}
+
+// Pick the full_step specialization, one flag at a time
+template <bool imag_time, bool cylindrical, bool two_wavefunctions, bool rotation, bool vertical, bool fourth_order>
+full_step_function select_full_step(int sincos_accuracy) {
+    // The accuracy only matters for the phase of the real time evolution
+    if (imag_time || sincos_accuracy == SINCOS_DOUBLE)
+        return full_step<imag_time, cylindrical, two_wavefunctions, rotation, vertical, fourth_order, SINCOS_DOUBLE>;
+    if (sincos_accuracy == SINCOS_SINGLE)
+        return full_step<imag_time, cylindrical, two_wavefunctions, rotation, vertical, fourth_order, SINCOS_SINGLE>;
+    return full_step<imag_time, cylindrical, two_wavefunctions, rotation, vertical, fourth_order, SINCOS_EXACT>;
+}
+
+template <bool imag_time, bool cylindrical, bool two_wavefunctions, bool rotation, bool vertical>
+full_step_function select_full_step(bool fourth_order, int sincos_accuracy) {
+    if (fourth_order)
+        return select_full_step<imag_time, cylindrical, two_wavefunctions, rotation, vertical, true>(sincos_accuracy);
+    return select_full_step<imag_time, cylindrical, two_wavefunctions, rotation, vertical, false>(sincos_accuracy);
+}
+
+template <bool imag_time, bool cylindrical, bool two_wavefunctions, bool rotation>
+full_step_function select_full_step(bool vertical, bool fourth_order, int sincos_accuracy) {
+    if (vertical)
+        return select_full_step<imag_time, cylindrical, two_wavefunctions, rotation, true>(fourth_order, sincos_accuracy);
+    return select_full_step<imag_time, cylindrical, two_wavefunctions, rotation, false>(fourth_order, sincos_accuracy);
+}
+
+template <bool imag_time, bool cylindrical, bool two_wavefunctions>
+full_step_function select_full_step(bool rotation, bool vertical, bool fourth_order, int sincos_accuracy) {
+    if (rotation)
+        return select_full_step<imag_time, cylindrical, two_wavefunctions, true>(vertical, fourth_order, sincos_accuracy);
+    return select_full_step<imag_time, cylindrical, two_wavefunctions, false>(vertical, fourth_order, sincos_accuracy);
+}
+
+template <bool imag_time, bool cylindrical>
+full_step_function select_full_step(bool two_wavefunctions, bool rotation, bool vertical, bool fourth_order, int sincos_accuracy) {
+    if (two_wavefunctions)
+        return select_full_step<imag_time, cylindrical, true>(rotation, vertical, fourth_order, sincos_accuracy);
+    return select_full_step<imag_time, cylindrical, false>(rotation, vertical, fourth_order, sincos_accuracy);
+}
+
+template <bool imag_time>
+full_step_function select_full_step(bool cylindrical, bool two_wavefunctions, bool rotation, bool vertical, bool fourth_order, int sincos_accuracy) {
+    if (cylindrical)
+        return select_full_step<imag_time, true>(two_wavefunctions, rotation, vertical, fourth_order, sincos_accuracy);
+    return select_full_step<imag_time, false>(two_wavefunctions, rotation, vertical, fourth_order, sincos_accuracy);
+}
+
+full_step_function select_full_step(bool imag_time, bool cylindrical, bool two_wavefunctions, bool rotation, bool vertical, bool fourth_order, int sincos_accuracy) {
+    if (imag_time)
+        return select_full_step<true>(cylindrical, two_wavefunctions, rotation, vertical, fourth_order, sincos_accuracy);
+    return select_full_step<false>(cylindrical, two_wavefunctions, rotation, vertical, fourth_order, sincos_accuracy);
+}
+
+// Copy width x height values between buffers whose rows are dstride and sstride values apart
+template <typename D, typename S>
+static inline void copy2D(D *dst, size_t dstride, const S *src, size_t sstride, size_t width, size_t height) {
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            dst[y * dstride + x] = D(src[y * sstride + x]);
         }
     }
+}
 
+template <typename D>
+static inline void copy2D(D *dst, size_t dstride, const D *src, size_t sstride, size_t width, size_t height) {
+    memcpy2D(dst, dstride * sizeof(D), src, sstride * sizeof(D), width * sizeof(D), height);
+}
 
-    delete[] block_real;
-    delete[] block_imag;
+/**
+ * Evolve a cached block, loaded with the rows [read_y, read_y + read_height) and
+ * the columns [read_x, read_x + read_width) of the tile, and write back the part
+ * of it starting at (write_x, write_y) in the block, without its halos.
+ */
+template <typename T>
+void process_block(full_step_function full_step, const double *rot_ax, const double *rot_bx, const double *rot_ay, const double *rot_by, size_t tile_width, size_t block_width,
+                   size_t read_x, size_t read_y, size_t read_width, size_t read_height, size_t write_x, size_t write_y, size_t write_width, size_t write_height,
+                   double aH, double bH, double aV, double bV, double aH2, double bH2, double aV2, double bV2, size_t origin_x, size_t origin_y,
+                   const double *radial, double coupling_a, double coupling_b, double coupling_aa,
+                   const double *external_pot_real, const double *external_pot_imag, const double * pb_real, const double * pb_imag,
+                   T * next_real, T * next_imag, double * block_real, double * block_imag, int steps) {
+    size_t offset = read_y * tile_width + read_x;
+    for (int step = 0; step < steps; ++step) {
+        full_step(block_width, read_width, read_height, &rot_ax[read_x], &rot_bx[read_x], &rot_ay[read_y], &rot_by[read_y], aH, bH, aV, bV, aH2, bH2, aV2, bV2, origin_x, origin_y, &radial[read_x], coupling_a, coupling_b, coupling_aa, tile_width,
+                  &external_pot_real[offset], &external_pot_imag[offset], &pb_real[offset], &pb_imag[offset], block_real, block_imag);
+    }
+    copy2D(&next_real[offset + write_y * tile_width + write_x], tile_width, &block_real[write_y * block_width + write_x], block_width, write_width, write_height);
+    copy2D(&next_imag[offset + write_y * tile_width + write_x], tile_width, &block_imag[write_y * block_width + write_x], block_width, write_width, write_height);
 }
 
+// Number of blocks, overlapping by 2 * halo, covering length
+static inline size_t count_blocks(size_t length, size_t block, size_t halo) {
+    if (length <= block) {
+        return 1;
+    }
+    // The last block ends at length, after the first one with room to spare
+    return (length - 2 * halo - 1) / (block - 2 * halo) + 1;
+}
+
+// The wave function in double precision, NULL when it is stored in single precision
+static inline const double *as_double(const double *wave_function) {
+    return wave_function;
+}
+
+static inline const double *as_double(const float *) {
+    return NULL;
+}
+
+static inline int thread_index() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// The loops over the bands use schedule(runtime): the static partition of the
+// bands when chunk is 0, which the buffers are first touched with (see
+// first_touch), or dynamic chunks of bands when chunk is positive
+static inline void set_band_schedule(int chunk, int *previous_kind, int *previous_chunk) {
+#ifdef _OPENMP
+    omp_sched_t kind;
+    omp_get_schedule(&kind, previous_chunk);
+    *previous_kind = int(kind);
+    omp_set_schedule(chunk == 0 ? omp_sched_static : omp_sched_dynamic, chunk);
+#endif
+}
+
+static inline void restore_schedule(int kind, int chunk) {
+#ifdef _OPENMP
+    omp_set_schedule(omp_sched_t(kind), chunk);
+#endif
+}
+
+static inline double wall_time() {
+#if defined(HAVE_MPI)
+    return MPI_Wtime();
+#elif defined(_OPENMP)
+    return omp_get_wtime();
+#else
+    return double(clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Model name of the CPU, as reported by the operating system
+static string cpu_model() {
+    ifstream cpuinfo("/proc/cpuinfo");
+    string line;
+    while (getline(cpuinfo, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            size_t start = line.find_first_not_of(" \t", line.find(':') + 1);
+            return start == string::npos ? "unknown" : line.substr(start);
+        }
+    }
+    return "unknown";
+}
+
+// Geometries found by the autotuner in this process, by key (see CPUBlock<T>::start_autotuning)
+static map<string, block_geometry> tuned_geometries;
+
 // Class methods
-CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
+template <typename T>
+CPUBlock<T>::CPUBlock(Lattice *grid, State *state, Hamiltonian *_hamiltonian,
                    double *_external_pot_real, double *_external_pot_imag,
-                   double delta_t, double _norm, bool _imag_time):
+                   double delta_t, double _norm, bool _imag_time, int _sincos_accuracy, bool _in_place):
     sense(0),
     state_index(0),
-    imag_time(_imag_time) {
+    imag_time(_imag_time),
+    sincos_accuracy(_sincos_accuracy),
+    in_place(_in_place),
+    block_width(BLOCK_WIDTH_CACHE),
+    band_chunk(0),
+    scratch(NULL),
+    scratch_capacity(0),
+    seams(NULL),
+    seam_capacity(0),
+    allocations(0),
+    hamiltonian(_hamiltonian) {
     delta_x = grid->delta_x;
     delta_y = grid->delta_y;
     halo_x = grid->halo_x;
     halo_y = grid->halo_y;
+    kinetic_order = grid->kinetic_order;
     periods = grid->periods;
-    rot_coord_x = hamiltonian->rot_coord_x;
-    rot_coord_y = hamiltonian->rot_coord_y;
-    alpha_x = hamiltonian->angular_velocity * delta_t * grid->delta_x / (2 * grid->delta_y);
-    alpha_y = hamiltonian->angular_velocity * delta_t * grid->delta_y / (2 * grid->delta_x);
+    rot_coord_x = _hamiltonian->rot_coord_x;
+    rot_coord_y = _hamiltonian->rot_coord_y;
     coupling_const = new double [3];
     LeeHuangYang_coupling = new double [2];
     norm = new double [1];
@@ -193,30 +342,11 @@ CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
     bH = new double [1];
     aV = new double [1];
     bV = new double [1];
+    aH2 = new double [1];
+    bH2 = new double [1];
+    aV2 = new double [1];
+    bV2 = new double [1];
     kin_radial = new double [1];
-    if (imag_time) {
-        aH[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aV[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-        }
-    }
-    else {
-        aH[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aV[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-        }
-    }
-    coupling_const[0] = hamiltonian->coupling_a * delta_t;
-    coupling_const[1] = 0.;
-    coupling_const[2] = 0.;
-    LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
-    LeeHuangYang_coupling[1] = 0;
     norm[0] = _norm;
     tot_norm = norm[0];
     coordinate_system = grid->coordinate_system;
@@ -227,11 +357,17 @@ CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
     MPI_Cart_shift(cartcomm, 1, 1, &neighbors[LEFT], &neighbors[RIGHT]);
 #endif
     if (halo_y == 0) {
+        block_width = BLOCK_WIDTH_CHAIN;
         block_height = 1;
     }
     else {
         block_height = BLOCK_HEIGHT_CACHE;
     }
+    steps_per_block = grid->steps_per_block;
+    steps_per_call = 1;
+    if (block_width <= 2 * halo_x || (halo_y != 0 && block_height <= 2 * halo_y)) {
+        my_abort("The halos are too wide for the cached blocks, reduce the number of steps per block.");
+    }
     start_x = grid->start_x;
     end_x = grid->end_x;
     inner_start_x = grid->inner_start_x;
@@ -243,97 +379,105 @@ CPUBlock::CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
     tile_width = end_x - start_x;
     tile_height = end_y - start_y;
 
-    p_real[0][0] = state->p_real;
-    p_imag[0][0] = state->p_imag;
-    p_real[0][1] = new double[tile_width * tile_height];
-    p_imag[0][1] = new double[tile_width * tile_height];
+    p_real[0][0] = attach_state(state->p_real);
+    p_imag[0][0] = attach_state(state->p_imag);
+    if (in_place) {
+        p_real[0][1] = p_real[0][0];
+        p_imag[0][1] = p_imag[0][0];
+    }
+    else {
+        p_real[0][1] = allocate_wave_function(tile_width * tile_height);
+        p_imag[0][1] = allocate_wave_function(tile_width * tile_height);
+        first_touch(p_real[0][1], tile_width, tile_height);
+        first_touch(p_imag[0][1], tile_width, tile_height);
+    }
     p_real[1][0] = NULL;
     p_imag[1][0] = NULL;
     p_real[1][1] = NULL;
     p_imag[1][1] = NULL;
+    other_modulus[0] = NULL;
+    other_modulus[1] = NULL;
     external_pot_real[0] = _external_pot_real;
     external_pot_imag[0] = _external_pot_imag;
     two_wavefunctions = false;
+    rotation_table = NULL;
+    radial_table[0] = NULL;
+    radial_table[1] = NULL;
+    set_time_step(delta_t);
+    full_step_kernel = select_full_step(imag_time, coordinate_system == "cylindrical", two_wavefunctions,
+                                        alpha_x != 0. && alpha_y != 0., tile_height > 1, kinetic_order == 4, sincos_accuracy);
+
+    // Cached blocks are allocated once, each starting on a cache line
+    size_t line = MEMORY_ALIGNMENT / sizeof(double);
+    scratch_block_size = (block_width * block_height + line - 1) / line * line;
+    reserve_scratch();
+    reserve_seams();
 
 #ifdef HAVE_MPI
+    int nProcs = 1;
+    MPI_Comm_size(cartcomm, &nProcs);
+    reduction_buffer = allocate(2 * nProcs);
+    MPI_Datatype wave_function_type = sizeof(T) == sizeof(double) ? MPI_DOUBLE : MPI_FLOAT;
+
     // Halo exchange uses wave pattern to communicate
     // halo_x-wide inner rows are sent first to left and right
     // Then full length rows are exchanged to the top and bottom
     int count = inner_end_y - inner_start_y;  // The number of rows in the halo submatrix
     int block_length = halo_x;  // The number of columns in the halo submatrix
     int stride = tile_width;  // The combined width of the matrix with the halo
-    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &verticalBorder);
+    MPI_Type_vector (count, block_length, stride, wave_function_type, &verticalBorder);
     MPI_Type_commit (&verticalBorder);
 
     count = halo_y; // The vertical halo in rows
     block_length = tile_width;  // The number of columns of the matrix
     stride = tile_width;  // The combined width of the matrix with the halo
-    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &horizontalBorder);
+    MPI_Type_vector (count, block_length, stride, wave_function_type, &horizontalBorder);
     MPI_Type_commit (&horizontalBorder);
 #endif
 }
 
-CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
-                   Hamiltonian2Component *hamiltonian,
+template <typename T>
+CPUBlock<T>::CPUBlock(Lattice *grid, State *state1, State *state2,
+                   Hamiltonian2Component *_hamiltonian,
                    double **_external_pot_real, double **_external_pot_imag,
-                   double delta_t, double *_norm, bool _imag_time):
+                   double delta_t, double *_norm, bool _imag_time, int _sincos_accuracy, bool _in_place):
     sense(0),
     state_index(0),
-    imag_time(_imag_time) {
+    imag_time(_imag_time),
+    sincos_accuracy(_sincos_accuracy),
+    in_place(_in_place),
+    block_width(BLOCK_WIDTH_CACHE),
+    band_chunk(0),
+    scratch(NULL),
+    scratch_capacity(0),
+    seams(NULL),
+    seam_capacity(0),
+    allocations(0),
+    hamiltonian(_hamiltonian) {
     delta_x = grid->delta_x;
     delta_y = grid->delta_y;
     halo_x = grid->halo_x;
     halo_y = grid->halo_y;
-    alpha_x = hamiltonian->angular_velocity * delta_t * grid->delta_x / (2 * grid->delta_y),
-    alpha_y = hamiltonian->angular_velocity * delta_t * grid->delta_y / (2 * grid->delta_x),
-    rot_coord_x = hamiltonian->rot_coord_x;
-    rot_coord_y = hamiltonian->rot_coord_y;
+    kinetic_order = grid->kinetic_order;
+    rot_coord_x = _hamiltonian->rot_coord_x;
+    rot_coord_y = _hamiltonian->rot_coord_y;
     aH = new double [2];
     bH = new double [2];
     aV = new double [2];
     bV = new double [2];
+    aH2 = new double [2];
+    bH2 = new double [2];
+    aV2 = new double [2];
+    bV2 = new double [2];
     kin_radial = new double [2];
-    if (imag_time) {
-        aH[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aH[1] = cosh(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        bH[1] = sinh(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        aV[0] = cosh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sinh(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        aV[1] = cosh(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        bV[1] = sinh(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-            kin_radial[1] = delta_t / (8. * hamiltonian->mass_b * grid->delta_x * grid->delta_x);
-        }
-    }
-    else {
-        aH[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        bH[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_x * grid->delta_x));
-        aH[1] = cos(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        bH[1] = sin(delta_t / (4. * hamiltonian->mass_b * grid->delta_x * grid->delta_x));
-        aV[0] = cos(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        bV[0] = sin(delta_t / (4. * hamiltonian->mass * grid->delta_y * grid->delta_y));
-        aV[1] = cos(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        bV[1] = sin(delta_t / (4. * hamiltonian->mass_b * grid->delta_y * grid->delta_y));
-        if (grid->coordinate_system == "cylindrical") {
-            kin_radial[0] = delta_t / (8. * hamiltonian->mass * grid->delta_x * grid->delta_x);
-            kin_radial[1] = delta_t / (8. * hamiltonian->mass_b * grid->delta_x * grid->delta_x);
-        }
-    }
     norm = new double [2];
     norm[0] = _norm[0];
     norm[1] = _norm[1];
     tot_norm = norm[0] + norm[1];
     coupling_const = new double[5];
-    coupling_const[0] = delta_t * hamiltonian->coupling_a;
-    coupling_const[1] = delta_t * hamiltonian->coupling_b;
-    coupling_const[2] = delta_t * hamiltonian->coupling_ab;
-    coupling_const[3] = 0.5 * hamiltonian->omega_r;
-    coupling_const[4] = 0.5 * hamiltonian->omega_i;
+    coupling_const[3] = 0.5 * _hamiltonian->omega_r;
+    coupling_const[4] = 0.5 * _hamiltonian->omega_i;
     LeeHuangYang_coupling = new double [2];
-    // LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
-    // LeeHuangYang_coupling[1] = hamiltonian->LeeHuangYang_coupling_b  * delta_t;
     periods = grid->periods;
     coordinate_system = grid->coordinate_system;
     angular_momentum[0] = state1->angular_momentum;
@@ -344,11 +488,17 @@ CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
     MPI_Cart_shift(cartcomm, 1, 1, &neighbors[LEFT], &neighbors[RIGHT]);
 #endif
     if (halo_y == 0) {
+        block_width = BLOCK_WIDTH_CHAIN;
         block_height = 1;
     }
     else {
         block_height = BLOCK_HEIGHT_CACHE;
     }
+    steps_per_block = grid->steps_per_block;
+    steps_per_call = 1;
+    if (block_width <= 2 * halo_x || (halo_y != 0 && block_height <= 2 * halo_y)) {
+        my_abort("The halos are too wide for the cached blocks, reduce the number of steps per block.");
+    }
 
     start_x = grid->start_x;
     end_x = grid->end_x;
@@ -360,197 +510,723 @@ CPUBlock::CPUBlock(Lattice *grid, State *state1, State *state2,
     inner_end_y = grid->inner_end_y;
     tile_width = end_x - start_x;
     tile_height = end_y - start_y;
-    p_real[0][0] = state1->p_real;
-    p_imag[0][0] = state1->p_imag;
-    p_real[1][0] = state2->p_real;
-    p_imag[1][0] = state2->p_imag;
+    p_real[0][0] = attach_state(state1->p_real);
+    p_imag[0][0] = attach_state(state1->p_imag);
+    p_real[1][0] = attach_state(state2->p_real);
+    p_imag[1][0] = attach_state(state2->p_imag);
 
     for(int i = 0; i < 2; i++) {
-        p_real[i][1] = new double[tile_width * tile_height];
-        p_imag[i][1] = new double[tile_width * tile_height];
-        memcpy2D(p_real[i][1], tile_width * sizeof(double), p_real[i][0], tile_width * sizeof(double), tile_width * sizeof(double), tile_height);
-        memcpy2D(p_imag[i][1], tile_width * sizeof(double), p_imag[i][0], tile_width * sizeof(double), tile_width * sizeof(double), tile_height);
+        if (in_place) {
+            p_real[i][1] = p_real[i][0];
+            p_imag[i][1] = p_imag[i][0];
+        }
+        else {
+            p_real[i][1] = allocate_wave_function(tile_width * tile_height);
+            p_imag[i][1] = allocate_wave_function(tile_width * tile_height);
+            first_touch(p_real[i][1], tile_width, tile_height);
+            first_touch(p_imag[i][1], tile_width, tile_height);
+            memcpy2D(p_real[i][1], tile_width * sizeof(T), p_real[i][0], tile_width * sizeof(T), tile_width * sizeof(T), tile_height);
+            memcpy2D(p_imag[i][1], tile_width * sizeof(T), p_imag[i][0], tile_width * sizeof(T), tile_width * sizeof(T), tile_height);
+        }
         external_pot_real[i] = _external_pot_real[i];
         external_pot_imag[i] = _external_pot_imag[i];
     }
     two_wavefunctions = true;
+    rotation_table = NULL;
+    radial_table[0] = NULL;
+    radial_table[1] = NULL;
+    set_time_step(delta_t);
+    full_step_kernel = select_full_step(imag_time, coordinate_system == "cylindrical", two_wavefunctions,
+                                        alpha_x != 0. && alpha_y != 0., tile_height > 1, kinetic_order == 4, sincos_accuracy);
+
+    // Cached blocks are allocated once, each starting on a cache line
+    size_t line = MEMORY_ALIGNMENT / sizeof(double);
+    scratch_block_size = (block_width * block_height + line - 1) / line * line;
+    reserve_scratch();
+    reserve_seams();
+    // The modulus of the other wave function is needed when it is overwritten, or not in double precision
+    other_modulus[0] = NULL;
+    other_modulus[1] = NULL;
+    for (int i = 0; i < 2; i++) {
+        if (sizeof(T) != sizeof(double) || (in_place && i == 1)) {
+            other_modulus[i] = allocate(tile_width * tile_height);
+            first_touch(other_modulus[i], tile_width, tile_height);
+        }
+    }
 
 #ifdef HAVE_MPI
+    int nProcs = 1;
+    MPI_Comm_size(cartcomm, &nProcs);
+    reduction_buffer = allocate(2 * nProcs);
+    MPI_Datatype wave_function_type = sizeof(T) == sizeof(double) ? MPI_DOUBLE : MPI_FLOAT;
+
     // Halo exchange uses wave pattern to communicate
     // halo_x-wide inner rows are sent first to left and right
     // Then full length rows are exchanged to the top and bottom
     int count = inner_end_y - inner_start_y;    // The number of rows in the halo submatrix
     int block_length = halo_x;  // The number of columns in the halo submatrix
     int stride = tile_width;    // The combined width of the matrix with the halo
-    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &verticalBorder);
+    MPI_Type_vector (count, block_length, stride, wave_function_type, &verticalBorder);
     MPI_Type_commit (&verticalBorder);
 
     count = halo_y; // The vertical halo in rows
     block_length = tile_width;  // The number of columns of the matrix
     stride = tile_width;    // The combined width of the matrix with the halo
-    MPI_Type_vector (count, block_length, stride, MPI_DOUBLE, &horizontalBorder);
+    MPI_Type_vector (count, block_length, stride, wave_function_type, &horizontalBorder);
     MPI_Type_commit (&horizontalBorder);
 #endif
 }
 
-void CPUBlock::update_potential(double *_external_pot_real, double *_external_pot_imag, int which) {
+template <typename T>
+void CPUBlock<T>::update_potential(double *_external_pot_real, double *_external_pot_imag, int which) {
     external_pot_real[which] = _external_pot_real;
     external_pot_imag[which] = _external_pot_imag;
 }
 
-CPUBlock::~CPUBlock() {
-    delete [] p_real[0][1];
-    delete [] p_imag[0][1];
-    delete [] p_real[1][1];
-    delete [] p_imag[1][1];
+template <typename T>
+double *CPUBlock<T>::allocate(size_t count) {
+    ++allocations;
+    return allocate_aligned(count);
+}
+
+template <typename T>
+T *CPUBlock<T>::allocate_wave_function(size_t count) {
+    // The aligned buffers are counted in doubles
+    return reinterpret_cast<T *>(allocate((count * sizeof(T) + sizeof(double) - 1) / sizeof(double)));
+}
+
+template <typename T>
+static inline void free_wave_function(T *wave_function) {
+    free_aligned(reinterpret_cast<double *>(wave_function));
+}
+
+template <typename T>
+T *CPUBlock<T>::attach_state(double *buffer) {
+    if (sizeof(T) == sizeof(double)) {
+        return reinterpret_cast<T *>(buffer);
+    }
+    T *wave_function = allocate_wave_function(tile_width * tile_height);
+    first_touch(wave_function, tile_width, tile_height);
+    copy2D(wave_function, tile_width, buffer, tile_width, tile_width, tile_height);
+    return wave_function;
+}
+
+template <typename T>
+void CPUBlock<T>::reserve_scratch() {
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    if (2 * threads * scratch_block_size > scratch_capacity) {
+        free_aligned(scratch);
+        scratch_capacity = 2 * threads * scratch_block_size;
+        scratch = allocate(scratch_capacity);
+    }
+}
+
+template <typename T>
+void CPUBlock<T>::reserve_seams() {
+    if (!in_place) {
+        return;
+    }
+    size_t bands = count_blocks(tile_height, block_height, halo_y);
+    size_t columns = count_blocks(tile_width, block_width, halo_x);
+    size_t capacity = 2 * ((columns - 1) * tile_height * 2 * halo_x + (bands - 1) * 2 * halo_y * tile_width);
+    if (capacity > seam_capacity) {
+        free_wave_function(seams);
+        seam_capacity = capacity;
+        seams = allocate_wave_function(seam_capacity);
+    }
+}
+
+/**
+ * The seams are the strips 2 * halo_x wide around the boundary between two
+ * column blocks, for the whole height of the tile, followed by the strips
+ * 2 * halo_y high around the boundary between two bands, for the whole width
+ * of the tile. Their real parts come first, then their imaginary parts.
+ */
+template <typename T>
+void CPUBlock<T>::save_seams() {
+    size_t bands = count_blocks(tile_height, block_height, halo_y);
+    size_t columns = count_blocks(tile_width, block_width, halo_x);
+    size_t seam_width = 2 * halo_x, seam_height = 2 * halo_y;
+    size_t column_seams = (columns - 1) * tile_height * seam_width;
+    size_t row_seams = (bands - 1) * seam_height * tile_width;
+    for (int part = 0; part < 2; ++part) {
+        const T *tile = part == 0 ? p_real[state_index][sense] : p_imag[state_index][sense];
+        T *column_seam = seams + part * (column_seams + row_seams);
+        T *row_seam = column_seam + column_seams;
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < int(tile_height); ++y) {
+            for (size_t boundary = 0; boundary < columns - 1; ++boundary) {
+                memcpy(&column_seam[(boundary * tile_height + y) * seam_width], &tile[y * tile_width + (boundary + 1) * (block_width - seam_width)], seam_width * sizeof(T));
+            }
+        }
+        for (size_t boundary = 0; boundary < bands - 1; ++boundary) {
+            memcpy(&row_seam[boundary * seam_height * tile_width], &tile[(boundary + 1) * (block_height - seam_height) * tile_width], seam_height * tile_width * sizeof(T));
+        }
+    }
+}
+
+/**
+ * Only the squared modulus of the other wave function enters the evolution of
+ * each one, so the modulus over sqrt(2) can stand for both its parts. Both are
+ * taken before the first wave function is evolved: the second one sees the
+ * first as it was before this step.
+ */
+template <typename T>
+void CPUBlock<T>::save_moduli() {
+    for (int i = 0; i < 2; ++i) {
+        if (other_modulus[i] == NULL) {
+            continue;
+        }
+        const T *tile_real = p_real[1 - i][sense];
+        const T *tile_imag = p_imag[1 - i][sense];
+        double *modulus = other_modulus[i];
+        #pragma omp parallel for schedule(static)
+        for (int y = 0; y < int(tile_height); ++y) {
+            for (size_t x = y * tile_width; x < (y + 1) * tile_width; ++x) {
+                double re = tile_real[x], im = tile_imag[x];
+                modulus[x] = sqrt(0.5 * (re * re + im * im));
+            }
+        }
+    }
+}
+
+template <typename T>
+void CPUBlock<T>::load_seams(size_t band, size_t column, size_t bands, size_t columns, size_t read_x, size_t read_y, size_t read_width, size_t read_height,
+                          double *block_real, double *block_imag) const {
+    size_t seam_width = 2 * halo_x, seam_height = 2 * halo_y;
+    size_t column_seams = (columns - 1) * tile_height * seam_width;
+    size_t row_seams = (bands - 1) * seam_height * tile_width;
+    for (int part = 0; part < 2; ++part) {
+        double *block = part == 0 ? block_real : block_imag;
+        const T *column_seam = seams + part * (column_seams + row_seams);
+        const T *row_seam = column_seam + column_seams;
+        if (column > 0) {
+            copy2D(block, block_width, &column_seam[((column - 1) * tile_height + read_y) * seam_width], seam_width, seam_width, read_height);
+        }
+        if (column < columns - 1) {
+            copy2D(&block[block_width - seam_width], block_width, &column_seam[(column * tile_height + read_y) * seam_width], seam_width, seam_width, read_height);
+        }
+        if (band > 0) {
+            copy2D(block, block_width, &row_seam[(band - 1) * seam_height * tile_width + read_x], tile_width, read_width, seam_height);
+        }
+        if (band < bands - 1) {
+            copy2D(&block[(block_height - seam_height) * block_width], block_width, &row_seam[band * seam_height * tile_width + read_x], tile_width, read_width, seam_height);
+        }
+    }
+}
+
+template <typename T>
+void CPUBlock<T>::init_rotation_tables() {
+    if (rotation_table == NULL) {
+        rotation_table = allocate(2 * (tile_width + tile_height));
+    }
+    rot_ax = rotation_table;
+    rot_bx = rot_ax + tile_width;
+    rot_ay = rot_bx + tile_width;
+    rot_by = rot_ay + tile_height;
+    for (size_t i = 0; i < tile_width; ++i) {
+        double alpha_xx = alpha_x * (start_x - rot_coord_x + i);
+        rot_ax[i] = imag_time ? cosh(alpha_xx) : cos(alpha_xx);
+        rot_bx[i] = imag_time ? sinh(alpha_xx) : sin(alpha_xx);
+    }
+    for (size_t j = 0; j < tile_height; ++j) {
+        double alpha_yy = - 0.5 * alpha_y * (start_y - rot_coord_y + j);
+        rot_ay[j] = imag_time ? cosh(alpha_yy) : cos(alpha_yy);
+        rot_by[j] = imag_time ? sinh(alpha_yy) : sin(alpha_yy);
+    }
+}
+
+template <typename T>
+void CPUBlock<T>::init_radial_tables(int component) {
+    if (radial_table[component] == NULL) {
+        radial_table[component] = allocate(4 * tile_width);
+    }
+    double *radial_a[2] = {radial_table[component], radial_table[component] + 2 * tile_width};
+    double *radial_b[2] = {radial_a[0] + tile_width, radial_a[1] + tile_width};
+    for (size_t i = 0; i < tile_width; ++i) {
+        radial_a[0][i] = radial_a[1][i] = 1.;
+        radial_b[0][i] = radial_b[1][i] = 0.;
+    }
+    if (coordinate_system != "cylindrical") {
+        return;
+    }
+    for (size_t i = 0; i + 1 < tile_width; ++i) {
+        // Pair of columns (i, i + 1)
+        size_t parity = i % 2;
+        double x = start_x - rot_coord_x + i;
+        double a, b, c;
+        if (x == 0) {
+            // The first two points of the radial coordinate have a different coupling
+            double kin = 2 * kin_radial[component];
+            a = imag_time ? cosh(kin) : cos(kin);
+            b = c = imag_time ? -sinh(kin) : -sin(kin);
+        }
+        else {
+            double kin = kin_radial[component] / sqrt(x * x - 0.25);
+            double ratio = sqrt((2 * x + 1) / (2 * x - 1));
+            double sin_kin = imag_time ? sin(kin) : sinh(kin);
+            a = imag_time ? cos(kin) : cosh(kin);
+            b = sin_kin * ratio;
+            c = - sin_kin / ratio;
+        }
+        radial_a[parity][i] = a;
+        radial_b[parity][i] = b;
+        radial_a[parity][i + 1] = a;
+        radial_b[parity][i + 1] = c;
+    }
+}
+
+/**
+ * The coefficients of the kinetic, rotation and radial terms, and the coupling
+ * constants, depend on the time step, which the higher order splittings change
+ * between the sub-steps of each time step.
+ */
+template <typename T>
+void CPUBlock<T>::set_time_step(double delta_t) {
+    double mass[2] = {hamiltonian->mass, hamiltonian->mass};
+    coupling_const[0] = hamiltonian->coupling_a * delta_t;
+    if (two_wavefunctions) {
+        Hamiltonian2Component *hamiltonian2 = static_cast<Hamiltonian2Component *>(hamiltonian);
+        mass[1] = hamiltonian2->mass_b;
+        coupling_const[1] = hamiltonian2->coupling_b * delta_t;
+        coupling_const[2] = hamiltonian2->coupling_ab * delta_t;
+        LeeHuangYang_coupling[0] = 0.;
+    }
+    else {
+        coupling_const[1] = 0.;
+        coupling_const[2] = 0.;
+        LeeHuangYang_coupling[0] = hamiltonian->LeeHuangYang_coupling_a  * delta_t;
+    }
+    LeeHuangYang_coupling[1] = 0.;
+    for (int i = 0; i < (two_wavefunctions ? 2 : 1); i++) {
+        double kinetic_x = delta_t / (4. * mass[i] * delta_x * delta_x);
+        double kinetic_y = delta_t / (4. * mass[i] * delta_y * delta_y);
+        // The fourth order stencil couples the neighbours by 4/3 and the next neighbours by -1/12
+        double kinetic_x2 = kinetic_order == 4 ? -kinetic_x / 12. : 0.;
+        double kinetic_y2 = kinetic_order == 4 ? -kinetic_y / 12. : 0.;
+        if (kinetic_order == 4) {
+            kinetic_x *= 4. / 3.;
+            kinetic_y *= 4. / 3.;
+        }
+        aH[i] = imag_time ? cosh(kinetic_x) : cos(kinetic_x);
+        bH[i] = imag_time ? sinh(kinetic_x) : sin(kinetic_x);
+        aV[i] = imag_time ? cosh(kinetic_y) : cos(kinetic_y);
+        bV[i] = imag_time ? sinh(kinetic_y) : sin(kinetic_y);
+        aH2[i] = imag_time ? cosh(kinetic_x2) : cos(kinetic_x2);
+        bH2[i] = imag_time ? sinh(kinetic_x2) : sin(kinetic_x2);
+        aV2[i] = imag_time ? cosh(kinetic_y2) : cos(kinetic_y2);
+        bV2[i] = imag_time ? sinh(kinetic_y2) : sin(kinetic_y2);
+        kin_radial[i] = delta_t / (8. * mass[i] * delta_x * delta_x);
+        init_radial_tables(i);
+    }
+    alpha_x = hamiltonian->angular_velocity * delta_t * delta_x / (2 * delta_y);
+    alpha_y = hamiltonian->angular_velocity * delta_t * delta_y / (2 * delta_x);
+    init_rotation_tables();
+}
+
+template <typename T>
+void CPUBlock<T>::set_steps_per_call(int steps) {
+    if (steps < 1 || steps > steps_per_block) {
+        my_abort("The number of steps per call exceeds the steps per block allowed by the halos.");
+    }
+    steps_per_call = steps;
+}
+
+/**
+ * In place, the buffers of the state are those the kernel evolves: moving to
+ * another state keeps the exponentials, the cached blocks and the seams.
+ */
+template <typename T>
+void CPUBlock<T>::set_state(State *state, double _norm) {
+    if (!in_place || two_wavefunctions || sizeof(T) != sizeof(double)) {
+        my_abort("Only the in place kernel of a single wave function in double precision moves to another state.");
+    }
+    p_real[0][0] = p_real[0][1] = attach_state(state->p_real);
+    p_imag[0][0] = p_imag[0][1] = attach_state(state->p_imag);
+    norm[0] = _norm;
+    tot_norm = norm[0];
+    sense = 0;
+}
+
+template <typename T>
+void CPUBlock<T>::set_block_geometry(block_geometry geometry) {
+    if (geometry.width % 2 != 0 || geometry.width <= 2 * halo_x || geometry.chunk < TASK_SCHEDULE ||
+            (halo_y != 0 && (geometry.height % 2 != 0 || geometry.height <= 2 * halo_y))) {
+        my_abort("Invalid geometry of the cached blocks.");
+    }
+    block_width = geometry.width;
+    block_height = halo_y == 0 ? 1 : geometry.height;
+    band_chunk = geometry.chunk;
+    size_t line = MEMORY_ALIGNMENT / sizeof(double);
+    scratch_block_size = (block_width * block_height + line - 1) / line * line;
+    reserve_scratch();
+    reserve_seams();
+}
+
+template <typename T>
+block_geometry CPUBlock<T>::get_block_geometry() const {
+    block_geometry geometry = {block_width, block_height, band_chunk};
+    return geometry;
+}
+
+/**
+ * The autotuner times every candidate geometry for AUTOTUNE_STEPS time steps of
+ * the actual evolution, with the static partition of the bands, and then the
+ * chunks of bands of the dynamic schedule and the tasks on the fastest geometry. The blocks
+ * give the same result whatever their size, so the evolution goes on unaffected
+ * while the candidates are timed.
+ *
+ * The results are kept for the process, and appended to cache_file, if given,
+ * as a line with the key, a tab, and the width, height and chunk. Only the first
+ * process writes to the file.
+ */
+template <typename T>
+void CPUBlock<T>::start_autotuning(string cache_file) {
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    stringstream key;
+    key << cpu_model() << " | " << tile_width << "x" << tile_height << " | halos "
+        << halo_x << "x" << halo_y << " | " << threads << " threads | " << (two_wavefunctions ? 2 : 1) << " components";
+    tuning_key = key.str();
+    tuning_cache_file = cache_file;
+    tuning_candidates.clear();
+
+    map<string, block_geometry>::iterator tuned = tuned_geometries.find(tuning_key);
+    if (tuned == tuned_geometries.end() && cache_file != "") {
+        ifstream cache(cache_file.c_str());
+        string line;
+        while (getline(cache, line)) {
+            size_t tab = line.rfind('\t');
+            if (tab == string::npos || line.substr(0, tab) != tuning_key) {
+                continue;
+            }
+            istringstream entry(line.substr(tab + 1));
+            block_geometry geometry;
+            if (entry >> geometry.width >> geometry.height >> geometry.chunk) {
+                tuned_geometries[tuning_key] = geometry;
+                tuned = tuned_geometries.find(tuning_key);
+            }
+        }
+    }
+    if (tuned != tuned_geometries.end()) {
+        set_block_geometry(tuned->second);
+        return;
+    }
+
+    // From blocks fitting a small L2 cache to blocks fitting a large one
+    const size_t widths[] = {64, 128, 256, 512};
+    const size_t heights[] = {64, 128, 256};
+    const size_t max_area = 512 * 128;
+    // The segments of 1D chains, from a small L1 cache to a large L2 one
+    const size_t chain_widths[] = {1024, 4096, 16384};
+    const size_t *candidates = halo_y == 0 ? chain_widths : widths;
+    size_t candidate_count = halo_y == 0 ? sizeof(chain_widths) / sizeof(chain_widths[0]) : sizeof(widths) / sizeof(widths[0]);
+    vector<size_t> candidate_widths, candidate_heights;
+    for (size_t i = 0; i < candidate_count; ++i) {
+        // Blocks wider than the tile are all the same
+        if (!candidate_widths.empty() && candidate_widths.back() >= tile_width) {
+            break;
+        }
+        if (candidates[i] > 2 * halo_x) {
+            candidate_widths.push_back(candidates[i]);
+        }
+    }
+    if (halo_y == 0) {
+        candidate_heights.push_back(1);
+    }
+    for (size_t i = 0; halo_y != 0 && i < sizeof(heights) / sizeof(heights[0]); ++i) {
+        if (!candidate_heights.empty() && candidate_heights.back() >= tile_height) {
+            break;
+        }
+        if (heights[i] > 2 * halo_y) {
+            candidate_heights.push_back(heights[i]);
+        }
+    }
+    for (size_t i = 0; i < candidate_widths.size(); ++i) {
+        for (size_t j = 0; j < candidate_heights.size(); ++j) {
+            if (candidate_widths[i] * candidate_heights[j] <= max_area) {
+                block_geometry geometry = {candidate_widths[i], candidate_heights[j], 0};
+                tuning_candidates.push_back(geometry);
+            }
+        }
+    }
+    if (tuning_candidates.empty()) {
+        // The halos are wider than any candidate: keep the current geometry
+        return;
+    }
+    tuning_best = tuning_candidates[0];
+    tuning_best_time = DBL_MAX;
+    tuning_time = DBL_MAX;
+    tuning_elapsed = 0.;
+    tuning_step = 0;
+    tuning_chunks = false;
+    // Make room in the arena for the largest candidate at once
+    size_t largest = 0;
+    for (size_t i = 1; i < tuning_candidates.size(); ++i) {
+        if (tuning_candidates[i].width * tuning_candidates[i].height >
+                tuning_candidates[largest].width * tuning_candidates[largest].height) {
+            largest = i;
+        }
+    }
+    set_block_geometry(tuning_candidates[largest]);
+    set_block_geometry(tuning_candidates[0]);
+}
+
+template <typename T>
+void CPUBlock<T>::next_tuning_step() {
+    if (tuning_step > 0) {
+        tuning_time = min(tuning_time, tuning_elapsed);
+    }
+    tuning_elapsed = 0.;
+    if (tuning_step < AUTOTUNE_STEPS) {
+        ++tuning_step;
+        return;
+    }
+    if (tuning_time < tuning_best_time) {
+        tuning_best = tuning_candidates[0];
+        tuning_best_time = tuning_time;
+    }
+    tuning_candidates.erase(tuning_candidates.begin());
+    tuning_time = DBL_MAX;
+    tuning_step = 1;
+    if (tuning_candidates.empty() && !tuning_chunks && halo_y != 0 && tile_height > tuning_best.height) {
+        tuning_chunks = true;
+        for (int chunk = 1; chunk <= 4; chunk *= 2) {
+            block_geometry geometry = {tuning_best.width, tuning_best.height, chunk};
+            tuning_candidates.push_back(geometry);
+        }
+        block_geometry geometry = {tuning_best.width, tuning_best.height, TASK_SCHEDULE};
+        tuning_candidates.push_back(geometry);
+    }
+    if (tuning_candidates.empty()) {
+        finish_autotuning();
+        return;
+    }
+    set_block_geometry(tuning_candidates[0]);
+}
+
+template <typename T>
+void CPUBlock<T>::finish_autotuning() {
+    tuning_candidates.clear();
+    set_block_geometry(tuning_best);
+    tuned_geometries[tuning_key] = tuning_best;
+    if (tuning_cache_file == "") {
+        return;
+    }
+    int rank = 0;
+#ifdef HAVE_MPI
+    MPI_Comm_rank(cartcomm, &rank);
+#endif
+    if (rank == 0) {
+        ofstream cache(tuning_cache_file.c_str(), ios::app);
+        if (!cache) {
+            my_abort("Cannot write the autotuning cache file " + tuning_cache_file + ".");
+        }
+        cache << tuning_key << '\t' << tuning_best.width << ' ' << tuning_best.height << ' ' << tuning_best.chunk << endl;
+    }
+}
+
+template <typename T>
+CPUBlock<T>::~CPUBlock() {
+    for (int i = 0; i < 2; i++) {
+        if (!in_place) {
+            free_wave_function(p_real[i][1]);
+            free_wave_function(p_imag[i][1]);
+        }
+        if (sizeof(T) != sizeof(double)) {
+            free_wave_function(p_real[i][0]);
+            free_wave_function(p_imag[i][0]);
+        }
+        free_aligned(other_modulus[i]);
+    }
+    free_aligned(scratch);
+    free_wave_function(seams);
+    free_aligned(rotation_table);
+    free_aligned(radial_table[0]);
+    free_aligned(radial_table[1]);
+#ifdef HAVE_MPI
+    free_aligned(reduction_buffer);
+#endif
     delete [] aH;
     delete [] bH;
     delete [] aV;
     delete [] bV;
+    delete [] aH2;
+    delete [] bH2;
+    delete [] aV2;
+    delete [] bV2;
+    delete [] kin_radial;
     delete [] norm;
     delete [] coupling_const;
     delete [] LeeHuangYang_coupling;
 }
 
-void CPUBlock::run_kernel() {
-    // Inner part
-    int inner = 1, sides = 0;
-    if (halo_y == 0) {
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, 0, block_height, halo_y, block_height - 2 * halo_y,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
+/**
+ * The blocks of a band overlap by 2 * halo_x: the column block number column
+ * reads the columns from column * (block_width - 2 * halo_x), and the bands
+ * overlap the same way by 2 * halo_y. Each block writes back its part without
+ * the halos, except at the edges of the tile.
+ *
+ * In place, the halos of a block are the part its neighbours write back, and
+ * they may have done it already: they are read from the seams saved at the
+ * beginning of the step instead (see save_seams).
+ */
+template <typename T>
+void CPUBlock<T>::run_block(size_t band, size_t column, size_t bands, size_t columns) {
+    double *block_real = scratch + 2 * thread_index() * scratch_block_size;
+    double *block_imag = block_real + scratch_block_size;
+    size_t read_x = column * (block_width - 2 * halo_x);
+    size_t read_width = min(block_width, tile_width - read_x);
+    size_t write_x = column == 0 ? 0 : halo_x;
+    size_t write_width = (column == columns - 1 ? read_width : block_width - halo_x) - write_x;
+    size_t read_y = band * (block_height - 2 * halo_y);
+    size_t read_height = min(block_height, tile_height - read_y);
+    size_t write_y = band == 0 ? 0 : halo_y;
+    size_t write_height = (band == bands - 1 ? read_height : block_height - halo_y) - write_y;
+    size_t offset = read_y * tile_width + read_x;
 
+    copy2D(block_real, block_width, &p_real[state_index][sense][offset], tile_width, read_width, read_height);
+    copy2D(block_imag, block_width, &p_imag[state_index][sense][offset], tile_width, read_width, read_height);
+    if (in_place) {
+        load_seams(band, column, bands, columns, read_x, read_y, read_width, read_height, block_real, block_imag);
     }
-    else {
-#ifndef HAVE_MPI
-        #pragma omp parallel default(shared)
-#endif
+    const double *pb_real = other_modulus[state_index];
+    const double *pb_imag = other_modulus[state_index];
+    if (pb_real == NULL) {
+        pb_real = as_double(p_real[1 - state_index][sense]);
+        pb_imag = as_double(p_imag[1 - state_index][sense]);
+    }
+    process_block(full_step_kernel, rot_ax, rot_bx, rot_ay, rot_by, tile_width, block_width,
+                  read_x, read_y, read_width, read_height, write_x, write_y, write_width, write_height,
+                  aH[state_index], bH[state_index], aV[state_index], bV[state_index],
+                  aH2[state_index], bH2[state_index], aV2[state_index], bV2[state_index],
+                  (start_x + read_x) & 3, (start_y + read_y) & 3, radial_table[state_index],
+                  coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
+                  external_pot_real[state_index], external_pot_imag[state_index], pb_real, pb_imag,
+                  p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
+                  block_real, block_imag, steps_per_call);
+}
+
+template <typename T>
+bool CPUBlock<T>::is_halo_block(size_t band, size_t column, size_t bands, size_t columns) const {
+    return column == 0 || column == columns - 1 || (halo_y != 0 && (band == 0 || band == bands - 1));
+}
+
+/**
+ * Evolve either the blocks at the edge of the tile or the inner ones, each pair
+ * of band and column block being a task. The threads of the team take the tasks
+ * as they become idle, so the work is balanced whatever the shape of the tile.
+ */
+template <typename T>
+void CPUBlock<T>::run_block_tasks(bool halo) {
+    size_t bands = count_blocks(tile_height, block_height, halo_y);
+    size_t columns = count_blocks(tile_width, block_width, halo_x);
+    #pragma omp parallel default(shared)
+    {
+        #pragma omp single
         {
-#ifndef HAVE_MPI
-            #pragma omp for schedule(dynamic)
+            for (size_t band = 0; band < bands; ++band) {
+                for (size_t column = 0; column < columns; ++column) {
+                    if (is_halo_block(band, column, bands, columns) == halo) {
+                        #pragma omp task firstprivate(band, column)
+                        run_block(band, column, bands, columns);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename T>
+void CPUBlock<T>::run_kernel() {
+    // Inner part
+    double start_time = wall_time();
+    reserve_scratch();
+    size_t bands = count_blocks(tile_height, block_height, halo_y);
+    size_t columns = count_blocks(tile_width, block_width, halo_x);
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
 #endif
-            for (int block_start = block_height - 2 * halo_y;
-            block_start < int(tile_height - block_height);
-            block_start += block_height - 2 * halo_y) {
-
-                process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                alpha_x, alpha_y, tile_width, block_width, block_height,
-                halo_x, block_start, block_height, halo_y, block_height - 2 * halo_y,
-                aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                external_pot_real[state_index], external_pot_imag[state_index],
-                p_real[state_index][sense], p_imag[state_index][sense],
-                p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                inner, sides, imag_time, coordinate_system);
+    if (halo_y == 0) {
+        // 1D chain: the segments between the two at the ends, with the static
+        // partition the buffers are first touched with
+        #pragma omp parallel for schedule(static)
+        for (int column = 1; column < int(columns) - 1; ++column) {
+            run_block(0, column, bands, columns);
+        }
+    }
+    else if (band_chunk == TASK_SCHEDULE || int(bands) - 2 < threads) {
+        // Too few bands to keep the threads busy
+        run_block_tasks(false);
+    }
+    else {
+        int previous_kind = 0, previous_chunk = 0;
+        set_band_schedule(band_chunk, &previous_kind, &previous_chunk);
+        #pragma omp parallel for schedule(runtime)
+        for (int band = 1; band < int(bands) - 1; ++band) {
+            for (size_t column = 1; column < columns - 1; ++column) {
+                run_block(band, column, bands, columns);
             }
         }
+        restore_schedule(previous_kind, previous_chunk);
+    }
+    if (is_autotuning()) {
+        tuning_elapsed += (wall_time() - start_time) / steps_per_call;
     }
     sense = 1 - sense;
 }
 
-void CPUBlock::run_kernel_on_halo() {
-    int inner = 0, sides = 0;
-    if (tile_height <= block_height) {
-        // One full band
-        inner = 1;
-        sides = 1;
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, 0, tile_height, 0, tile_height,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
+template <typename T>
+void CPUBlock<T>::run_kernel_on_halo() {
+    if (is_autotuning() && state_index == 0) {
+        next_tuning_step();
     }
-    else {
+    double start_time = wall_time();
+    reserve_scratch();
+    if (two_wavefunctions && state_index == 0) {
+        save_moduli();
+    }
+    if (in_place) {
+        save_seams();
+    }
+    // The halo exchange starts as soon as these blocks are done
+    run_block_tasks(true);
+    if (is_autotuning()) {
+        tuning_elapsed += (wall_time() - start_time) / steps_per_call;
+    }
+}
 
-        // Sides
-        inner = 0;
-        sides = 1;
-#ifndef HAVE_MPI
-        #pragma omp parallel for schedule(dynamic)
-#endif
-        for (int block_start = block_height - 2 * halo_y; block_start < tile_height - block_height; block_start += block_height - 2 * halo_y) {
-            process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                         alpha_x, alpha_y, tile_width, block_width, block_height,
-                         halo_x, block_start, block_height, halo_y, block_height - 2 * halo_y,
-                         aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                         coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                         external_pot_real[state_index], external_pot_imag[state_index],
-                         p_real[state_index][sense], p_imag[state_index][sense],
-                         p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                         p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                         inner, sides, imag_time, coordinate_system);
-        }
-        size_t block_start;
-        for (block_start = block_height - 2 * halo_y; block_start < tile_height - block_height; block_start += block_height - 2 * halo_y) {}
-        // First band
-        inner = 1;
-        sides = 1;
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, 0, block_height, 0, block_height - halo_y,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
-
-        // Last band
-        inner = 1;
-        sides = 1;
-        process_band(two_wavefunctions, start_x - rot_coord_x, start_y - rot_coord_y,
-                     alpha_x, alpha_y, tile_width, block_width, block_height,
-                     halo_x, block_start, tile_height - block_start, halo_y, tile_height - block_start - halo_y,
-                     aH[state_index], bH[state_index], aV[state_index], bV[state_index], kin_radial[state_index],
-                     coupling_const[state_index], coupling_const[2], LeeHuangYang_coupling[state_index],
-                     external_pot_real[state_index], external_pot_imag[state_index],
-                     p_real[state_index][sense], p_imag[state_index][sense],
-                     p_real[1 - state_index][sense], p_imag[1 - state_index][sense],
-                     p_real[state_index][1 - sense], p_imag[state_index][1 - sense],
-                     inner, sides, imag_time, coordinate_system);
-    }
-}
-
-double CPUBlock::calculate_squared_norm(bool global) const {
+template <typename T>
+double CPUBlock<T>::calculate_squared_norm(bool global) const {
     double norm2 = 0.;
-#ifndef HAVE_MPI
     #pragma omp parallel for reduction(+:norm2) schedule(dynamic, 8)
-#endif
     for(int i = inner_start_y - start_y; i < inner_end_y - start_y; i++) {
         for(int j = inner_start_x - start_x; j < inner_end_x - start_x; j++) {
-            norm2 += p_real[state_index][sense][j + i * tile_width] * p_real[state_index][sense][j + i * tile_width] + p_imag[state_index][sense][j + i * tile_width] * p_imag[state_index][sense][j + i * tile_width];
+            double re = p_real[state_index][sense][j + i * tile_width], im = p_imag[state_index][sense][j + i * tile_width];
+            norm2 += re * re + im * im;
         }
     }
 #ifdef HAVE_MPI
     if (global) {
         int nProcs = 1;
         MPI_Comm_size(cartcomm, &nProcs);
-        double *sums = new double[nProcs];
-        MPI_Allgather(&norm2, 1, MPI_DOUBLE, sums, 1, MPI_DOUBLE, cartcomm);
+        MPI_Allgather(&norm2, 1, MPI_DOUBLE, reduction_buffer, 1, MPI_DOUBLE, cartcomm);
         norm2 = 0.;
         for(int i = 0; i < nProcs; i++)
-            norm2 += sums[i];
-        delete [] sums;
+            norm2 += reduction_buffer[i];
     }
 #endif
     return norm2 * delta_x * delta_y;
 }
 
-void CPUBlock::wait_for_completion() {
+template <typename T>
+void CPUBlock<T>::wait_for_completion() {
     if (imag_time && norm[state_index] != 0) {
         //normalization
         double tot_norm = calculate_squared_norm(true);
@@ -571,16 +1247,18 @@ void CPUBlock::wait_for_completion() {
     }
 }
 
-void CPUBlock::get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double *dest_real2, double * dest_imag2) const {
-    memcpy2D(dest_real, dest_stride * sizeof(double), &(p_real[0][sense][y * tile_width + x]), tile_width * sizeof(double), width * sizeof(double), height);
-    memcpy2D(dest_imag, dest_stride * sizeof(double), &(p_imag[0][sense][y * tile_width + x]), tile_width * sizeof(double), width * sizeof(double), height);
+template <typename T>
+void CPUBlock<T>::get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double *dest_real2, double * dest_imag2) const {
+    copy2D(dest_real, dest_stride, &(p_real[0][sense][y * tile_width + x]), tile_width, width, height);
+    copy2D(dest_imag, dest_stride, &(p_imag[0][sense][y * tile_width + x]), tile_width, width, height);
     if (dest_real2 != 0) {
-        memcpy2D(dest_real2, dest_stride * sizeof(double), &(p_real[1][sense][y * tile_width + x]), tile_width * sizeof(double), width * sizeof(double), height);
-        memcpy2D(dest_imag2, dest_stride * sizeof(double), &(p_imag[1][sense][y * tile_width + x]), tile_width * sizeof(double), width * sizeof(double), height);
+        copy2D(dest_real2, dest_stride, &(p_real[1][sense][y * tile_width + x]), tile_width, width, height);
+        copy2D(dest_imag2, dest_stride, &(p_imag[1][sense][y * tile_width + x]), tile_width, width, height);
     }
 }
 
-void CPUBlock::rabi_coupling(double var, double delta_t) {
+template <typename T>
+void CPUBlock<T>::rabi_coupling(double var, double delta_t) {
     double norm_omega = sqrt(coupling_const[3] * coupling_const[3] + coupling_const[4] * coupling_const[4]);
     double cc, cs_r, cs_i;
     if(imag_time) {
@@ -609,43 +1287,38 @@ void CPUBlock::rabi_coupling(double var, double delta_t) {
     }
 }
 
-void CPUBlock::normalization() {
+template <typename T>
+void CPUBlock<T>::normalization() {
     if(imag_time && (coupling_const[3] != 0 || coupling_const[4] != 0)) {
         //normalization
-        int nProcs = 1;
-#ifdef HAVE_MPI
-        MPI_Comm_size(cartcomm, &nProcs);
-#endif
-
-        double sum_a = 0., sum_b = 0., *sums, *sums_a, *sums_b;
-        sums = new double[nProcs];
-        sums_a = new double[nProcs];
-        sums_b = new double[nProcs];
+        double sum_a = 0., sum_b = 0.;
         for(int i = inner_start_y - start_y; i < inner_end_y - start_y; i++) {
             for(int j = inner_start_x - start_x; j < inner_end_x - start_x; j++) {
-                sum_a += p_real[0][sense][j + i * tile_width] * p_real[0][sense][j + i * tile_width] + p_imag[0][sense][j + i * tile_width] * p_imag[0][sense][j + i * tile_width];
+                double re = p_real[0][sense][j + i * tile_width], im = p_imag[0][sense][j + i * tile_width];
+                sum_a += re * re + im * im;
             }
         }
         if(p_real[1] != NULL) {
             for(int i = inner_start_y - start_y; i < inner_end_y - start_y; i++) {
                 for(int j = inner_start_x - start_x; j < inner_end_x - start_x; j++) {
-                    sum_b += p_real[1][sense][j + i * tile_width] * p_real[1][sense][j + i * tile_width] + p_imag[1][sense][j + i * tile_width] * p_imag[1][sense][j + i * tile_width];
+                    double re = p_real[1][sense][j + i * tile_width], im = p_imag[1][sense][j + i * tile_width];
+                    sum_b += re * re + im * im;
                 }
             }
         }
+        double tot_sum_a = sum_a, tot_sum_b = sum_b;
 #ifdef HAVE_MPI
-
-        MPI_Allgather(&sum_a, 1, MPI_DOUBLE, sums_a, 1, MPI_DOUBLE, cartcomm);
-        MPI_Allgather(&sum_b, 1, MPI_DOUBLE, sums_b, 1, MPI_DOUBLE, cartcomm);
-#else
-        sums_a[0] = sum_a;
-        sums_b[0] = sum_b;
-#endif
-        double tot_sum_a = 0., tot_sum_b = 0.;
+        int nProcs = 1;
+        MPI_Comm_size(cartcomm, &nProcs);
+        MPI_Allgather(&sum_a, 1, MPI_DOUBLE, reduction_buffer, 1, MPI_DOUBLE, cartcomm);
+        MPI_Allgather(&sum_b, 1, MPI_DOUBLE, reduction_buffer + nProcs, 1, MPI_DOUBLE, cartcomm);
+        tot_sum_a = 0.;
+        tot_sum_b = 0.;
         for(int i = 0; i < nProcs; i++) {
-            tot_sum_a += sums_a[i];
-            tot_sum_b += sums_b[i];
+            tot_sum_a += reduction_buffer[i];
+            tot_sum_b += reduction_buffer[nProcs + i];
         }
+#endif
         double _norm = sqrt((tot_sum_a + tot_sum_b) * delta_x * delta_y / tot_norm);
 
         for(size_t i = 0; i < tile_height; i++) {
@@ -664,11 +1337,11 @@ void CPUBlock::normalization() {
             }
             norm[1] = tot_sum_b / (tot_sum_a + tot_sum_b) * tot_norm;
         }
-        delete[] sums;
     }
 }
 
-void CPUBlock::cpy_first_positive_to_first_negative() {
+template <typename T>
+void CPUBlock<T>::cpy_first_positive_to_first_negative() {
     if (imag_time && coordinate_system == "cylindrical") {
         // performs the copy only for the tiles containing the origin of the radial coordinate
         if (start_x <= 0) {
@@ -690,7 +1363,8 @@ void CPUBlock::cpy_first_positive_to_first_negative() {
     }
 }
 
-void CPUBlock::start_halo_exchange() {
+template <typename T>
+void CPUBlock<T>::start_halo_exchange() {
     // Halo exchange: LEFT/RIGHT
 #ifdef HAVE_MPI
     int offset = (inner_start_y - start_y) * tile_width;
@@ -709,15 +1383,16 @@ void CPUBlock::start_halo_exchange() {
 #else
     if(periods[1] != 0) {
         int offset = (inner_start_y - start_y) * tile_width;
-        memcpy2D(&(p_real[state_index][1 - sense][offset]), tile_width * sizeof(double), &(p_real[state_index][1 - sense][offset + tile_width - 2 * halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
-        memcpy2D(&(p_imag[state_index][1 - sense][offset]), tile_width * sizeof(double), &(p_imag[state_index][1 - sense][offset + tile_width - 2 * halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
-        memcpy2D(&(p_real[state_index][1 - sense][offset + tile_width - halo_x]), tile_width * sizeof(double), &(p_real[state_index][1 - sense][offset + halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
-        memcpy2D(&(p_imag[state_index][1 - sense][offset + tile_width - halo_x]), tile_width * sizeof(double), &(p_imag[state_index][1 - sense][offset + halo_x]), tile_width * sizeof(double), halo_x * sizeof(double), tile_height - 2 * halo_y);
+        memcpy2D(&(p_real[state_index][1 - sense][offset]), tile_width * sizeof(T), &(p_real[state_index][1 - sense][offset + tile_width - 2 * halo_x]), tile_width * sizeof(T), halo_x * sizeof(T), inner_end_y - inner_start_y);
+        memcpy2D(&(p_imag[state_index][1 - sense][offset]), tile_width * sizeof(T), &(p_imag[state_index][1 - sense][offset + tile_width - 2 * halo_x]), tile_width * sizeof(T), halo_x * sizeof(T), inner_end_y - inner_start_y);
+        memcpy2D(&(p_real[state_index][1 - sense][offset + tile_width - halo_x]), tile_width * sizeof(T), &(p_real[state_index][1 - sense][offset + halo_x]), tile_width * sizeof(T), halo_x * sizeof(T), inner_end_y - inner_start_y);
+        memcpy2D(&(p_imag[state_index][1 - sense][offset + tile_width - halo_x]), tile_width * sizeof(T), &(p_imag[state_index][1 - sense][offset + halo_x]), tile_width * sizeof(T), halo_x * sizeof(T), inner_end_y - inner_start_y);
     }
 #endif
 }
 
-void CPUBlock::finish_halo_exchange() {
+template <typename T>
+void CPUBlock<T>::finish_halo_exchange() {
 #ifdef HAVE_MPI
     MPI_Waitall(8, req, statuses);
 
@@ -740,10 +1415,13 @@ void CPUBlock::finish_halo_exchange() {
 #else
     if(periods[0] != 0) {
         int offset = (inner_end_y - start_y) * tile_width;
-        memcpy2D(&(p_real[state_index][sense][0]), tile_width * sizeof(double), &(p_real[state_index][sense][offset - halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
-        memcpy2D(&(p_imag[state_index][sense][0]), tile_width * sizeof(double), &(p_imag[state_index][sense][offset - halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
-        memcpy2D(&(p_real[state_index][sense][offset]), tile_width * sizeof(double), &(p_real[state_index][sense][halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
-        memcpy2D(&(p_imag[state_index][sense][offset]), tile_width * sizeof(double), &(p_imag[state_index][sense][halo_y * tile_width]), tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+        memcpy2D(&(p_real[state_index][sense][0]), tile_width * sizeof(T), &(p_real[state_index][sense][offset - halo_y * tile_width]), tile_width * sizeof(T), tile_width * sizeof(T), halo_y);
+        memcpy2D(&(p_imag[state_index][sense][0]), tile_width * sizeof(T), &(p_imag[state_index][sense][offset - halo_y * tile_width]), tile_width * sizeof(T), tile_width * sizeof(T), halo_y);
+        memcpy2D(&(p_real[state_index][sense][offset]), tile_width * sizeof(T), &(p_real[state_index][sense][halo_y * tile_width]), tile_width * sizeof(T), tile_width * sizeof(T), halo_y);
+        memcpy2D(&(p_imag[state_index][sense][offset]), tile_width * sizeof(T), &(p_imag[state_index][sense][halo_y * tile_width]), tile_width * sizeof(T), tile_width * sizeof(T), halo_y);
     }
 #endif
 }
+
+template class CPUBlock<double>;
+template class CPUBlock<float>;
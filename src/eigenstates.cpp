@@ -0,0 +1,343 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+#include "kernel.h"
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// Sweeps of the Jacobi rotations diagonalizing the Hamiltonian within the block
+#define JACOBI_SWEEPS 50
+
+/**
+ * Eigenvalues and eigenvectors of a Hermitian matrix, row-major, by Jacobi
+ * rotations: each one zeroes an off-diagonal element, after a phase that
+ * makes it real. The matrix is overwritten; the columns of vectors are the
+ * eigenvectors.
+ */
+static void diagonalize_hermitian(int n, complex<double> *matrix, complex<double> *vectors, double *values) {
+    for (int i = 0; i < n; i++) {
+        for (int j = 0; j < n; j++) {
+            vectors[i * n + j] = i == j ? 1. : 0.;
+        }
+    }
+    for (int sweep = 0; sweep < JACOBI_SWEEPS; sweep++) {
+        double off_diagonal = 0., diagonal = 0.;
+        for (int p = 0; p < n; p++) {
+            diagonal += norm(matrix[p * n + p]);
+            for (int q = p + 1; q < n; q++) {
+                off_diagonal += norm(matrix[p * n + q]);
+            }
+        }
+        if (off_diagonal <= DBL_EPSILON * DBL_EPSILON * diagonal) {
+            break;
+        }
+        for (int p = 0; p < n; p++) {
+            for (int q = p + 1; q < n; q++) {
+                double modulus = abs(matrix[p * n + q]);
+                if (modulus == 0.) {
+                    continue;
+                }
+                complex<double> phase = matrix[p * n + q] / modulus;
+                double theta = (matrix[q * n + q].real() - matrix[p * n + p].real()) / (2. * modulus);
+                double t = (theta >= 0. ? 1. : -1.) / (fabs(theta) + sqrt(theta * theta + 1.));
+                double c = 1. / sqrt(t * t + 1.);
+                double s = t * c;
+                // Columns p and q times the rotation, then rows p and q times its adjoint
+                for (int k = 0; k < n; k++) {
+                    complex<double> a_p = matrix[k * n + p], a_q = matrix[k * n + q];
+                    matrix[k * n + p] = c * a_p - s * conj(phase) * a_q;
+                    matrix[k * n + q] = s * a_p + c * conj(phase) * a_q;
+                    complex<double> v_p = vectors[k * n + p], v_q = vectors[k * n + q];
+                    vectors[k * n + p] = c * v_p - s * conj(phase) * v_q;
+                    vectors[k * n + q] = s * v_p + c * conj(phase) * v_q;
+                }
+                for (int k = 0; k < n; k++) {
+                    complex<double> a_p = matrix[p * n + k], a_q = matrix[q * n + k];
+                    matrix[p * n + k] = c * a_p - s * phase * a_q;
+                    matrix[q * n + k] = s * a_p + c * phase * a_q;
+                }
+            }
+        }
+    }
+    for (int k = 0; k < n; k++) {
+        values[k] = matrix[k * n + k].real();
+    }
+}
+
+EigenstateBlock::EigenstateBlock(Lattice *_grid, vector<State*> &_states, Hamiltonian *hamiltonian,
+                                 double *external_pot_real, double *external_pot_imag, double delta_t):
+    grid(_grid), states(_states) {
+    count = states.size();
+    stencil = new StencilHamiltonian(grid, hamiltonian, false);
+    size_t tile_size = stencil->get_tile_size();
+    int tile_width = grid->end_x - grid->start_x;
+    h_real = allocate_aligned(2 * tile_size);
+    h_imag = h_real + tile_size;
+    first_touch(h_real, tile_width, 2 * tile_size / tile_width);
+    // Initial guesses may be far from orthogonal: the second pass restores the orthogonality lost to rounding
+    orthonormalize();
+    orthonormalize();
+    kernel = new CPUBlock<double>(grid, states[0], hamiltonian, external_pot_real, external_pot_imag,
+                                  delta_t, 1., true, SINCOS_DOUBLE, true);
+    steps_per_call = 1;
+    if (grid->steps_per_block > 1 && !hamiltonian->potential->depends_on_time()) {
+        steps_per_call = grid->steps_per_block;
+    }
+}
+
+EigenstateBlock::~EigenstateBlock() {
+    delete kernel;
+    delete stencil;
+    free_aligned(h_real);
+}
+
+/**
+ * The halos are exchanged after every call, the last one included: the
+ * states keep consistent halos for the Hamiltonian and the next evolution.
+ */
+void EigenstateBlock::evolve(int iterations) {
+    for (int k = 0; k < count; k++) {
+        kernel->set_state(states[k], 1.);
+        for (int i = 0, steps = 1; i < iterations; i += steps) {
+            if (steps_per_call > 1) {
+                steps = min(steps_per_call, iterations - i);
+                kernel->set_steps_per_call(steps);
+            }
+            kernel->run_kernel_on_halo();
+            kernel->start_halo_exchange();
+            kernel->run_kernel();
+            kernel->finish_halo_exchange();
+            kernel->wait_for_completion();
+        }
+        states[k]->expected_values_updated = false;
+    }
+}
+
+/**
+ * The rows of all the states stay in cache while the products of all the
+ * pairs sum over them. The products <psi_a|f_b> of the fields f_b with the
+ * states a <= b are packed by columns of the upper triangle, from b (b + 1).
+ */
+void EigenstateBlock::add_overlaps(int first, int last, const double *const *fields_real,
+                                   const double *const *fields_imag, double *sums) const {
+    int tile_width = grid->end_x - grid->start_x;
+    int size = (last + 1) * (last + 2) - first * (first + 1);
+    #pragma omp parallel
+    {
+        double *partial = new double[size];
+        for (int p = 0; p < size; p++) {
+            partial[p] = 0.;
+        }
+        #pragma omp for
+        for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
+            size_t row = i * tile_width;
+            for (int b = first, p = 0; b <= last; b++) {
+                const double *b_real = fields_real[b - first] + row;
+                const double *b_imag = fields_imag[b - first] + row;
+                for (int a = 0; a <= b; a++, p += 2) {
+                    const double *a_real = states[a]->p_real + row;
+                    const double *a_imag = states[a]->p_imag + row;
+                    double sum_real = 0., sum_imag = 0.;
+                    for (int j = grid->inner_start_x - grid->start_x; j < grid->inner_end_x - grid->start_x; ++j) {
+                        sum_real += a_real[j] * b_real[j] + a_imag[j] * b_imag[j];
+                        sum_imag += a_real[j] * b_imag[j] - a_imag[j] * b_real[j];
+                    }
+                    partial[p] += sum_real;
+                    partial[p + 1] += sum_imag;
+                }
+            }
+        }
+        #pragma omp critical
+        for (int p = 0; p < size; p++) {
+            sums[first * (first + 1) + p] += partial[p];
+        }
+        delete [] partial;
+    }
+}
+
+/**
+ * Every process applies the same coefficients to the whole tile, halos
+ * included, which stay consistent with those of the neighbors.
+ */
+void EigenstateBlock::combine(const complex<double> *coefficients, bool triangular) {
+    int tile_width = grid->end_x - grid->start_x;
+    int tile_height = grid->end_y - grid->start_y;
+    #pragma omp parallel
+    {
+        // Rows of the new states, when they depend on all the old ones
+        double *rows = triangular ? NULL : new double[2 * count * tile_width];
+        #pragma omp for
+        for (int i = 0; i < tile_height; ++i) {
+            size_t row = i * tile_width;
+            for (int b = 0; b < count; b++) {
+                double *b_real = states[b]->p_real + row;
+                double *b_imag = states[b]->p_imag + row;
+                if (!triangular) {
+                    b_real = rows + 2 * b * tile_width;
+                    b_imag = b_real + tile_width;
+                    for (int j = 0; j < tile_width; ++j) {
+                        b_real[j] = 0.;
+                        b_imag[j] = 0.;
+                    }
+                }
+                for (int a = 0; a < (triangular ? b : count); a++) {
+                    const double *a_real = states[a]->p_real + row;
+                    const double *a_imag = states[a]->p_imag + row;
+                    double c_real = coefficients[a * count + b].real();
+                    double c_imag = coefficients[a * count + b].imag();
+                    // Forward substitution subtracts the lower states, already solved for
+                    if (triangular) {
+                        c_real = -c_real;
+                        c_imag = -c_imag;
+                    }
+                    for (int j = 0; j < tile_width; ++j) {
+                        b_real[j] += a_real[j] * c_real - a_imag[j] * c_imag;
+                        b_imag[j] += a_real[j] * c_imag + a_imag[j] * c_real;
+                    }
+                }
+                if (triangular) {
+                    double scale = 1. / coefficients[b * count + b].real();
+                    for (int j = 0; j < tile_width; ++j) {
+                        b_real[j] *= scale;
+                        b_imag[j] *= scale;
+                    }
+                }
+            }
+            if (!triangular) {
+                for (int b = 0; b < count; b++) {
+                    memcpy(states[b]->p_real + row, rows + 2 * b * tile_width, tile_width * sizeof(double));
+                    memcpy(states[b]->p_imag + row, rows + (2 * b + 1) * tile_width, tile_width * sizeof(double));
+                }
+            }
+        }
+        delete [] rows;
+    }
+    for (int k = 0; k < count; k++) {
+        states[k]->expected_values_updated = false;
+    }
+}
+
+/**
+ * Gram-Schmidt in its Cholesky form: the overlaps S_ab = <psi_a|psi_b> of all
+ * the pairs come from a single reduction, and the Cholesky factor S = R^H R,
+ * upper triangular, gives the states of Gram-Schmidt,
+ * psi_b = sum_{a <= b} q_a R_ab, solved for the q_b by forward substitution.
+ */
+void EigenstateBlock::orthonormalize() {
+    double cell = grid->delta_x * grid->delta_y;
+    int pairs = count * (count + 1) / 2;
+    double *overlaps = new double[2 * pairs];
+    for (int p = 0; p < 2 * pairs; p++) {
+        overlaps[p] = 0.;
+    }
+    const double **fields = new const double *[2 * count];
+    for (int b = 0; b < count; b++) {
+        fields[b] = states[b]->p_real;
+        fields[count + b] = states[b]->p_imag;
+    }
+    add_overlaps(0, count - 1, fields, fields + count, overlaps);
+    delete [] fields;
+#ifdef HAVE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, overlaps, 2 * pairs, MPI_DOUBLE, MPI_SUM, grid->cartcomm);
+#endif
+
+    complex<double> *factor = new complex<double>[count * count];
+    for (int b = 0; b < count; b++) {
+        for (int a = 0; a <= b; a++) {
+            int p = b * (b + 1) + 2 * a;
+            complex<double> overlap(overlaps[p] * cell, overlaps[p + 1] * cell);
+            for (int c = 0; c < a; c++) {
+                overlap -= conj(factor[c * count + a]) * factor[c * count + b];
+            }
+            if (a < b) {
+                factor[a * count + b] = overlap / factor[a * count + a];
+            }
+            else if (overlap.real() <= DBL_EPSILON * overlaps[p] * cell) {
+                my_abort("The states of the block are linearly dependent.");
+            }
+            else {
+                factor[b * count + b] = sqrt(overlap.real());
+            }
+        }
+    }
+    delete [] overlaps;
+    combine(factor, true);
+    delete [] factor;
+}
+
+/**
+ * The Hamiltonian within the block, H_ab = <psi_a|H psi_b>, comes from a
+ * single reduction too; the states become its eigenvectors, whose energies
+ * only depend on the subspace spanned by the block. The Hamiltonian is that
+ * of the energy of the solver.
+ */
+void EigenstateBlock::rotate_to_eigenstates(double *energies) {
+    double cell = grid->delta_x * grid->delta_y;
+    int pairs = count * (count + 1) / 2;
+    double *elements = new double[2 * pairs];
+    for (int p = 0; p < 2 * pairs; p++) {
+        elements[p] = 0.;
+    }
+    for (int b = 0; b < count; b++) {
+        stencil->apply(0, states[b]->p_real, states[b]->p_imag, h_real, h_imag);
+        add_overlaps(b, b, &h_real, &h_imag, elements);
+    }
+#ifdef HAVE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, elements, 2 * pairs, MPI_DOUBLE, MPI_SUM, grid->cartcomm);
+#endif
+    complex<double> *matrix = new complex<double>[count * count];
+    for (int b = 0; b < count; b++) {
+        for (int a = 0; a <= b; a++) {
+            int p = b * (b + 1) + 2 * a;
+            matrix[a * count + b] = complex<double>(elements[p] * cell, elements[p + 1] * cell);
+            matrix[b * count + a] = conj(matrix[a * count + b]);
+        }
+    }
+    delete [] elements;
+
+    complex<double> *vectors = new complex<double>[count * count];
+    double *values = new double[count];
+    diagonalize_hermitian(count, matrix, vectors, values);
+    // Order the eigenvectors by energy
+    int *order = new int[count];
+    for (int k = 0; k < count; k++) {
+        order[k] = k;
+    }
+    for (int k = 0; k < count; k++) {
+        for (int l = k + 1; l < count; l++) {
+            if (values[order[l]] < values[order[k]]) {
+                swap(order[k], order[l]);
+            }
+        }
+    }
+    for (int a = 0; a < count; a++) {
+        for (int b = 0; b < count; b++) {
+            matrix[a * count + b] = vectors[a * count + order[b]];
+        }
+    }
+    for (int k = 0; k < count; k++) {
+        energies[k] = values[order[k]];
+    }
+    combine(matrix, false);
+    delete [] order;
+    delete [] values;
+    delete [] vectors;
+    delete [] matrix;
+}
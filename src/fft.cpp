@@ -0,0 +1,464 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+#include "kernel.h"
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// Side of the square blocks of the transpositions, which fit in the L1 cache
+#define TRANSPOSE_BLOCK 32
+
+static inline int thread_index() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+FourierTransform::FourierTransform(int _length): length(_length) {
+    int remaining = length;
+    int radix = 4;
+    while (remaining > 1) {
+        while (remaining % radix != 0) {
+            // 4, then 2, then the odd numbers: only primes divide what is left
+            radix = radix == 4 ? 2 : radix == 2 ? 3 : radix + 2;
+            if (radix * radix > remaining) {
+                radix = remaining;
+            }
+        }
+        factors.push_back(radix);
+        remaining /= radix;
+    }
+    twiddles.resize(length);
+    for (int k = 0; k < length; k++) {
+        double phase = -2. * M_PI * k / length;
+        twiddles[k] = complex<double>(cos(phase), sin(phase));
+    }
+}
+
+void FourierTransform::transform(const complex<double> *in, complex<double> *out, bool inverse) const {
+    if (length == 1) {
+        out[0] = in[0];
+        return;
+    }
+    work(out, in, 1, 0, inverse);
+}
+
+/**
+ * Decimation in time: the subsequences of in starting at q * stride, for
+ * q < p, are transformed into the consecutive chunks of out of length m, and
+ * the butterflies of radix p combine the dots u of the chunks, after their
+ * twiddle factors exp(-2 pi i q stride u / n), into the dots u + q m.
+ */
+void FourierTransform::work(complex<double> *out, const complex<double> *in, size_t stride, int stage, bool inverse) const {
+    int p = factors[stage];
+    size_t m = length / (stride * p);
+    if (m == 1) {
+        for (int q = 0; q < p; q++) {
+            out[q] = in[q * stride];
+        }
+    }
+    else {
+        for (int q = 0; q < p; q++) {
+            work(out + q * m, in + q * stride, stride * p, stage + 1, inverse);
+        }
+    }
+    // exp(-i theta) forward, exp(i theta) inverse: sign of the imaginary unit
+    double sign = inverse ? -1. : 1.;
+    const complex<double> minus_i(0., -sign);
+    complex<double> s[5];
+    vector<complex<double> > generic;
+    if (p > 5) {
+        generic.resize(p);
+    }
+    complex<double> *values = p > 5 ? &generic[0] : s;
+    for (size_t u = 0; u < m; u++) {
+        for (int q = 0; q < p; q++) {
+            complex<double> w = twiddles[q * stride * u];
+            values[q] = out[u + q * m] * (inverse ? conj(w) : w);
+        }
+        if (p == 2) {
+            out[u] = values[0] + values[1];
+            out[u + m] = values[0] - values[1];
+        }
+        else if (p == 3) {
+            const double sin_60 = 0.86602540378443864676;
+            complex<double> t = values[0] - 0.5 * (values[1] + values[2]);
+            complex<double> d = minus_i * sin_60 * (values[1] - values[2]);
+            out[u] = values[0] + values[1] + values[2];
+            out[u + m] = t + d;
+            out[u + 2 * m] = t - d;
+        }
+        else if (p == 4) {
+            complex<double> a = values[0] + values[2], b = values[0] - values[2];
+            complex<double> c = values[1] + values[3], d = minus_i * (values[1] - values[3]);
+            out[u] = a + c;
+            out[u + m] = b + d;
+            out[u + 2 * m] = a - c;
+            out[u + 3 * m] = b - d;
+        }
+        else if (p == 5) {
+            const double cos_72 = 0.30901699437494742410, cos_144 = -0.80901699437494742410;
+            const double sin_72 = 0.95105651629515357212, sin_144 = 0.58778525229247312917;
+            complex<double> a1 = values[1] + values[4], b1 = values[1] - values[4];
+            complex<double> a2 = values[2] + values[3], b2 = values[2] - values[3];
+            complex<double> t1 = values[0] + cos_72 * a1 + cos_144 * a2;
+            complex<double> t2 = values[0] + cos_144 * a1 + cos_72 * a2;
+            complex<double> d1 = minus_i * (sin_72 * b1 + sin_144 * b2);
+            complex<double> d2 = minus_i * (sin_144 * b1 - sin_72 * b2);
+            out[u] = values[0] + a1 + a2;
+            out[u + m] = t1 + d1;
+            out[u + 2 * m] = t2 + d2;
+            out[u + 3 * m] = t2 - d2;
+            out[u + 4 * m] = t1 - d1;
+        }
+        else {
+            size_t turn = length / p;
+            for (int k = 0; k < p; k++) {
+                complex<double> sum = 0.;
+                for (int q = 0; q < p; q++) {
+                    complex<double> w = twiddles[(q * k % p) * turn];
+                    sum += values[q] * (inverse ? conj(w) : w);
+                }
+                out[u + k * m] = sum;
+            }
+        }
+    }
+}
+
+// Copy width x height dots between layouts where the dot (x, y) is at x * sx + y * sy, by square blocks
+static void copy_rectangle(const complex<double> *src, size_t src_sx, size_t src_sy,
+                           complex<double> *dst, size_t dst_sx, size_t dst_sy, int width, int height) {
+    #pragma omp parallel for
+    for (int y0 = 0; y0 < height; y0 += TRANSPOSE_BLOCK) {
+        for (int x0 = 0; x0 < width; x0 += TRANSPOSE_BLOCK) {
+            for (int y = y0; y < min(height, y0 + TRANSPOSE_BLOCK); y++) {
+                for (int x = x0; x < min(width, x0 + TRANSPOSE_BLOCK); x++) {
+                    dst[x * dst_sx + y * dst_sy] = src[x * src_sx + y * src_sy];
+                }
+            }
+        }
+    }
+}
+
+// Split of length dots among parts: the first and last dot of each one
+static void split(int length, int parts, int part, int *first, int *last) {
+    *first = (int)((long)length * part / parts);
+    *last = (int)((long)length * (part + 1) / parts);
+}
+
+FFTKernel::FFTKernel(Lattice *_grid, State *state, Hamiltonian *_hamiltonian, double *_external_pot_real, double *_external_pot_imag,
+                     double delta_t, double _norm, bool _imag_time, int _sincos_accuracy):
+    grid(_grid), hamiltonian(_hamiltonian), imag_time(_imag_time), sincos_accuracy(_sincos_accuracy), norm(_norm),
+    external_pot_real(_external_pot_real), external_pot_imag(_external_pot_imag), steps_per_call(1), allocations(0) {
+    halos = new StencilHamiltonian(grid, hamiltonian, false);
+    dim_x = grid->global_no_halo_dim_x;
+    dim_y = grid->global_no_halo_dim_y;
+    transform_x = new FourierTransform(dim_x);
+    transform_y = new FourierTransform(dim_y);
+    ranks = 1;
+    rank = 0;
+#ifdef HAVE_MPI
+    MPI_Comm_size(grid->cartcomm, &ranks);
+    MPI_Comm_rank(grid->cartcomm, &rank);
+#endif
+    int tile[4] = {grid->inner_start_x, grid->inner_end_x, grid->inner_start_y, grid->inner_end_y};
+    tiles.resize(4 * ranks);
+#ifdef HAVE_MPI
+    MPI_Allgather(tile, 4, MPI_INT, &tiles[0], 4, MPI_INT, grid->cartcomm);
+#else
+    memcpy(&tiles[0], tile, 4 * sizeof(int));
+#endif
+    rows.resize(4 * ranks);
+    columns.resize(4 * ranks);
+    for (int r = 0; r < ranks; r++) {
+        rows[4 * r] = 0;
+        rows[4 * r + 1] = dim_x;
+        split(dim_y, ranks, r, &rows[4 * r + 2], &rows[4 * r + 3]);
+        split(dim_x, ranks, r, &columns[4 * r], &columns[4 * r + 1]);
+        columns[4 * r + 2] = 0;
+        columns[4 * r + 3] = dim_y;
+    }
+
+    int tile_width = grid->end_x - grid->start_x;
+    int tile_height = grid->end_y - grid->start_y;
+    size_t tile_size = tile_width * tile_height;
+    size_t inner_size = (tile[1] - tile[0]) * (tile[3] - tile[2]);
+    size_t row_size = (rows[4 * rank + 3] - rows[4 * rank + 2]) * dim_x;
+    size_t column_size = (columns[4 * rank + 1] - columns[4 * rank]) * dim_y;
+    exchange_length = ranks > 1 ? max(inner_size, max(row_size, column_size)) : 0;
+    line_length = max(dim_x, dim_y);
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    // Wave function, then complex buffers: local, rows, columns, lines, send and receive buffers
+    size_t complex_size = inner_size + (ranks > 1 ? row_size : 0) + column_size + threads * line_length + 2 * exchange_length;
+    buffers = allocate_aligned(2 * tile_size + 2 * complex_size);
+    ++allocations;
+    psi[0] = buffers;
+    psi[1] = buffers + tile_size;
+    first_touch(psi[0], tile_width, tile_height);
+    first_touch(psi[1], tile_width, tile_height);
+    local = reinterpret_cast<complex<double> *>(buffers + 2 * tile_size);
+    row_data = ranks > 1 ? local + inner_size : local;
+    column_data = row_data + (ranks > 1 ? row_size : inner_size);
+    lines = column_data + column_size;
+    exchange = lines + threads * line_length;
+    memcpy(psi[0], state->p_real, tile_size * sizeof(double));
+    memcpy(psi[1], state->p_imag, tile_size * sizeof(double));
+    set_time_step(delta_t);
+}
+
+FFTKernel::~FFTKernel() {
+    free_aligned(buffers);
+    delete transform_x;
+    delete transform_y;
+    delete halos;
+}
+
+/**
+ * The kinetic factors exp(-i k^2 / (2 m) t) in real time, or exp(-k^2 / (2 m) t)
+ * in imaginary time, are products of those along x and y, with the wave
+ * numbers 2 pi j / L of the periodic lattice, j from -n / 2 to n / 2.
+ */
+void FFTKernel::set_time_step(double delta_t) {
+    coupling = hamiltonian->coupling_a * delta_t;
+    LeeHuangYang_coupling = hamiltonian->LeeHuangYang_coupling_a * delta_t;
+    int dims[2] = {dim_x, dim_y};
+    double spacings[2] = {grid->delta_x, grid->delta_y};
+    vector<complex<double> > *tables[2] = {kinetic_x, kinetic_y};
+    for (int axis = 0; axis < 2; axis++) {
+        int n = dims[axis];
+        for (int which = 0; which < 2; which++) {
+            double t = which == 0 ? 0.5 * delta_t : delta_t;
+            // The inverse transforms are unnormalized
+            double scale = axis == 0 ? 1. / ((double)dim_x * dim_y) : 1.;
+            tables[axis][which].resize(n);
+            for (int j = 0; j < n; j++) {
+                double k = n == 1 ? 0. : 2. * M_PI * (2 * j <= n ? j : j - n) / (n * spacings[axis]);
+                double exponent = k * k / (2. * hamiltonian->mass) * t;
+                tables[axis][which][j] = scale * (imag_time ? complex<double>(exp(-exponent), 0.) : polar(1., -exponent));
+            }
+        }
+    }
+}
+
+void FFTKernel::set_steps_per_call(int steps) {
+    steps_per_call = steps;
+}
+
+void FFTKernel::update_potential(double *_external_pot_real, double *_external_pot_imag, int which) {
+    external_pot_real = _external_pot_real;
+    external_pot_imag = _external_pot_imag;
+}
+
+/**
+ * Each process sends to every other one the dots of its source rectangle
+ * within their destination rectangle, row by row, and copies its own ones
+ * directly.
+ */
+void FFTKernel::redistribute(const complex<double> *src, const int *src_rects, bool src_by_columns,
+                             complex<double> *dst, const int *dst_rects, bool dst_by_columns) {
+    const int *own_src = src_rects + 4 * rank, *own_dst = dst_rects + 4 * rank;
+    size_t src_width = own_src[1] - own_src[0], src_height = own_src[3] - own_src[2];
+    size_t dst_width = own_dst[1] - own_dst[0], dst_height = own_dst[3] - own_dst[2];
+    size_t src_sx = src_by_columns ? src_height : 1, src_sy = src_by_columns ? 1 : src_width;
+    size_t dst_sx = dst_by_columns ? dst_height : 1, dst_sy = dst_by_columns ? 1 : dst_width;
+#ifdef HAVE_MPI
+    vector<int> send_counts(ranks, 0), send_offsets(ranks, 0), receive_counts(ranks, 0), receive_offsets(ranks, 0);
+    complex<double> *send = exchange, *receive = exchange + exchange_length;
+    int send_offset = 0, receive_offset = 0;
+#endif
+    for (int r = 0; r < ranks; r++) {
+        // Own source within the destination of r, and source of r within the own destination
+        const int *to = dst_rects + 4 * r;
+        int out_x0 = max(own_src[0], to[0]), out_x1 = min(own_src[1], to[1]);
+        int out_y0 = max(own_src[2], to[2]), out_y1 = min(own_src[3], to[3]);
+        if (r == rank) {
+            if (out_x1 > out_x0 && out_y1 > out_y0) {
+                copy_rectangle(src + (out_x0 - own_src[0]) * src_sx + (out_y0 - own_src[2]) * src_sy, src_sx, src_sy,
+                               dst + (out_x0 - own_dst[0]) * dst_sx + (out_y0 - own_dst[2]) * dst_sy, dst_sx, dst_sy,
+                               out_x1 - out_x0, out_y1 - out_y0);
+            }
+            continue;
+        }
+#ifdef HAVE_MPI
+        if (out_x1 > out_x0 && out_y1 > out_y0) {
+            int width = out_x1 - out_x0, height = out_y1 - out_y0;
+            copy_rectangle(src + (out_x0 - own_src[0]) * src_sx + (out_y0 - own_src[2]) * src_sy, src_sx, src_sy,
+                           send + send_offset, 1, width, width, height);
+            send_offsets[r] = 2 * send_offset;
+            send_counts[r] = 2 * width * height;
+            send_offset += width * height;
+        }
+        const int *from = src_rects + 4 * r;
+        int in_x0 = max(from[0], own_dst[0]), in_x1 = min(from[1], own_dst[1]);
+        int in_y0 = max(from[2], own_dst[2]), in_y1 = min(from[3], own_dst[3]);
+        if (in_x1 > in_x0 && in_y1 > in_y0) {
+            receive_offsets[r] = 2 * receive_offset;
+            receive_counts[r] = 2 * (in_x1 - in_x0) * (in_y1 - in_y0);
+            receive_offset += (in_x1 - in_x0) * (in_y1 - in_y0);
+        }
+#endif
+    }
+#ifdef HAVE_MPI
+    MPI_Alltoallv(reinterpret_cast<double *>(send), &send_counts[0], &send_offsets[0], MPI_DOUBLE,
+                  reinterpret_cast<double *>(receive), &receive_counts[0], &receive_offsets[0], MPI_DOUBLE, grid->cartcomm);
+    for (int r = 0; r < ranks; r++) {
+        if (r == rank || receive_counts[r] == 0) {
+            continue;
+        }
+        const int *from = src_rects + 4 * r;
+        int in_x0 = max(from[0], own_dst[0]), in_x1 = min(from[1], own_dst[1]);
+        int in_y0 = max(from[2], own_dst[2]), in_y1 = min(from[3], own_dst[3]);
+        int width = in_x1 - in_x0;
+        copy_rectangle(receive + receive_offsets[r] / 2, 1, width,
+                       dst + (in_x0 - own_dst[0]) * dst_sx + (in_y0 - own_dst[2]) * dst_sy, dst_sx, dst_sy,
+                       width, in_y1 - in_y0);
+    }
+#endif
+}
+
+/**
+ * The rows are transformed along x, then the columns along y, multiplied by
+ * the kinetic factors and transformed back, then the rows; 1D chains multiply
+ * the rows directly. Each transform reads a line of the process and writes a
+ * line of the thread, or the way back.
+ */
+void FFTKernel::apply_kinetic(int which) {
+    int tile_width = grid->end_x - grid->start_x;
+    const int *tile = &tiles[4 * rank];
+    int inner_width = tile[1] - tile[0], inner_height = tile[3] - tile[2];
+    int offset = (grid->inner_start_y - grid->start_y) * tile_width + grid->inner_start_x - grid->start_x;
+    #pragma omp parallel for
+    for (int i = 0; i < inner_height; i++) {
+        for (int j = 0; j < inner_width; j++) {
+            size_t index = offset + i * tile_width + j;
+            local[i * inner_width + j] = complex<double>(psi[0][index], psi[1][index]);
+        }
+    }
+    if (ranks > 1) {
+        redistribute(local, &tiles[0], false, row_data, &rows[0], false);
+    }
+
+    int row_count = rows[4 * rank + 3] - rows[4 * rank + 2];
+    const complex<double> *factors_x = &kinetic_x[which][0];
+    bool chain = dim_y == 1;
+    #pragma omp parallel for
+    for (int r = 0; r < row_count; r++) {
+        complex<double> *row = row_data + r * dim_x;
+        complex<double> *line = lines + thread_index() * line_length;
+        transform_x->transform(row, line);
+        if (chain) {
+            for (int j = 0; j < dim_x; j++) {
+                line[j] *= factors_x[j];
+            }
+            transform_x->transform(line, row, true);
+        }
+        else {
+            memcpy(row, line, dim_x * sizeof(complex<double>));
+        }
+    }
+
+    if (!chain) {
+        redistribute(row_data, &rows[0], false, column_data, &columns[0], true);
+        int first_column = columns[4 * rank], column_count = columns[4 * rank + 1] - first_column;
+        const complex<double> *factors_y = &kinetic_y[which][0];
+        #pragma omp parallel for
+        for (int c = 0; c < column_count; c++) {
+            complex<double> *column = column_data + c * dim_y;
+            complex<double> *line = lines + thread_index() * line_length;
+            complex<double> factor = factors_x[first_column + c];
+            transform_y->transform(column, line);
+            for (int i = 0; i < dim_y; i++) {
+                line[i] *= factor * factors_y[i];
+            }
+            transform_y->transform(line, column, true);
+        }
+        redistribute(column_data, &columns[0], true, row_data, &rows[0], false);
+        #pragma omp parallel for
+        for (int r = 0; r < row_count; r++) {
+            complex<double> *row = row_data + r * dim_x;
+            complex<double> *line = lines + thread_index() * line_length;
+            transform_x->transform(row, line, true);
+            memcpy(row, line, dim_x * sizeof(complex<double>));
+        }
+    }
+
+    if (ranks > 1) {
+        redistribute(row_data, &rows[0], false, local, &tiles[0], false);
+    }
+    #pragma omp parallel for
+    for (int i = 0; i < inner_height; i++) {
+        for (int j = 0; j < inner_width; j++) {
+            size_t index = offset + i * tile_width + j;
+            psi[0][index] = local[i * inner_width + j].real();
+            psi[1][index] = local[i * inner_width + j].imag();
+        }
+    }
+}
+
+void FFTKernel::apply_potential() {
+    int tile_width = grid->end_x - grid->start_x;
+    int width = grid->inner_end_x - grid->inner_start_x;
+    int offset = (grid->inner_start_y - grid->start_y) * tile_width + grid->inner_start_x - grid->start_x;
+    #pragma omp parallel for
+    for (int i = 0; i < grid->inner_end_y - grid->inner_start_y; ++i) {
+        size_t index = offset + i * tile_width;
+        if (imag_time) {
+            block_kernel_potential_imaginary(false, tile_width, width, 1, coupling, 0., LeeHuangYang_coupling, tile_width,
+                                             external_pot_real + index, external_pot_imag + index, NULL, NULL, psi[0] + index, psi[1] + index);
+        }
+        else {
+            block_kernel_potential(sincos_accuracy, false, tile_width, width, 1, coupling, 0., LeeHuangYang_coupling, tile_width,
+                                   external_pot_real + index, external_pot_imag + index, NULL, NULL, psi[0] + index, psi[1] + index);
+        }
+    }
+}
+
+void FFTKernel::run_kernel_on_halo() {}
+
+/**
+ * The kinetic halves of consecutive steps of a call merge into a whole step.
+ */
+void FFTKernel::run_kernel() {
+    apply_kinetic(0);
+    for (int step_index = 0; step_index < steps_per_call; step_index++) {
+        apply_potential();
+        apply_kinetic(step_index == steps_per_call - 1 ? 0 : 1);
+    }
+    halos->exchange_halos(psi[0], psi[1]);
+}
+
+double FFTKernel::calculate_squared_norm(bool global) const {
+    return halos->squared_norm(psi[0], psi[1], global);
+}
+
+void FFTKernel::wait_for_completion() {
+    if (imag_time && norm != 0) {
+        halos->normalize(psi[0], psi[1], norm);
+    }
+}
+
+void FFTKernel::get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2, double * dest_imag2) const {
+    halos->get_sample(psi[0], psi[1], dest_stride, x, y, width, height, dest_real, dest_imag);
+}
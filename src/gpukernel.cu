@@ -544,6 +544,16 @@ void CC2Kernel::cpy_first_positive_to_first_negative() {
 
 }
 
+void CC2Kernel::set_steps_per_call(int steps) {
+    if (steps != 1) {
+        my_abort("The GPU kernel evolves a single time step per call.");
+    }
+}
+
+void CC2Kernel::set_time_step(double delta_t) {
+    my_abort("The GPU kernel only evolves with the time step it was constructed with.");
+}
+
 void CC2Kernel::get_sample(size_t dest_stride, size_t x, size_t y,
                            size_t width, size_t height,
                            double *dest_real, double *dest_imag,
@@ -20,6 +20,7 @@
 #ifndef __KERNEL_H
 #define __KERNEL_H
 #include <string>
+#include <vector>
 #include "trottersuzuki.h"
 #ifdef _OPENMP
 #include <omp.h>
@@ -37,6 +38,18 @@
 
 #define BLOCK_WIDTH_CACHE 128u
 #define BLOCK_HEIGHT_CACHE 128u
+#define BLOCK_WIDTH_CHAIN 4096u    ///< Width of the cached segments of 1D chains, whose blocks are a single row.
+
+//Accuracy of the sine and cosine of the nonlinear phase in the potential kernel
+#define SINCOS_EXACT  0   ///< Standard library.
+#define SINCOS_DOUBLE 1   ///< In-tree polynomial, accurate to a few ulp in double precision.
+#define SINCOS_SINGLE 2   ///< In-tree polynomial of lower degree, accurate to single precision.
+
+//Number of time steps the autotuner times each candidate geometry of the cached blocks for
+#define AUTOTUNE_STEPS 2
+
+//Chunk of the bands (see block_geometry) making every band and column block of the inner part of the tile a task
+#define TASK_SCHEDULE -1
 
 /** Functions defining Euclidean geometry
  */
@@ -44,14 +57,35 @@ void block_kernel_vertical(size_t start_offset, size_t stride, size_t width, siz
 void block_kernel_vertical_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
 void block_kernel_horizontal(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
 void block_kernel_horizontal_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
-void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height, double offset_x, double _kin_radial, double * p_real, double * p_imag);
-void block_kernel_radial_kinetic_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double offset_x, double _kin_radial, double * p_real, double * p_imag);
-void block_kernel_potential(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width, const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag);
+void block_kernel_vertical_next(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_vertical_next_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_horizontal_next(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_horizontal_next_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, double a, double b, double * p_real, double * p_imag);
+void block_kernel_radial_kinetic(size_t start_offset, size_t stride, size_t width, size_t height, const double *radial_a, const double *radial_b, double * p_real, double * p_imag);
+void block_kernel_radial_kinetic_imaginary(size_t start_offset, size_t stride, size_t width, size_t height, const double *radial_a, const double *radial_b, double * p_real, double * p_imag);
+void block_kernel_potential(int sincos_accuracy, bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width, const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag);
 void block_kernel_potential_imaginary(bool two_wavefunctions, size_t stride, size_t width, size_t height, double coupling_a, double coupling_b, double coupling_aa, size_t tile_width, const double *external_pot_real, const double *external_pot_imag, const double *pb_real, const double *pb_imag, double * p_real, double * p_imag);
-void block_kernel_rotation(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag);
-void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, int offset_x, int offset_y, double alpha_x, double alpha_y, double * p_real, double * p_imag);
-void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag);
-void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, double *p_real, double *p_imag, double *pb_real, double *pb_imag);
+void block_kernel_rotation(size_t stride, size_t width, size_t height, const double *rot_ax, const double *rot_bx, const double *rot_ay, const double *rot_by, double * p_real, double * p_imag);
+void block_kernel_rotation_imaginary(size_t stride, size_t width, size_t height, const double *rot_ax, const double *rot_bx, const double *rot_ay, const double *rot_by, double * p_real, double * p_imag);
+template <typename T>
+void rabi_coupling_real(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, T *p_real, T *p_imag, T *pb_real, T *pb_imag);
+template <typename T>
+void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double cc, double cs_r, double cs_i, T *p_real, T *p_imag, T *pb_real, T *pb_imag);
+
+/// Kernel evolving a cached block by a full time step (see full_step in cpukernel.cpp).
+typedef void (*full_step_function)(size_t stride, size_t width, size_t height,
+                                   const double *rot_ax, const double *rot_bx, const double *rot_ay, const double *rot_by,
+                                   double aH, double bH, double aV, double bV, double aH2, double bH2, double aV2, double bV2, size_t origin_x, size_t origin_y,
+                                   const double *radial, double coupling_a, double coupling_b, double coupling_aa,
+                                   size_t tile_width, const double *external_pot_real, const double *external_pot_imag,
+                                   const double *pb_real, const double *pb_imag, double * real, double * imag);
+/// Geometry of the cached blocks and scheduling of the bands among the threads.
+struct block_geometry {
+    size_t width;     ///< Width of the cached blocks (number of lattice's dots).
+    size_t height;    ///< Height of the cached blocks (number of lattice's dots).
+    int chunk;        ///< Number of bands a thread takes at a time from the dynamic schedule, 0 for the static partition of the bands, TASK_SCHEDULE for a task per block.
+};
+
 /**
  * \brief This class defines the CPU kernel.
  *
@@ -62,19 +96,23 @@ void rabi_coupling_imaginary(size_t stride, size_t width, size_t height, double
  *  - intra species interaction
  *  - extra species interaction
  *  - Rabi coupling
+ *
+ * The template parameter is the type of the wave function stored by the kernel: double, or float
+ * to halve the memory traffic (kernel type cpu-float). The cached blocks are evolved, and the norms
+ * reduced, in double precision whatever the type.
  */
-
+template <typename T>
 class CPUBlock: public ITrotterKernel {
 public:
-    CPUBlock(Lattice *grid, State *state, Hamiltonian *hamiltonian,
+    CPUBlock(Lattice *grid, State *state, Hamiltonian *_hamiltonian,
              double *_external_pot_real, double *_external_pot_imag,
-             double delta_t, double _norm, bool _imag_time);    ///< Instantiate the kernel for single wave functions state evolution.
+             double delta_t, double _norm, bool _imag_time, int _sincos_accuracy = SINCOS_DOUBLE, bool _in_place = false);    ///< Instantiate the kernel for single wave functions state evolution; in place, it evolves the buffers of the state without a second buffer.
 
 
     CPUBlock(Lattice *grid, State *state1, State *state2,
-             Hamiltonian2Component *hamiltonian,
+             Hamiltonian2Component *_hamiltonian,
              double **_external_pot_real, double **_external_pot_imag,
-             double delta_t, double *_norm, bool _imag_time);    ///< Instantiate the kernel for two wave functions state evolution.
+             double delta_t, double *_norm, bool _imag_time, int _sincos_accuracy = SINCOS_DOUBLE, bool _in_place = false);    ///< Instantiate the kernel for two wave functions state evolution; in place, it evolves the buffers of the states without a second buffer.
 
     ~CPUBlock();
     void run_kernel_on_halo();          ///< Evolve blocks of wave function at the edge of the tile. This comprises the halos.
@@ -86,8 +124,23 @@ public:
     double calculate_squared_norm(bool global = true) const;  ///< Calculate squared norm of the state.
     void update_potential(double *_external_pot_real, double *_external_pot_imag, int which);    ///< Update memory pointed by external_potential_real and external_potential_imag (only non static external potential).
     void cpy_first_positive_to_first_negative();    ///< Copy first points with positive radial coordinates to first points with negative coordinates.
+    void set_steps_per_call(int steps);    ///< Set how many time steps each cached block evolves in the next calls to run_kernel_on_halo() and run_kernel() (at most the lattice's steps_per_block).
+    void set_time_step(double delta_t);    ///< Set the time step of the next calls to run_kernel_on_halo() and run_kernel(), retabulating the coefficients that depend on it.
+    void set_state(State *state, double _norm);    ///< Evolve the buffers of another state of the same lattice in the next calls, normalized to _norm in imaginary time (in place, double precision, single wave function only).
+    void set_block_geometry(block_geometry geometry);    ///< Set the size of the cached blocks and the schedule of the bands.
+    block_geometry get_block_geometry() const;    ///< Get the size of the cached blocks and the schedule of the bands.
+    void start_autotuning(string cache_file = "");    ///< Time candidate geometries of the cached blocks in the next time steps and keep the fastest; a nonempty cache_file stores the result for the CPU model and tile shape.
+    /// Tell whether the autotuner is still timing candidate geometries.
+    bool is_autotuning() const {
+        return !tuning_candidates.empty();
+    }
+    /// Get the number of buffers the kernel allocated on the heap since its construction.
+    size_t get_allocation_count() const {
+        return allocations;
+    }
+    /// Tell whether the kernel evolves the buffers of the states in place.
     bool runs_in_place() const {
-        return false;
+        return in_place;
     }
     /// Get kernel name.
     string get_name() const {
@@ -100,15 +153,21 @@ public:
 
 
 private:
-    double *p_real[2][2];       ///< Array of two pointers that point to two buffers used to store the real part of the wave function at i-th time step and (i+1)-th time step.
-    double *p_imag[2][2];       ///< Array of two pointers that point to two buffers used to store the imaginary part of the wave function at i-th time step and (i+1)-th time step.
+    T *p_real[2][2];       ///< Array of two pointers that point to two buffers used to store the real part of the wave function at i-th time step and (i+1)-th time step.
+    T *p_imag[2][2];       ///< Array of two pointers that point to two buffers used to store the imaginary part of the wave function at i-th time step and (i+1)-th time step.
     double *external_pot_real[2];   ///< Points to the matrix representation (real entries) of the operator given by the exponential of external potential.
     double *external_pot_imag[2];   ///< Points to the matrix representation (immaginary entries) of the operator given by the exponential of external potential.
     double *aH;            ///< Diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
     double *bH;            ///< Off diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
     double *aV;            ///< Diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
     double *bV;            ///< Off diagonal value of the matrix representation of the operator given by the exponential of kinetic operator.
+    double *aH2;            ///< Diagonal value of the exponential of the next neighbour kinetic pairs along x (fourth order only).
+    double *bH2;            ///< Off diagonal value of the exponential of the next neighbour kinetic pairs along x (fourth order only).
+    double *aV2;            ///< Diagonal value of the exponential of the next neighbour kinetic pairs along y (fourth order only).
+    double *bV2;            ///< Off diagonal value of the exponential of the next neighbour kinetic pairs along y (fourth order only).
+    int kinetic_order;    ///< Order of the finite differences of the kinetic term, 2 (pairs of neighbours) or 4 (and pairs of next neighbours).
     double *kin_radial;   ///< Kinetic costant for the radial coordinate.
+    double *radial_table[2];    ///< Coefficients of the radial kinetic term for each column of the tile: diagonal and off diagonal terms of the pairs starting at even columns, then of those starting at odd columns.
     double delta_x;         ///< Physical length between two neighbour along x axis dots of the lattice.
     double delta_y;         ///< Physical length between two neighbour along y axis dots of the lattice.
     double *norm;         ///< Squared norm of the single wave functions.
@@ -122,8 +181,13 @@ private:
     size_t tile_width;        ///< Width of the tile (number of lattice's dots).
     size_t tile_height;       ///< Height of the tile (number of lattice's dots).
     bool imag_time;         ///< True: imaginary time evolution; False: real time evolution.
-    static const size_t block_width = BLOCK_WIDTH_CACHE;      ///< Width of the lattice block which is cached (number of lattice's dots).
+    int sincos_accuracy;    ///< Accuracy of the sine and cosine of the nonlinear phase (SINCOS_EXACT, SINCOS_DOUBLE or SINCOS_SINGLE).
+    bool in_place;    ///< True: the second buffer of each wave function is the first one, and the blocks read their halos from the seams; False: the blocks are written to the second buffer.
+    size_t block_width;      ///< Width of the lattice block which is cached (number of lattice's dots).
     size_t block_height;     ///< Height of the lattice block which is cached (number of lattice's dots).
+    int band_chunk;    ///< Number of bands a thread takes at a time from the dynamic schedule, 0 (default) for the static partition of the bands, TASK_SCHEDULE for a task per block. Tiles with fewer inner bands than threads always use tasks.
+    int steps_per_block;    ///< Maximum number of time steps a cached block can evolve, given the width of the halos.
+    int steps_per_call;    ///< Number of time steps a cached block evolves before being written back.
     bool two_wavefunctions;    ///< Flag parameter to distinguish whether the kernel is evolving a two-wave-function or a single-wave-function
     int angular_momentum[2];   ///< Angular momentum when cylindrical coordinates are used.
 
@@ -131,6 +195,11 @@ private:
     double alpha_y;         ///< Real coupling constant associated to the Y*P_x operator, part of the angular momentum.
     double rot_coord_x;        ///< X axis coordinate of the center of rotation.
     double rot_coord_y;        ///< Y axis coordinate of the center of rotation.
+    double *rotation_table;    ///< Buffer of the four tables of rotation coefficients below.
+    double *rot_ax;    ///< Diagonal coefficient of the rotation along x, for each column of the tile.
+    double *rot_bx;    ///< Off diagonal coefficient of the rotation along x, for each column of the tile.
+    double *rot_ay;    ///< Diagonal coefficient of the rotation along y, for each row of the tile.
+    double *rot_by;    ///< Off diagonal coefficient of the rotation along y, for each row of the tile.
     int start_x;          ///< X axis coordinate of the first dot of the processed tile.
     int start_y;          ///< Y axis coordinate of the first dot of the processed tile.
     int end_x;            ///< X axis coordinate of the last dot of the processed tile.
@@ -141,7 +210,42 @@ private:
     int inner_end_y;        ///< Y axis coordinate of the last dot of the processed tile, which is not in the halo.
     int *periods;         ///< Two dimensional array which takes entries 0 or 1. 1: periodic boundary condition along the corresponding axis; 0: closed boundary condition along the corresponding axis.
     string coordinate_system;  ///< Type of the coordinate system used.
+    full_step_function full_step_kernel;    ///< Full step kernel specialized, when the kernel is constructed, for the kind of evolution.
+    double *scratch;    ///< Arena of cached blocks, a real and an imaginary block for each thread, reused by every call of the kernel.
+    size_t scratch_block_size;    ///< Number of doubles between two consecutive blocks of the arena (a multiple of the cache line).
+    size_t scratch_capacity;    ///< Number of doubles allocated for the arena.
+    T *seams;    ///< Strips of the wave function around the boundaries between the blocks, as they were at the beginning of the step (in place only).
+    size_t seam_capacity;    ///< Number of values allocated for the seams.
+    double *other_modulus[2];    ///< Modulus of the other wave function before the step, over sqrt(2), which each wave function reads as both parts of the other component (two wave functions, in place or stored in single precision only).
+    size_t allocations;    ///< Number of buffers allocated on the heap since the construction of the kernel.
+    Hamiltonian *hamiltonian;    ///< Hamiltonian of the system, whose parameters and the time step give the coefficients of the evolution.
+    double *allocate(size_t count);    ///< Allocate an aligned buffer and keep count of it.
+    T *allocate_wave_function(size_t count);    ///< Allocate an aligned buffer for count values of the wave function and keep count of it.
+    T *attach_state(double *buffer);    ///< Return the buffer of a state as the wave function of the kernel, or a copy of it in single precision.
+    void reserve_scratch();    ///< Make room in the arena for all the threads of the next parallel region.
+    void reserve_seams();    ///< Make room for the seams of the current geometry of the blocks (in place only).
+    void save_seams();    ///< Save the seams of the wave function being evolved, before any block is written back.
+    void save_moduli();    ///< Save the modulus of each wave function for the evolution of the other one, before the first one is evolved.
+    void load_seams(size_t band, size_t column, size_t bands, size_t columns, size_t read_x, size_t read_y, size_t read_width, size_t read_height,
+                    double *block_real, double *block_imag) const;    ///< Overwrite the halos of a loaded block with the saved seams.
+    void run_block(size_t band, size_t column, size_t bands, size_t columns);    ///< Evolve a column block of a band, in the arena of the calling thread.
+    bool is_halo_block(size_t band, size_t column, size_t bands, size_t columns) const;    ///< Tell whether a block writes to the edge of the tile, which the halo exchange sends.
+    void run_block_tasks(bool halo);    ///< Evolve the blocks at the edge of the tile, or the inner ones, as a task each.
+    void init_rotation_tables();    ///< Tabulate the coefficients of the rotation for the rows and columns of the tile, allocating the tables the first time.
+    void init_radial_tables(int component);    ///< Tabulate the coefficients of the radial kinetic term for the columns of the tile, allocating the tables the first time.
+    vector<block_geometry> tuning_candidates;    ///< Geometries the autotuner has yet to time, the current one first; empty when not autotuning.
+    block_geometry tuning_best;    ///< Fastest geometry timed so far by the autotuner.
+    double tuning_best_time;    ///< Time per step of the fastest geometry.
+    double tuning_time;    ///< Time per step of the current candidate, the minimum over the steps timed so far.
+    double tuning_elapsed;    ///< Time spent in the kernel calls of the current step, per time step.
+    int tuning_step;    ///< Number of steps the current candidate has been timed for.
+    bool tuning_chunks;    ///< True once the autotuner has moved on to the chunks of the schedule.
+    string tuning_cache_file;    ///< File storing the results of the autotuner.
+    string tuning_key;    ///< Key of the results of the autotuner: CPU model, tile shape, halos, threads and number of components.
+    void next_tuning_step();    ///< Account for the time step just timed and move to the next candidate when due.
+    void finish_autotuning();    ///< Apply the fastest geometry and store it.
 #ifdef HAVE_MPI
+    double *reduction_buffer;    ///< Receive buffer of the global reductions, two entries for each process.
     MPI_Comm cartcomm;        ///< Ensemble of processes communicating the halos and evolving the tiles.
     int neighbors[4];       ///< Array that stores the processes' rank neighbour of the current process.
     MPI_Request req[8];       ///< Variable to manage MPI communication.
@@ -151,6 +255,377 @@ private:
 #endif
 };
 
+/**
+ * \brief This class applies the Hamiltonian to wave functions stored as the tiles of the states.
+ *
+ * The Hamiltonian is discretized as in the energy of the Solver: the kinetic term with the
+ * fourth order five point stencil, the rotation term with the centered fourth order stencil
+ * of the first derivatives, which keeps it Hermitian, and the wave function vanishing beyond
+ * closed boundaries. Only the linear terms are applied; the nonlinear ones depend on the
+ * densities, which the caller knows. Cartesian coordinates only.
+ */
+class StencilHamiltonian {
+public:
+    StencilHamiltonian(Lattice *grid, Hamiltonian *hamiltonian, bool two_components);    ///< Tabulate the potentials and the coordinates of the tile.
+    ~StencilHamiltonian();
+    void exchange_halos(double *p_real, double *p_imag);    ///< Fill the halos of a wave function from the neighbour tiles, or from the periodic images.
+    double apply(int component, const double *p_real, const double *p_imag, double *h_real, double *h_imag, bool kinetic_only = false) const;    ///< Write the Hamiltonian of a component, or its kinetic term only, applied to the inner dots; the halos must be up to date. Return the kinetic energy of the tile.
+    double squared_norm(const double *p_real, const double *p_imag, bool global = true) const;    ///< Get the squared norm of a wave function over the inner dots of the tile, or of the whole lattice.
+    void normalize(double *p_real, double *p_imag, double norm) const;    ///< Rescale a wave function, halos included, to the squared norm norm over the whole lattice.
+    void get_sample(const double *p_real, const double *p_imag, size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double *dest_real, double *dest_imag) const;    ///< Copy a rectangle of a wave function on the tile to dest_real and dest_imag.
+    double get_kinetic_bound(int component) const;    ///< Get the upper bound of the spectrum of the kinetic term.
+    void get_spectral_bounds(int component, double *lower, double *upper) const;    ///< Get bounds of the spectrum of the Hamiltonian of a component over the whole lattice.
+    /// Get the number of dots of the tile, halos included.
+    size_t get_tile_size() const {
+        return tile_width * tile_height;
+    }
+    Lattice *grid;    ///< Lattice of the wave functions.
+
+private:
+    double *potential[2];    ///< External potential of each component on the tile.
+    double *coordinate_x;    ///< X coordinate of each column of the tile.
+    double *coordinate_y;    ///< Y coordinate of each row of the tile.
+    double *zeros;    ///< Row of zeros, read beyond closed boundaries.
+    double mass[2];    ///< Mass of each component.
+    double angular_velocity;    ///< Angular velocity of the rotating frame.
+    bool two_dimensional;    ///< False for 1D chains, along the x axis.
+    int tile_width;        ///< Width of the tile (number of lattice's dots).
+    int tile_height;       ///< Height of the tile (number of lattice's dots).
+#ifdef HAVE_MPI
+    int neighbors[4];       ///< Array that stores the processes' rank neighbour of the current process.
+    MPI_Datatype horizontalBorder;  ///< Datatype for the horizontal halos.
+    MPI_Datatype verticalBorder;  ///< Datatype for the vertical halos.
+#endif
+};
+
+/**
+ * \brief This class defines the Chebyshev kernel.
+ *
+ * It evolves a single wave function under a linear Hamiltonian with a static potential by the
+ * Chebyshev expansion of the evolution operator, exp(-i H dt) in real time and exp(-H dt) in
+ * imaginary time, accurate to the rounding for any time step. The Hamiltonian is that of the
+ * energy of the Solver (see StencilHamiltonian); the number of terms grows with the time step
+ * times the width of its spectrum, bounded from the potential, the lattice spacing and the
+ * rotation.
+ */
+class ChebyshevKernel: public ITrotterKernel {
+public:
+    ChebyshevKernel(Lattice *grid, State *state, Hamiltonian *hamiltonian, double delta_t, double _norm, bool _imag_time);    ///< Instantiate the kernel for single wave function state evolution.
+    ~ChebyshevKernel();
+    void run_kernel_on_halo();    ///< Nothing to do: run_kernel() evolves the whole tile.
+    void run_kernel();    ///< Evolve the wave function by steps_per_call time steps, exchanging the halos before each application of the Hamiltonian.
+    void wait_for_completion();    ///< Perform normalization for imaginary time evolution.
+    void get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2 = 0, double * dest_imag2 = 0) const; ///< Copy the wave function to dest_real and dest_imag.
+    void normalization() {};    ///< Nothing to do: single wave function only.
+    void rabi_coupling(double var, double delta_t) {};    ///< Nothing to do: single wave function only.
+    double calculate_squared_norm(bool global = true) const;    ///< Calculate squared norm of the state.
+    /// Tell whether the kernel evolves the states in place.
+    bool runs_in_place() const {
+        return false;
+    }
+    /// Get kernel name.
+    string get_name() const {
+        return "chebyshev";
+    }
+    void update_potential(double *_external_pot_real, double *_external_pot_imag, int which) {};    ///< Nothing to do: the potential is static, and the kernel does not use its exponential.
+    void cpy_first_positive_to_first_negative() {};    ///< Nothing to do: cartesian coordinates only.
+    void set_steps_per_call(int steps);    ///< Set how many time steps the next calls to run_kernel() evolve.
+    void set_time_step(double delta_t);    ///< Set the time step, recomputing the coefficients of the expansion.
+    /// Get the number of buffers the kernel allocated on the heap since its construction.
+    size_t get_allocation_count() const {
+        return allocations;
+    }
+    void start_halo_exchange() {};    ///< Nothing to do: run_kernel() exchanges the halos.
+    void finish_halo_exchange() {};    ///< Nothing to do: run_kernel() exchanges the halos.
+
+private:
+    Lattice *grid;    ///< Lattice of the wave function.
+    StencilHamiltonian *stencil;    ///< Hamiltonian applied to the wave function.
+    bool imag_time;    ///< Whether the time of evolution is imaginary(true) or real(false).
+    double norm;    ///< Squared norm of the wave function in imaginary time, 0 not to normalize it.
+    double center;    ///< Center of the bounds of the spectrum.
+    double half_width;    ///< Half the width of the bounds of the spectrum.
+    vector<double> coefficients;    ///< Coefficients of the Chebyshev polynomials of the rescaled Hamiltonian, real and imaginary part of each.
+    int steps_per_call;    ///< Time steps of each call of run_kernel().
+    size_t allocations;    ///< Number of buffers allocated on the heap.
+    double *buffers;    ///< Storage of the fields below.
+    double *psi[2];    ///< Wave function, real and imaginary part.
+    double *previous[2];    ///< Chebyshev vector of the previous order.
+    double *current[2];    ///< Chebyshev vector of the current order.
+    double *h[2];    ///< Hamiltonian applied to the current Chebyshev vector.
+    void step();    ///< Evolve the wave function by a time step.
+};
+
+/**
+ * \brief This class defines the alternating direction implicit kernel.
+ *
+ * It evolves a single wave function in cartesian coordinates by Crank-Nicolson steps of the
+ * kinetic term, along the rows and then along the columns, around the potential and nonlinear
+ * step of the CPU kernel. The Crank-Nicolson steps are unitary in real time and contracting in
+ * imaginary time for any time step. Each direction solves a batch of tridiagonal systems, one
+ * per row or column of the tile, by the Thomas algorithm; the tiles of a row or column of MPI
+ * processes join their solutions through a reduced system of one unknown per seam.
+ */
+class ADIKernel: public ITrotterKernel {
+public:
+    ADIKernel(Lattice *grid, State *state, Hamiltonian *hamiltonian, double *_external_pot_real, double *_external_pot_imag,
+              double delta_t, double _norm, bool _imag_time, int _sincos_accuracy);    ///< Instantiate the kernel for single wave function state evolution.
+    ~ADIKernel();
+    void run_kernel_on_halo();    ///< Nothing to do: run_kernel() evolves the whole tile.
+    void run_kernel();    ///< Evolve the wave function by steps_per_call time steps, exchanging the halos before each kinetic step.
+    void wait_for_completion();    ///< Perform normalization for imaginary time evolution.
+    void get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2 = 0, double * dest_imag2 = 0) const; ///< Copy the wave function to dest_real and dest_imag.
+    void normalization() {};    ///< Nothing to do: single wave function only.
+    void rabi_coupling(double var, double delta_t) {};    ///< Nothing to do: single wave function only.
+    double calculate_squared_norm(bool global = true) const;    ///< Calculate squared norm of the state.
+    /// Tell whether the kernel evolves the states in place.
+    bool runs_in_place() const {
+        return false;
+    }
+    /// Get kernel name.
+    string get_name() const {
+        return "adi";
+    }
+    void update_potential(double *_external_pot_real, double *_external_pot_imag, int which);    ///< Update the evolution operator of the potential.
+    void cpy_first_positive_to_first_negative() {};    ///< Nothing to do: cartesian coordinates only.
+    void set_steps_per_call(int steps);    ///< Set how many time steps the next calls to run_kernel() evolve.
+    void set_time_step(double delta_t);    ///< Set the time step, refactoring the tridiagonal systems.
+    /// Get the number of buffers the kernel allocated on the heap since its construction.
+    size_t get_allocation_count() const {
+        return allocations;
+    }
+    void start_halo_exchange() {};    ///< Nothing to do: run_kernel() exchanges the halos.
+    void finish_halo_exchange() {};    ///< Nothing to do: run_kernel() exchanges the halos.
+
+private:
+    /// Tridiagonal systems of the Crank-Nicolson step along one direction, with the factors that depend on the time step.
+    struct implicit_direction {
+        int length;    ///< Inner dots of the tile along the direction.
+        int block;    ///< Dots solved by the Thomas algorithm: all of them, or all but the last one, which is a seam.
+        int offset;    ///< Offset of the first inner dot of the first system in the tile.
+        int step;    ///< Distance in the tile of consecutive dots of a system.
+        int systems;    ///< Number of systems, rows or columns of the tile.
+        int system_step;    ///< Distance in the tile of the first dots of consecutive systems.
+        bool before;    ///< Whether the tile has a dot before the first inner one.
+        bool after;    ///< Whether the tile has a dot after the last inner one.
+        int ranks;    ///< MPI processes sharing the systems.
+        int rank;    ///< Position of the process among them.
+        int seams;    ///< Unknowns of the reduced system: the last dot of each tile but the last one, or of every tile if periodic.
+        complex<double> diagonal;    ///< Diagonal of the implicit operator.
+        complex<double> off_diagonal;    ///< Off-diagonal of the implicit operator.
+        vector<complex<double> > pivots;    ///< Inverse pivots of the Thomas algorithm.
+        vector<complex<double> > left_response;    ///< Solution of the block for a unit value before its first dot.
+        vector<complex<double> > right_response;    ///< Solution of the block for a unit value after its last dot.
+        vector<complex<double> > reduced;    ///< LU factors of the reduced system.
+        vector<int> permutation;    ///< Row pivoting of the LU factors.
+        vector<double> local;    ///< First and last dot of the block, and right-hand side of the seam, of each system.
+        vector<double> gathered;    ///< Values of local of all the processes.
+#ifdef HAVE_MPI
+        MPI_Comm comm;    ///< Processes sharing the systems.
+#endif
+    };
+    Lattice *grid;    ///< Lattice of the wave function.
+    Hamiltonian *hamiltonian;    ///< Hamiltonian of the system.
+    StencilHamiltonian *halos;    ///< Halo exchange, norm and samples of the wave function on the tile.
+    bool imag_time;    ///< Whether the time of evolution is imaginary(true) or real(false).
+    int sincos_accuracy;    ///< Accuracy of the sine and cosine of the nonlinear phase in real time.
+    double norm;    ///< Squared norm of the wave function in imaginary time, 0 not to normalize it.
+    double coupling;    ///< Coupling constant of the contact interaction times the time step.
+    double LeeHuangYang_coupling;    ///< Coupling constant of the Lee-Huang-Yang term times the time step.
+    double *external_pot_real;    ///< Real part of the evolution operator of the potential.
+    double *external_pot_imag;    ///< Imaginary part of the evolution operator of the potential.
+    int directions;    ///< One for 1D chains, two otherwise.
+    implicit_direction direction[2];    ///< Systems along the rows and along the columns.
+    int steps_per_call;    ///< Time steps of each call of run_kernel().
+    size_t allocations;    ///< Number of buffers allocated on the heap.
+    double *buffers;    ///< Storage of the wave function.
+    double *psi[2];    ///< Wave function, real and imaginary part.
+    void init_direction(implicit_direction &solver, double delta_t, double spacing);    ///< Factor the systems of a direction for a kinetic step of duration delta_t.
+    void solve_direction(implicit_direction &solver);    ///< Evolve the wave function by a kinetic step along a direction.
+    void apply_potential();    ///< Evolve the wave function by the potential and the nonlinear term.
+};
+
+/**
+ * \brief This class computes the discrete Fourier transform of a complex sequence.
+ *
+ * Mixed radix Cooley-Tukey transform, with butterflies of radix 4, 2, 3 and 5, and a generic
+ * one for the other prime factors of the length.
+ */
+class FourierTransform {
+public:
+    FourierTransform(int length);    ///< Factor the length and tabulate the twiddle factors.
+    void transform(const complex<double> *in, complex<double> *out, bool inverse = false) const;    ///< Write the transform of in to out, unnormalized, with exp(-2 pi i jk / n), or exp(2 pi i jk / n) if inverse.
+    /// Get the length of the sequences.
+    int get_length() const {
+        return length;
+    }
+
+private:
+    int length;    ///< Length of the sequences.
+    vector<int> factors;    ///< Radix of each stage.
+    vector<complex<double> > twiddles;    ///< exp(-2 pi i k / length), for k = 0, ..., length - 1.
+    void work(complex<double> *out, const complex<double> *in, size_t stride, int stage, bool inverse) const;    ///< Transform of the subsequence of in with the given stride, from the given stage on.
+};
+
+/**
+ * \brief This class defines the pseudo-spectral kernel.
+ *
+ * It evolves a single wave function on a periodic lattice in cartesian coordinates by the
+ * split-step Fourier method: half a step of the exact kinetic term in momentum space on either
+ * side of the potential and nonlinear step of the CPU kernel. The two-dimensional transforms are
+ * computed along the rows, then along the columns after a blocked transposition; under MPI, the
+ * tiles are redistributed to whole rows and columns with all-to-all exchanges over the
+ * processes of the topology.
+ */
+class FFTKernel: public ITrotterKernel {
+public:
+    FFTKernel(Lattice *grid, State *state, Hamiltonian *hamiltonian, double *_external_pot_real, double *_external_pot_imag,
+              double delta_t, double _norm, bool _imag_time, int _sincos_accuracy);    ///< Instantiate the kernel for single wave function state evolution.
+    ~FFTKernel();
+    void run_kernel_on_halo();    ///< Nothing to do: run_kernel() evolves the whole tile.
+    void run_kernel();    ///< Evolve the wave function by steps_per_call time steps, and update the halos.
+    void wait_for_completion();    ///< Perform normalization for imaginary time evolution.
+    void get_sample(size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double * dest_real, double * dest_imag, double * dest_real2 = 0, double * dest_imag2 = 0) const; ///< Copy the wave function to dest_real and dest_imag.
+    void normalization() {};    ///< Nothing to do: single wave function only.
+    void rabi_coupling(double var, double delta_t) {};    ///< Nothing to do: single wave function only.
+    double calculate_squared_norm(bool global = true) const;    ///< Calculate squared norm of the state.
+    /// Tell whether the kernel evolves the states in place.
+    bool runs_in_place() const {
+        return false;
+    }
+    /// Get kernel name.
+    string get_name() const {
+        return "fft";
+    }
+    void update_potential(double *_external_pot_real, double *_external_pot_imag, int which);    ///< Update the evolution operator of the potential.
+    void cpy_first_positive_to_first_negative() {};    ///< Nothing to do: cartesian coordinates only.
+    void set_steps_per_call(int steps);    ///< Set how many time steps the next calls to run_kernel() evolve.
+    void set_time_step(double delta_t);    ///< Set the time step, retabulating the kinetic factors.
+    /// Get the number of buffers the kernel allocated on the heap since its construction.
+    size_t get_allocation_count() const {
+        return allocations;
+    }
+    void start_halo_exchange() {};    ///< Nothing to do: run_kernel() exchanges the halos.
+    void finish_halo_exchange() {};    ///< Nothing to do: run_kernel() exchanges the halos.
+
+private:
+    Lattice *grid;    ///< Lattice of the wave function.
+    Hamiltonian *hamiltonian;    ///< Hamiltonian of the system.
+    StencilHamiltonian *halos;    ///< Halo exchange, norm and samples of the wave function on the tile.
+    bool imag_time;    ///< Whether the time of evolution is imaginary(true) or real(false).
+    int sincos_accuracy;    ///< Accuracy of the sine and cosine of the nonlinear phase in real time.
+    double norm;    ///< Squared norm of the wave function in imaginary time, 0 not to normalize it.
+    double coupling;    ///< Coupling constant of the contact interaction times the time step.
+    double LeeHuangYang_coupling;    ///< Coupling constant of the Lee-Huang-Yang term times the time step.
+    double *external_pot_real;    ///< Real part of the evolution operator of the potential.
+    double *external_pot_imag;    ///< Imaginary part of the evolution operator of the potential.
+    int dim_x;    ///< Dots of the lattice along x, halos excluded.
+    int dim_y;    ///< Dots of the lattice along y, halos excluded.
+    FourierTransform *transform_x;    ///< Transform along the rows.
+    FourierTransform *transform_y;    ///< Transform along the columns.
+    vector<complex<double> > kinetic_x[2];    ///< Kinetic factors of half and of a whole time step along x, normalization of the transforms included.
+    vector<complex<double> > kinetic_y[2];    ///< Kinetic factors of half and of a whole time step along y.
+    int steps_per_call;    ///< Time steps of each call of run_kernel().
+    int ranks;    ///< Number of MPI processes.
+    int rank;    ///< Rank of the process.
+    vector<int> tiles;    ///< Inner dots of the tile of each process: first and last column, first and last row.
+    vector<int> rows;    ///< Whole rows each process transforms along x.
+    vector<int> columns;    ///< Whole columns each process transforms along y.
+    size_t allocations;    ///< Number of buffers allocated on the heap.
+    double *buffers;    ///< Storage of the wave function.
+    double *psi[2];    ///< Wave function, real and imaginary part.
+    complex<double> *local;    ///< Inner dots of the tile, row by row.
+    complex<double> *row_data;    ///< Rows of the process, the same buffer as local on a single process.
+    complex<double> *column_data;    ///< Columns of the process, column by column.
+    complex<double> *lines;    ///< A line per thread for the transforms.
+    complex<double> *exchange;    ///< Send and receive buffers of the redistributions.
+    size_t line_length;    ///< Length of each line.
+    size_t exchange_length;    ///< Length of each of the send and receive buffers.
+    void apply_kinetic(int which);    ///< Evolve the wave function by the kinetic factors of half (0) or a whole (1) time step.
+    void apply_potential();    ///< Evolve the wave function by the potential and the nonlinear term.
+    void redistribute(const complex<double> *src, const int *src_rects, bool src_by_columns,
+                      complex<double> *dst, const int *dst_rects, bool dst_by_columns);    ///< Move the dots from the rectangles of a layout to those of another one.
+};
+
+/**
+ * \brief This class minimizes the energy of the Gross-Pitaevskii functional at fixed norms.
+ *
+ * It runs the nonlinear conjugate gradient, Polak-Ribiere, on the manifold of the wave functions
+ * with the squared norms of the initial states: the squared norm of each component, or the total
+ * one with a Rabi coupling. The gradient is preconditioned by the inverse of the kinetic term
+ * shifted by the kinetic energy, approximated by a Chebyshev iteration.
+ */
+class EnergyMinimizer {
+public:
+    EnergyMinimizer(Lattice *grid, State *state1, State *state2, Hamiltonian *hamiltonian, int preconditioner_steps);    ///< Prepare the minimization of the energy of one state, or two if state2 is not NULL.
+    ~EnergyMinimizer();
+    int minimize(double tolerance, int max_iterations);    ///< Minimize the energy and write the minimizer to the states; return the iterations, negative if the relative squared residual norm did not fall below the tolerance.
+    /// Get the energy per particle of the last minimization.
+    double get_energy() const {
+        return energy;
+    }
+
+private:
+    StencilHamiltonian *stencil;    ///< Linear terms of the Hamiltonian.
+    State *states[2];    ///< States to minimize.
+    Hamiltonian *hamiltonian;    ///< Hamiltonian of the system.
+    int components;    ///< Number of wave functions.
+    int groups;    ///< Number of norm constraints: one per component, or a single one with a Rabi coupling.
+    int group[2];    ///< Norm constraint of each component.
+    double norm2[2];    ///< Squared norm of each constraint, in lattice sums.
+    double lambda[2];    ///< Chemical potential of each constraint.
+    double alpha[2];    ///< Shift of the kinetic preconditioner of each component.
+    double energy;    ///< Energy per particle of the current wave functions.
+    int preconditioner_steps;    ///< Iterations of the Chebyshev preconditioner; 0 for none.
+    size_t tile_size;    ///< Number of dots of the tile.
+    double *buffers;    ///< Storage of the fields below.
+    double *psi[2];    ///< Wave functions, real then imaginary part.
+    double *gradient[2];    ///< Hamiltonian applied to the wave functions.
+    double *residual[2];    ///< Gradient projected on the tangent space of the constraints.
+    double *previous_residual[2];    ///< Residual of the previous iteration.
+    double *preconditioned[2];    ///< Preconditioned residual.
+    double *direction[2];    ///< Search direction.
+    double *trial[2];    ///< Wave functions along the search direction.
+    double *trial_gradient[2];    ///< Hamiltonian applied to the trial wave functions.
+    double *work[2][3];    ///< Scratch fields of the preconditioner and of the curvature.
+    double evaluate(double **values, double **h, double *sums);    ///< Apply the Hamiltonian to the wave functions values and return their energy (lattice sum); sums receives the energy, then, for each component, the expectation of the Hamiltonian, of the kinetic term, and the squared norm.
+    double apply_hamiltonian(double **density, double **values, double **h, double *kinetic);    ///< Apply the Hamiltonian, with the densities of the wave functions density, to values; kinetic receives the kinetic energies of the tile. Return the interaction energy of the tile that the expectation of the Hamiltonian counts twice.
+    void update_multipliers(const double *sums);    ///< Set the chemical potentials and the shifts of the preconditioner from the sums of evaluate().
+    void precondition(int component, const double *r, double *z);    ///< Approximate the inverse of the shifted kinetic term applied to r.
+    double local_dot(const double *a, const double *b) const;    ///< Real part of the scalar product over the inner dots of the tile.
+    void reduce(double *sums, int count) const;    ///< Sum over the tiles.
+};
+
+/**
+ * \brief Block of states evolved together in imaginary time towards the lowest eigenstates of a linear Hamiltonian without rotation.
+ *
+ * A single in place kernel evolves the states one after the other, keeping its exponentials and
+ * cached blocks. The block is orthonormalized by Gram-Schmidt in its order, and rotated to the
+ * eigenstates of the Hamiltonian within the block, the Rayleigh-Ritz step, which also resolves
+ * (nearly) degenerate levels.
+ */
+class EigenstateBlock {
+public:
+    EigenstateBlock(Lattice *grid, vector<State*> &states, Hamiltonian *hamiltonian,
+                    double *external_pot_real, double *external_pot_imag, double delta_t);    ///< Prepare the block and orthonormalize it; the exponentials of the potential are those of imaginary time.
+    ~EigenstateBlock();
+    void evolve(int iterations);    ///< Evolve each state of the block in imaginary time, normalized to one.
+    void orthonormalize();    ///< Orthonormalize the states in their order, with the overlaps of all the pairs from a single reduction.
+    void rotate_to_eigenstates(double *energies);    ///< Rotate the orthonormal states to the eigenstates of the Hamiltonian within the block, sorted by energy; energies receives their energies.
+
+private:
+    Lattice *grid;    ///< Lattice of the states.
+    vector<State*> states;    ///< States of the block.
+    int count;    ///< Number of states.
+    CPUBlock<double> *kernel;    ///< In place kernel evolving the states.
+    StencilHamiltonian *stencil;    ///< Hamiltonian applied to the states.
+    int steps_per_call;    ///< Time steps of each call of the kernel (temporal blocking).
+    double *h_real;    ///< Real part of the Hamiltonian applied to a state.
+    double *h_imag;    ///< Imaginary part of the Hamiltonian applied to a state.
+    void add_overlaps(int first, int last, const double *const *fields_real, const double *const *fields_imag, double *sums) const;    ///< Add to sums the scalar products over the inner dots of the tile of the states a <= b with the fields b = first, ..., last, in a single pass.
+    void combine(const complex<double> *coefficients, bool triangular);    ///< Replace each state b with sum_a states[a] coefficients[a * count + b]; triangular: solve states[b] = sum_{a <= b} q_a coefficients[a * count + b] for the q_a instead.
+};
+
 #ifdef CUDA
 
 //#define DISABLE_FMA
@@ -191,6 +666,12 @@ public:
     double calculate_squared_norm(bool global = true) const;  ///< Calculate squared norm of the state.
     void update_potential(double *_external_pot_real, double *_external_pot_imag, int which);    ///< Update memory pointed by external_potential_real and external_potential_imag (only non static external potential).
     void cpy_first_positive_to_first_negative();    ///< Copy first points with positive radial coordinates to first points with negative coordinates.
+    void set_steps_per_call(int steps);    ///< Only a single time step per call is supported.
+    void set_time_step(double delta_t);    ///< Only the time step of the construction is supported.
+    /// The host buffers of the GPU kernel are not tracked.
+    size_t get_allocation_count() const {
+        return 0;
+    }
     bool runs_in_place() const {
         return false;
     }
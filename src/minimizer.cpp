@@ -0,0 +1,355 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+#include "kernel.h"
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// Fields of each component: wave function, gradient, residual, previous
+// residual, preconditioned residual, direction, trial wave function and its
+// gradient, and three scratch fields; each holds a real and an imaginary tile
+#define MINIMIZER_FIELDS 11
+// Reductions of the step along the search direction before giving it up
+#define LINE_SEARCH_STEPS 30
+// Relative change of the energy within the rounding of its sum over the lattice
+#define ENERGY_ROUNDING 1.e-13
+
+EnergyMinimizer::EnergyMinimizer(Lattice *grid, State *state1, State *state2, Hamiltonian *_hamiltonian,
+                                 int _preconditioner_steps):
+    hamiltonian(_hamiltonian), preconditioner_steps(_preconditioner_steps) {
+    states[0] = state1;
+    states[1] = state2;
+    components = state2 == NULL ? 1 : 2;
+    stencil = new StencilHamiltonian(grid, hamiltonian, components == 2);
+    tile_size = stencil->get_tile_size();
+    bool rabi = components == 2 && (static_cast<Hamiltonian2Component *>(hamiltonian)->omega_r != 0. ||
+                                     static_cast<Hamiltonian2Component *>(hamiltonian)->omega_i != 0.);
+    groups = components == 2 && !rabi ? 2 : 1;
+    group[0] = 0;
+    group[1] = groups - 1;
+    energy = 0.;
+
+    int tile_width = grid->end_x - grid->start_x;
+    buffers = allocate_aligned(MINIMIZER_FIELDS * 2 * components * tile_size);
+    for (int f = 0; f < MINIMIZER_FIELDS * 2 * components; f++) {
+        first_touch(buffers + f * tile_size, tile_width, tile_size / tile_width);
+    }
+    double *field = buffers;
+    double **fields[8] = {psi, gradient, residual, previous_residual, preconditioned, direction, trial, trial_gradient};
+    for (int k = 0; k < components; k++) {
+        for (int f = 0; f < 8; f++, field += 2 * tile_size) {
+            fields[f][k] = field;
+        }
+        for (int f = 0; f < 3; f++, field += 2 * tile_size) {
+            work[k][f] = field;
+        }
+        memcpy(psi[k], states[k]->p_real, tile_size * sizeof(double));
+        memcpy(psi[k] + tile_size, states[k]->p_imag, tile_size * sizeof(double));
+    }
+}
+
+EnergyMinimizer::~EnergyMinimizer() {
+    free_aligned(buffers);
+    delete stencil;
+}
+
+double EnergyMinimizer::local_dot(const double *a, const double *b) const {
+    Lattice *grid = stencil->grid;
+    int tile_width = grid->end_x - grid->start_x;
+    double sum = 0.;
+    #pragma omp parallel for reduction(+:sum)
+    for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
+        for (int j = grid->inner_start_x - grid->start_x; j < grid->inner_end_x - grid->start_x; ++j) {
+            size_t index = i * tile_width + j;
+            sum += a[index] * b[index] + a[index + tile_size] * b[index + tile_size];
+        }
+    }
+    return sum;
+}
+
+void EnergyMinimizer::reduce(double *sums, int count) const {
+#ifdef HAVE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, sums, count, MPI_DOUBLE, MPI_SUM, stencil->grid->cartcomm);
+#endif
+}
+
+/**
+ * The mean field of the first component is (g_a n_a + g_ab n_b + g_LHY n_a^(3/2)),
+ * that of the second one (g_b n_b + g_ab n_a), with the densities n of the
+ * wave functions density; the Rabi coupling adds w psi_b to the first
+ * component and conj(w) psi_a to the second one, with w = (omega_r + i omega_i) / 2
+ * as in the CPU kernel. The energy functional is the expectation of the
+ * Hamiltonian minus the interaction energy it counts twice.
+ */
+double EnergyMinimizer::apply_hamiltonian(double **density, double **values, double **h, double *kinetic) {
+    Lattice *grid = stencil->grid;
+    for (int k = 0; k < components; k++) {
+        stencil->exchange_halos(values[k], values[k] + tile_size);
+        kinetic[k] = stencil->apply(k, values[k], values[k] + tile_size, h[k], h[k] + tile_size);
+    }
+    double coupling_a = hamiltonian->coupling_a;
+    double coupling_b = 0., coupling_ab = 0., omega_r = 0., omega_i = 0.;
+    double LeeHuangYang_coupling = components == 1 ? hamiltonian->LeeHuangYang_coupling_a : 0.;
+    if (components == 2) {
+        Hamiltonian2Component *hamiltonian2 = static_cast<Hamiltonian2Component *>(hamiltonian);
+        coupling_b = hamiltonian2->coupling_b;
+        coupling_ab = hamiltonian2->coupling_ab;
+        omega_r = 0.5 * hamiltonian2->omega_r;
+        omega_i = 0.5 * hamiltonian2->omega_i;
+    }
+    int tile_width = grid->end_x - grid->start_x;
+    bool two_components = components == 2;
+    double overcount = 0.;
+
+    #pragma omp parallel for reduction(+:overcount)
+    for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
+        for (int j = grid->inner_start_x - grid->start_x; j < grid->inner_end_x - grid->start_x; ++j) {
+            size_t re = i * tile_width + j, im = re + tile_size;
+            double density_a = density[0][re] * density[0][re] + density[0][im] * density[0][im];
+            double density_b = two_components ? density[1][re] * density[1][re] + density[1][im] * density[1][im] : 0.;
+            double field_a = coupling_a * density_a + coupling_ab * density_b;
+            double LeeHuangYang = 0.;
+            if (LeeHuangYang_coupling != 0.) {
+                LeeHuangYang = LeeHuangYang_coupling * density_a * sqrt(density_a);
+                field_a += LeeHuangYang;
+            }
+            h[0][re] += field_a * values[0][re];
+            h[0][im] += field_a * values[0][im];
+            overcount += 0.5 * coupling_a * density_a * density_a + 0.6 * LeeHuangYang * density_a;
+            if (two_components) {
+                double field_b = coupling_b * density_b + coupling_ab * density_a;
+                h[1][re] += field_b * values[1][re] + omega_r * values[0][re] + omega_i * values[0][im];
+                h[1][im] += field_b * values[1][im] + omega_r * values[0][im] - omega_i * values[0][re];
+                h[0][re] += omega_r * values[1][re] - omega_i * values[1][im];
+                h[0][im] += omega_r * values[1][im] + omega_i * values[1][re];
+                overcount += 0.5 * coupling_b * density_b * density_b + coupling_ab * density_a * density_b;
+            }
+        }
+    }
+    return overcount;
+}
+
+double EnergyMinimizer::evaluate(double **values, double **h, double *sums) {
+    double kinetic[2] = {0., 0.};
+    sums[0] = -apply_hamiltonian(values, values, h, kinetic);
+    for (int k = 0; k < 2; k++) {
+        sums[1 + 3 * k] = k < components ? local_dot(values[k], h[k]) : 0.;
+        sums[2 + 3 * k] = kinetic[k];
+        sums[3 + 3 * k] = k < components ? local_dot(values[k], values[k]) : 0.;
+        sums[0] += sums[1 + 3 * k];
+    }
+    reduce(sums, 7);
+    return sums[0];
+}
+
+void EnergyMinimizer::update_multipliers(const double *sums) {
+    lambda[0] = lambda[1] = 0.;
+    for (int k = 0; k < components; k++) {
+        lambda[group[k]] += sums[1 + 3 * k] / norm2[group[k]];
+        // The kinetic energy per particle sets the scale of the smooth part of the residual
+        alpha[k] = sums[3 + 3 * k] > 0. ? sums[2 + 3 * k] / sums[3 + 3 * k] : 0.;
+        if (alpha[k] <= 0.) {
+            alpha[k] = 1.e-3 * stencil->get_kinetic_bound(k);
+        }
+    }
+}
+
+/**
+ * The Chebyshev iteration for (alpha + T) z = r, whose spectrum lies in
+ * [alpha, alpha + bound], returns a polynomial of the kinetic term applied to
+ * r, positive on the spectrum: a symmetric positive definite preconditioner,
+ * which damps the high wave numbers that stiffen the gradient on fine
+ * lattices, at the cost of a stencil and a halo exchange per step.
+ */
+void EnergyMinimizer::precondition(int component, const double *r, double *z) {
+    size_t size = 2 * tile_size;
+    if (preconditioner_steps == 0) {
+        memcpy(z, r, size * sizeof(double));
+        return;
+    }
+    double lower = alpha[component];
+    double upper = alpha[component] + stencil->get_kinetic_bound(component);
+    double theta = 0.5 * (upper + lower), delta = 0.5 * (upper - lower);
+    double sigma = theta / delta, rho = 1. / sigma;
+    double *res = work[component][0], *w = work[component][1], *t = work[component][2];
+    #pragma omp parallel for
+    for (int index = 0; index < int(size); ++index) {
+        res[index] = r[index];
+        w[index] = r[index] / theta;
+        z[index] = w[index];
+    }
+    for (int step = 1; step < preconditioner_steps; step++) {
+        stencil->exchange_halos(w, w + tile_size);
+        stencil->apply(component, w, w + tile_size, t, t + tile_size, true);
+        double next_rho = 1. / (2. * sigma - rho);
+        double a = next_rho * rho, b = 2. * next_rho / delta;
+        #pragma omp parallel for
+        for (int index = 0; index < int(size); ++index) {
+            res[index] -= lower * w[index] + t[index];
+            w[index] = a * w[index] + b * res[index];
+            z[index] += w[index];
+        }
+        rho = next_rho;
+    }
+}
+
+/**
+ * Each iteration moves along the search direction d, in the tangent space of
+ * the constraints, and maps back onto them by rescaling: the squared norm of
+ * psi + t d is that of psi plus t^2 |d|^2. The step t minimizes the quadratic
+ * model given by the slope and by the curvature of the energy, with the
+ * densities of psi; it shrinks, by quadratic interpolation, until the energy
+ * decreases. The iterations stop when the squared norm of the residual
+ * H psi - mu psi, per particle, is below tolerance times the squared energy per
+ * particle, or when not even the preconditioned residual lowers the energy.
+ */
+int EnergyMinimizer::minimize(double tolerance, int max_iterations) {
+    double sums[8];
+    sums[0] = local_dot(psi[0], psi[0]);
+    sums[1] = components == 2 ? local_dot(psi[1], psi[1]) : 0.;
+    reduce(sums, 2);
+    norm2[0] = norm2[1] = 0.;
+    for (int k = 0; k < components; k++) {
+        norm2[group[k]] += sums[k];
+    }
+    for (int g = 0; g < groups; g++) {
+        if (norm2[g] <= 0.) {
+            my_abort("The energy minimizer needs states with a nonzero norm.");
+        }
+    }
+    double total_norm2 = norm2[0] + (groups == 2 ? norm2[1] : 0.);
+    double functional = evaluate(psi, gradient, sums);
+    update_multipliers(sums);
+
+    size_t size = 2 * tile_size;
+    bool converged = false, steepest = true;
+    double previous_rz = 0., step = 0.;
+    int iteration = 0;
+    while (true) {
+        for (int k = 0; k < components; k++) {
+            double mu = lambda[group[k]];
+            double *r = residual[k], *h = gradient[k], *p = psi[k];
+            #pragma omp parallel for
+            for (int index = 0; index < int(size); ++index) {
+                r[index] = h[index] - mu * p[index];
+            }
+            precondition(k, residual[k], preconditioned[k]);
+        }
+        // One reduction: |r|^2, <r, z>, <r_old, z>, <r, d>, then <psi, z> and <psi, d> for each constraint
+        for (int s = 0; s < 8; s++) {
+            sums[s] = 0.;
+        }
+        for (int k = 0; k < components; k++) {
+            sums[0] += local_dot(residual[k], residual[k]);
+            sums[1] += local_dot(residual[k], preconditioned[k]);
+            sums[2] += local_dot(previous_residual[k], preconditioned[k]);
+            sums[3] += local_dot(residual[k], direction[k]);
+            sums[4 + group[k]] += local_dot(psi[k], preconditioned[k]);
+            sums[6 + group[k]] += local_dot(psi[k], direction[k]);
+        }
+        reduce(sums, 8);
+        energy = functional / total_norm2;
+        if (sums[0] / total_norm2 <= tolerance * energy * energy) {
+            converged = true;
+            break;
+        }
+        if (iteration == max_iterations) {
+            break;
+        }
+        ++iteration;
+
+        // Polak-Ribiere, restarted when it would not descend
+        double beta = steepest || previous_rz <= 0. ? 0. : max(0., (sums[1] - sums[2]) / previous_rz);
+        double slope = 2. * (beta * sums[3] - sums[1]);
+        if (slope >= 0.) {
+            beta = 0.;
+            slope = -2. * sums[1];
+        }
+        previous_rz = sums[1];
+        for (int k = 0; k < components; k++) {
+            int g = group[k];
+            double projection = (beta * sums[6 + g] - sums[4 + g]) / norm2[g];
+            double *d = direction[k], *z = preconditioned[k], *p = psi[k];
+            #pragma omp parallel for
+            for (int index = 0; index < int(size); ++index) {
+                d[index] = beta * d[index] - z[index] - projection * p[index];
+            }
+            swap(residual[k], previous_residual[k]);
+        }
+
+        // Curvature of the energy along the direction, and squared norms of the direction
+        double *hd[2] = {work[0][0], components == 2 ? work[1][0] : NULL};
+        double kinetic[2];
+        apply_hamiltonian(psi, direction, hd, kinetic);
+        for (int s = 0; s < 4; s++) {
+            sums[s] = 0.;
+        }
+        for (int k = 0; k < components; k++) {
+            double dd = local_dot(direction[k], direction[k]);
+            sums[0] += local_dot(direction[k], hd[k]) - lambda[group[k]] * dd;
+            sums[2 + group[k]] += dd;
+        }
+        reduce(sums, 4);
+        double curvature = 2. * sums[0];
+        double direction_norm2[2] = {sums[2], sums[3]};
+        step = curvature > 0. ? -slope / curvature : (step > 0. ? 2. * step : 1.);
+
+        bool accepted = false;
+        double trial_sums[7];
+        for (int s = 0; s < LINE_SEARCH_STEPS && !accepted; s++) {
+            for (int k = 0; k < components; k++) {
+                int g = group[k];
+                double scale = sqrt(norm2[g] / (norm2[g] + step * step * direction_norm2[g]));
+                double *d = direction[k], *p = psi[k], *q = trial[k];
+                #pragma omp parallel for
+                for (int index = 0; index < int(size); ++index) {
+                    q[index] = scale * (p[index] + step * d[index]);
+                }
+            }
+            double trial_functional = evaluate(trial, trial_gradient, trial_sums);
+            if (trial_functional <= functional + ENERGY_ROUNDING * fabs(functional)) {
+                accepted = true;
+                functional = trial_functional;
+                for (int k = 0; k < components; k++) {
+                    swap(psi[k], trial[k]);
+                    swap(gradient[k], trial_gradient[k]);
+                }
+                update_multipliers(trial_sums);
+            }
+            else {
+                double excess = trial_functional - functional - slope * step;
+                double shrunk = excess > 0. ? -0.5 * slope * step * step / excess : 0.5 * step;
+                step = min(max(shrunk, 0.1 * step), 0.5 * step);
+            }
+        }
+        if (!accepted && steepest) {
+            break;
+        }
+        steepest = !accepted;
+    }
+
+    for (int k = 0; k < components; k++) {
+        stencil->exchange_halos(psi[k], psi[k] + tile_size);
+        memcpy(states[k]->p_real, psi[k], tile_size * sizeof(double));
+        memcpy(states[k]->p_imag, psi[k] + tile_size, tile_size * sizeof(double));
+        states[k]->expected_values_updated = false;
+    }
+    return converged ? iteration : -iteration;
+}
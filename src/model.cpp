@@ -32,11 +32,28 @@ double const_potential(double x, double y) {
     return 0.;
 }
 
-Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coordinate_system) {
+// Points a time step spoils at the edge of a cached block: 4 by the sweeps of
+// the pairs of neighbours, 8 more by those of the next neighbours of the fourth
+// order, and 4 more by the rotation or the radial kinetic term
+static int spoiled_points(int kinetic_order, bool rotation_or_radial) {
+    return (kinetic_order == 4 ? 12 : 4) + (rotation_or_radial ? 4 : 0);
+}
+
+static void check_kinetic_order(int kinetic_order, string coordinate_system) {
+    if (kinetic_order != 2 && kinetic_order != 4) {
+        my_abort("The order of the kinetic term must be 2 or 4.");
+    }
+    if (kinetic_order == 4 && coordinate_system != "cartesian") {
+        my_abort("The kinetic term of fourth order needs cartesian coordinates.");
+    }
+}
+
+Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coordinate_system, int _kinetic_order) {
     if (_coordinate_system != "cartesian" &&
             _coordinate_system != "cylindrical") {
         my_abort("The coordinate system you have chosen is not implemented.");
     }
+    check_kinetic_order(_kinetic_order, _coordinate_system);
     if (_coordinate_system == "cylindrical" &&
             periodic_x_axis == true) {
         my_abort("You cannot choose periodic boundary on the radial axis.");
@@ -55,6 +72,7 @@ Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coord
     periods[0] = 0;
     periods[1] = (int) periodic_x_axis;
 #ifdef HAVE_MPI
+    check_mpi_thread_support();
     MPI_Comm_size(MPI_COMM_WORLD, &mpi_procs);
     mpi_dims[0] = mpi_procs;
     mpi_dims[1] = 1;
@@ -68,8 +86,10 @@ Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coord
     mpi_dims[0] = mpi_dims[1] = 1;
     mpi_coords[0] = mpi_coords[1] = 0;
 #endif
-    halo_x = 4;
+    kinetic_order = _kinetic_order;
+    halo_x = spoiled_points(kinetic_order, coordinate_system == "cylindrical");
     halo_y = 0;
+    steps_per_block = 1;
     global_dim_x = dim + periods[1] * 2 * halo_x;
     global_dim_y = 1;
     global_no_halo_dim_x = dim;
@@ -91,25 +111,32 @@ Lattice1D::Lattice1D(int dim, double length, bool periodic_x_axis, string _coord
 
 Lattice2D::Lattice2D(int dim, double _length,
                      bool periodic_x_axis, bool periodic_y_axis,
-                     double angular_velocity, string coordinate_system) {
+                     double angular_velocity, string coordinate_system,
+                     int steps_per_block, int kinetic_order) {
     init(dim, _length, dim, _length, periodic_x_axis, periodic_y_axis,
-         angular_velocity, coordinate_system);
+         angular_velocity, coordinate_system, steps_per_block, kinetic_order);
 }
 
 Lattice2D::Lattice2D(int _dim_x, double _length_x, int _dim_y, double _length_y,
                      bool periodic_x_axis, bool periodic_y_axis,
-                     double angular_velocity, string coordinate_system) {
+                     double angular_velocity, string coordinate_system,
+                     int steps_per_block, int kinetic_order) {
     init(_dim_x, _length_x, _dim_y, _length_y, periodic_x_axis, periodic_y_axis,
-         angular_velocity, coordinate_system);
+         angular_velocity, coordinate_system, steps_per_block, kinetic_order);
 }
 
 void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
                      bool periodic_x_axis, bool periodic_y_axis,
-                     double angular_velocity, string _coordinate_system) {
+                     double angular_velocity, string _coordinate_system,
+                     int _steps_per_block, int _kinetic_order) {
     if (_coordinate_system != "cartesian" &&
             _coordinate_system != "cylindrical") {
         my_abort("The coordinate system you have chosen is not implemented.");
     }
+    if (_steps_per_block < 1) {
+        my_abort("The number of steps per block must be positive.");
+    }
+    check_kinetic_order(_kinetic_order, _coordinate_system);
     if (_coordinate_system == "cylindrical" &&
             periodic_x_axis == true) {
         my_abort("You cannot choose periodic boundary on the radial axis.");
@@ -129,6 +156,7 @@ void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
     periods[1] = (int) periodic_x_axis;
     mpi_dims[0] = mpi_dims[1] = 0;
 #ifdef HAVE_MPI
+    check_mpi_thread_support();
     MPI_Comm_size(MPI_COMM_WORLD, &mpi_procs);
     MPI_Dims_create(mpi_procs, 2, mpi_dims);  //partition all the processes (the size of MPI_COMM_WORLD's group) into an 2-dimensional topology
     MPI_Cart_create(MPI_COMM_WORLD, 2, mpi_dims, periods, 0, &cartcomm);
@@ -140,8 +168,11 @@ void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
     mpi_dims[0] = mpi_dims[1] = 1;
     mpi_coords[0] = mpi_coords[1] = 0;
 #endif
-    halo_x = (angular_velocity == 0. ? 4 : 8);
-    halo_y = (angular_velocity == 0. ? 4 : 8);
+    // Every time step spoils the edge of a block
+    steps_per_block = _steps_per_block;
+    kinetic_order = _kinetic_order;
+    halo_x = spoiled_points(kinetic_order, angular_velocity != 0. || coordinate_system == "cylindrical") * steps_per_block;
+    halo_y = spoiled_points(kinetic_order, angular_velocity != 0.) * steps_per_block;
     global_dim_x = _dim_x + periods[1] * 2 * halo_x;
     global_dim_y = _dim_y + periods[0] * 2 * halo_y;
     global_no_halo_dim_x = _dim_x;
@@ -158,6 +189,12 @@ void Lattice2D::init(int _dim_x, double _length_x, int _dim_y, double _length_y,
                       _dim_y, halo_y, periods[0]);
     dim_x = end_x - start_x;
     dim_y = end_y - start_y;
+    // The halos are exchanged from the inner tile of the neighbours
+    if (mpi_procs > 1 &&
+            (inner_end_x - inner_start_x < halo_x ||
+             inner_end_y - inner_start_y < halo_y)) {
+        my_abort("The tiles of the MPI processes are smaller than their halos: use a larger lattice or fewer processes.");
+    }
 }
 
 State::State(Lattice *_grid, int _angular_momentum, double *_p_real, double *_p_imag): grid(_grid), angular_momentum(_angular_momentum) {
@@ -165,9 +202,7 @@ State::State(Lattice *_grid, int _angular_momentum, double *_p_real, double *_p_
     if (_p_real == 0) {
         self_init = true;
         p_real = new double[grid->dim_x * grid->dim_y];
-        for (int i = 0; i < grid->dim_x * grid->dim_y; i++) {
-            p_real[i] = 0;
-        }
+        first_touch(p_real, grid->dim_x, grid->dim_y);
     }
     else {
         self_init = false;
@@ -175,9 +210,7 @@ State::State(Lattice *_grid, int _angular_momentum, double *_p_real, double *_p_
     }
     if (_p_imag == 0) {
         p_imag = new double[grid->dim_x * grid->dim_y];
-        for (int i = 0; i < grid->dim_x * grid->dim_y; i++) {
-            p_imag[i] = 0;
-        }
+        first_touch(p_imag, grid->dim_x, grid->dim_y);
     }
     else {
         p_imag = _p_imag;
@@ -191,6 +224,8 @@ State::State(const State &obj): grid(obj.grid), angular_momentum(obj.angular_mom
     norm2(obj.norm2) {
     p_real = new double[grid->dim_x * grid->dim_y];
     p_imag = new double[grid->dim_x * grid->dim_y];
+    first_touch(p_real, grid->dim_x, grid->dim_y);
+    first_touch(p_imag, grid->dim_x, grid->dim_y);
     for (int y = 0; y < grid->dim_y; y++) {
         for (int x = 0; x < grid->dim_x; x++) {
             p_real[y * grid->dim_x + x] = obj.p_real[y * grid->dim_x + x];
@@ -414,9 +449,7 @@ void State::calculate_expected_values(void) {
     complex<double> const_1 = -1. / 12., const_2 = 4. / 3., const_3 = -2.5;
     complex<double> derivate1_1 = 1. / 6., derivate1_2 = - 1., derivate1_3 = 0.5, derivate1_4 = 1. / 3.;
 
-#ifndef HAVE_MPI
     #pragma omp parallel for reduction(+:sum_norm2,sum_x_mean,sum_y_mean,sum_xx_mean,sum_yy_mean,sum_px_mean,sum_py_mean,sum_pxpx_mean,sum_pypy_mean,sum_angular_momentum) private(x,y) schedule(dynamic, 8)
-#endif
     for (int i = ini_halo_y; i < grid->inner_end_y - grid->start_y; ++i) {
         complex<double> psi_up, psi_down, psi_center, psi_left, psi_right;
         complex<double> psi_up_up, psi_down_down, psi_left_left, psi_right_right;
@@ -835,7 +868,8 @@ complex<double> BesselState::bessel_state2D(double x, double y) {
     return normalization * exp(complex<double>(0., phase)) * complex<double> (jn(int(angular_momentum), x * zero / grid->length_x) * cos(M_PI * double(n_y) / grid->length_y * y), 0.);
 }
 
-Potential::Potential(Lattice *_grid, char *filename): grid(_grid) {
+Potential::Potential(Lattice *_grid, char *filename): grid(_grid),
+    matrix_grid(NULL), lattice_matrix(NULL), level_matrix(NULL) {
     matrix = new double[grid->dim_y * grid->dim_x];
     self_init = true;
     is_static = true;
@@ -850,7 +884,8 @@ Potential::Potential(Lattice *_grid, char *filename): grid(_grid) {
     input.close();
 }
 
-Potential::Potential(Lattice *_grid, double *_external_pot): grid(_grid) {
+Potential::Potential(Lattice *_grid, double *_external_pot): grid(_grid),
+    matrix_grid(NULL), lattice_matrix(NULL), level_matrix(NULL) {
     if (_external_pot == 0) {
         self_init = true;
         matrix = new double[grid->dim_x * grid->dim_y];
@@ -865,7 +900,8 @@ Potential::Potential(Lattice *_grid, double *_external_pot): grid(_grid) {
     static_potential = NULL;
 }
 
-Potential::Potential(Lattice *_grid, double (*potential_fuction)(double x, double y)): grid(_grid) {
+Potential::Potential(Lattice *_grid, double (*potential_fuction)(double x, double y)): grid(_grid),
+    matrix_grid(NULL), lattice_matrix(NULL), level_matrix(NULL) {
     is_static = true;
     self_init = false;
     updated_potential_matrix = false;
@@ -874,7 +910,8 @@ Potential::Potential(Lattice *_grid, double (*potential_fuction)(double x, doubl
     matrix = NULL;
 }
 
-Potential::Potential(Lattice *_grid, double (*potential_function)(double x, double y, double t), int _t): grid(_grid) {
+Potential::Potential(Lattice *_grid, double (*potential_function)(double x, double y, double t), int _t): grid(_grid),
+    matrix_grid(NULL), lattice_matrix(NULL), level_matrix(NULL) {
     is_static = false;
     self_init = false;
     updated_potential_matrix = false;
@@ -913,9 +950,36 @@ bool Potential::update(double t) {
     return false;
 }
 
+bool Potential::depends_on_time() const {
+    return !is_static || updated_potential_matrix;
+}
+
+void Potential::set_lattice(Lattice *_grid) {
+    // A matrix is averaged over the cells of a coarser lattice, and restored
+    // on the lattice it was given on
+    if (matrix != NULL && matrix_grid == NULL) {
+        matrix_grid = grid;
+        lattice_matrix = matrix;
+    }
+    if (matrix_grid != NULL) {
+        delete [] level_matrix;
+        level_matrix = NULL;
+        if (_grid == matrix_grid) {
+            matrix = lattice_matrix;
+        }
+        else {
+            level_matrix = new double[_grid->dim_x * _grid->dim_y];
+            restrict_lattice(matrix_grid, lattice_matrix, _grid, level_matrix);
+            matrix = level_matrix;
+        }
+    }
+    grid = _grid;
+}
+
 Potential::~Potential() {
+    delete [] level_matrix;
     if (self_init) {
-        delete [] matrix;
+        delete [] (matrix_grid != NULL ? lattice_matrix : matrix);
     }
 }
 
@@ -950,12 +1014,13 @@ Hamiltonian::Hamiltonian(Lattice *_grid, Potential *_potential,
             cout << "Boundary conditions must be closed for rotating frame of reference\n";
             return;
         }
+        int halo = spoiled_points(grid->kinetic_order, true) * grid->steps_per_block;
         if (grid->mpi_procs == 1) {
-            grid->halo_x = 8;
-            grid->halo_y = 8;
+            grid->halo_x = halo;
+            grid->halo_y = halo;
         }
-        if (grid->mpi_procs > 1 && (grid->halo_x == 4 || grid->halo_y == 4)) {
-            cout << "Halos must be of 8 points width\n";
+        if (grid->mpi_procs > 1 && (grid->halo_x < halo || grid->halo_y < halo)) {
+            cout << "Halos must be of " << halo / grid->steps_per_block << " points width\n";
             return;
         }
     }
@@ -982,6 +1047,18 @@ double Hamiltonian::azimuthal_potential(double x, int angular_momentum) {
     return (angular_momentum * angular_momentum) / (2. * mass * x_r * x_r);
 }
 
+void Hamiltonian::set_lattice(Lattice *_grid) {
+    // The center of rotation keeps its physical coordinates
+    if (grid->coordinate_system != "cylindrical") {
+        rot_coord_x = _grid->global_no_halo_dim_x * 0.5 +
+                      (rot_coord_x - grid->global_no_halo_dim_x * 0.5) * grid->delta_x / _grid->delta_x;
+    }
+    rot_coord_y = _grid->global_no_halo_dim_y * 0.5 +
+                  (rot_coord_y - grid->global_no_halo_dim_y * 0.5) * grid->delta_y / _grid->delta_y;
+    grid = _grid;
+    potential->set_lattice(grid);
+}
+
 Hamiltonian::~Hamiltonian() {
     if (self_init) {
         delete potential;
@@ -1014,6 +1091,13 @@ double Hamiltonian2Component::azimuthal_potential_b(double x, int angular_moment
     return (angular_momentum * angular_momentum) / (2. * mass_b * x_r * x_r);
 }
 
+void Hamiltonian2Component::set_lattice(Lattice *_grid) {
+    Hamiltonian::set_lattice(_grid);
+    if (potential_b != potential) {
+        potential_b->set_lattice(_grid);
+    }
+}
+
 Hamiltonian2Component::~Hamiltonian2Component() {
 
 }
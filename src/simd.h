@@ -0,0 +1,54 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef __SIMD_H
+#define __SIMD_H
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+/* Thin layer over the AVX-512 and AVX2 intrinsics used by the CPU kernels.
+ * SIMD_WIDTH is the number of doubles in a vector; it is not defined when the
+ * compiler targets neither instruction set, and the kernels fall back to their
+ * scalar loops.
+ */
+#if defined(__AVX512F__)
+#define SIMD_WIDTH 8
+typedef __m512d simd_double;
+static inline simd_double simd_load(const double *p) { return _mm512_loadu_pd(p); }
+static inline void simd_store(double *p, simd_double v) { _mm512_storeu_pd(p, v); }
+static inline simd_double simd_set1(double a) { return _mm512_set1_pd(a); }
+static inline simd_double simd_add(simd_double a, simd_double b) { return _mm512_add_pd(a, b); }
+static inline simd_double simd_sub(simd_double a, simd_double b) { return _mm512_sub_pd(a, b); }
+static inline simd_double simd_mul(simd_double a, simd_double b) { return _mm512_mul_pd(a, b); }
+static inline simd_double simd_swap_pairs(simd_double v) { return _mm512_shuffle_pd(v, v, 0x55); }
+static inline simd_double simd_blend_even(simd_double old_v, simd_double new_v) { return _mm512_mask_blend_pd(0x55, old_v, new_v); }
+#elif defined(__AVX2__)
+#define SIMD_WIDTH 4
+typedef __m256d simd_double;
+static inline simd_double simd_load(const double *p) { return _mm256_loadu_pd(p); }
+static inline void simd_store(double *p, simd_double v) { _mm256_storeu_pd(p, v); }
+static inline simd_double simd_set1(double a) { return _mm256_set1_pd(a); }
+static inline simd_double simd_add(simd_double a, simd_double b) { return _mm256_add_pd(a, b); }
+static inline simd_double simd_sub(simd_double a, simd_double b) { return _mm256_sub_pd(a, b); }
+static inline simd_double simd_mul(simd_double a, simd_double b) { return _mm256_mul_pd(a, b); }
+static inline simd_double simd_swap_pairs(simd_double v) { return _mm256_permute_pd(v, 0x5); }
+static inline simd_double simd_blend_even(simd_double old_v, simd_double new_v) { return _mm256_blend_pd(old_v, new_v, 0x5); }
+#endif
+
+#endif
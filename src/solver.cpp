@@ -21,44 +21,77 @@
 #include "kernel.h"
 #include <iostream>
 #include <cstring>
+#include <algorithm>
+
+// Imaginary time steps between two checks of the energy in mixed precision
+#define MIXED_PRECISION_CHECK_STEPS 100
+// Weights of the sub-steps of the fourth order Yoshida splitting: outer, middle, outer
+#define YOSHIDA_OUTER (1. / (2. - pow(2., 1. / 3.)))
+#define YOSHIDA_MIDDLE (1. - 2. * YOSHIDA_OUTER)
 
 
 Solver::Solver(Lattice *_grid, State *_state, Hamiltonian *_hamiltonian,
                double _delta_t, string _kernel_type):
     grid(_grid), state(_state), hamiltonian(_hamiltonian), delta_t(_delta_t),
-    kernel_type(_kernel_type) {
+    kernel_type(_kernel_type), sincos_accuracy("double"), autotune_cache(""), in_place(false),
+    mixed_precision_tolerance(0.), splitting_order(2) {
     external_pot_real = new double* [2];
     external_pot_imag = new double* [2];
     external_pot_real[0] = new double[grid->dim_x * grid->dim_y];
+    first_touch(external_pot_real[0], grid->dim_x, grid->dim_y);
     external_pot_imag[0] = new double[grid->dim_x * grid->dim_y];
+    first_touch(external_pot_imag[0], grid->dim_x, grid->dim_y);
     external_pot_real[1] = NULL;
     external_pot_imag[1] = NULL;
     is_python = false;
     state_b = NULL;
     kernel = NULL;
+    float_kernel = NULL;
     current_evolution_time = 0;
     single_component = true;
     energy_expected_values_updated = false;
     has_parameters_changed = false;
+    mixed_precision_converged = false;
+    mixed_precision_steps = 0;
+    mixed_precision_energy = 0.;
+    coarse_iterations = 0;
+    for (int i = 0; i < 2; i++) {
+        middle_pot_real[i] = NULL;
+        middle_pot_imag[i] = NULL;
+    }
 }
 
 Solver::Solver(Lattice *_grid, State *state1, State *state2,
                Hamiltonian2Component *_hamiltonian,
                double _delta_t, string _kernel_type):
     grid(_grid), state(state1), state_b(state2), hamiltonian(_hamiltonian), delta_t(_delta_t),
-    kernel_type(_kernel_type) {
+    kernel_type(_kernel_type), sincos_accuracy("double"), autotune_cache(""), in_place(false),
+    mixed_precision_tolerance(0.), splitting_order(2) {
     external_pot_real = new double* [2];
     external_pot_imag = new double* [2];
     external_pot_real[0] = new double[grid->dim_x * grid->dim_y];
+    first_touch(external_pot_real[0], grid->dim_x, grid->dim_y);
     external_pot_imag[0] = new double[grid->dim_x * grid->dim_y];
+    first_touch(external_pot_imag[0], grid->dim_x, grid->dim_y);
     external_pot_real[1] = new double[grid->dim_x * grid->dim_y];
+    first_touch(external_pot_real[1], grid->dim_x, grid->dim_y);
     external_pot_imag[1] = new double[grid->dim_x * grid->dim_y];
+    first_touch(external_pot_imag[1], grid->dim_x, grid->dim_y);
     is_python = false;
     kernel = NULL;
+    float_kernel = NULL;
     current_evolution_time = 0;
     single_component = false;
     energy_expected_values_updated = false;
     has_parameters_changed = false;
+    mixed_precision_converged = false;
+    mixed_precision_steps = 0;
+    mixed_precision_energy = 0.;
+    coarse_iterations = 0;
+    for (int i = 0; i < 2; i++) {
+        middle_pot_real[i] = NULL;
+        middle_pot_imag[i] = NULL;
+    }
 }
 
 Solver::~Solver() {
@@ -68,46 +101,74 @@ Solver::~Solver() {
     delete [] external_pot_imag[1];
     delete [] external_pot_real;
     delete [] external_pot_imag;
+    for (int i = 0; i < 2; i++) {
+        delete [] middle_pot_real[i];
+        delete [] middle_pot_imag[i];
+    }
     if (kernel != NULL) {
         delete kernel;
     }
+    if (float_kernel != NULL) {
+        delete float_kernel;
+    }
 }
 
-void Solver::initialize_exp_potential(double delta_t, int which) {
-#ifndef HAVE_MPI
+void Solver::initialize_exp_potential(double delta_t, int which, double *pot_real, double *pot_imag) {
+    // The azimuthal term only depends on the radial coordinate
+    double *azimuthal_terms = new double[grid->dim_x];
+    for (int x = 0; x < grid->dim_x; ++x) {
+        azimuthal_terms[x] = 0.;
+        if (grid->coordinate_system == "cylindrical") {
+            if (which == 0) {
+                azimuthal_terms[x] = hamiltonian->azimuthal_potential(x, state->angular_momentum);
+            }
+            else {
+                azimuthal_terms[x] = static_cast<Hamiltonian2Component*>(hamiltonian)->azimuthal_potential_b(x, state_b->angular_momentum);
+            }
+        }
+    }
     #pragma omp parallel default(shared)
-#endif
     {
         complex<double> tmp;
         double ptmp;
-#ifndef HAVE_MPI
-        #pragma omp for schedule(dynamic, 12) collapse(2)
-#endif
+        #pragma omp for schedule(static)
         for (int y = 0; y < grid->dim_y; ++y) {
             for (int x = 0; x < grid->dim_x; ++x) {
                 if (which == 0) {
                     ptmp = hamiltonian->potential->get_value(x, y);
-                    if (grid->coordinate_system == "cylindrical") {
-                        ptmp += hamiltonian->azimuthal_potential(x, state->angular_momentum);
-                    }
                 }
                 else {
                     ptmp = static_cast<Hamiltonian2Component*>(hamiltonian)->potential_b->get_value(x, y);
-                    if (grid->coordinate_system == "cylindrical") {
-                        ptmp += static_cast<Hamiltonian2Component*>(hamiltonian)->azimuthal_potential_b(x, state_b->angular_momentum);
-                    }
                 }
+                ptmp += azimuthal_terms[x];
                 if (imag_time) {
                     tmp = exp(complex<double> (-delta_t * ptmp, 0.));
                 }
                 else {
                     tmp = exp(complex<double> (0., -delta_t * ptmp));
                 }
-                external_pot_real[which][y * grid->dim_x + x] = real(tmp);
-                external_pot_imag[which][y * grid->dim_x + x] = imag(tmp);
+                pot_real[y * grid->dim_x + x] = real(tmp);
+                pot_imag[y * grid->dim_x + x] = imag(tmp);
             }
         }
     }
+    delete [] azimuthal_terms;
+}
+
+void Solver::initialize_exp_potentials(int which) {
+    if (splitting_order == 2 || imag_time) {
+        initialize_exp_potential(delta_t, which, external_pot_real[which], external_pot_imag[which]);
+        return;
+    }
+    // The outer sub-steps share the buffers of the second order splitting
+    if (middle_pot_real[which] == NULL) {
+        middle_pot_real[which] = new double[grid->dim_x * grid->dim_y];
+        first_touch(middle_pot_real[which], grid->dim_x, grid->dim_y);
+        middle_pot_imag[which] = new double[grid->dim_x * grid->dim_y];
+        first_touch(middle_pot_imag[which], grid->dim_x, grid->dim_y);
+    }
+    initialize_exp_potential(YOSHIDA_OUTER * delta_t, which, external_pot_real[which], external_pot_imag[which]);
+    initialize_exp_potential(YOSHIDA_MIDDLE * delta_t, which, middle_pot_real[which], middle_pot_imag[which]);
 }
 
 void Solver::set_exp_potential(double *real, int real_length, double *imag,
@@ -117,23 +178,134 @@ void Solver::set_exp_potential(double *real, int real_length, double *imag,
     memcpy(external_pot_imag[which], imag, sizeof(double)*imag_length);
 }
 
+void Solver::set_sincos_accuracy(string accuracy) {
+    if (accuracy != "exact" && accuracy != "double" && accuracy != "single") {
+        my_abort("Unknown accuracy of the sine and cosine, use exact, double or single.");
+    }
+    sincos_accuracy = accuracy;
+    has_parameters_changed = true;
+}
+
+void Solver::set_autotune_cache(string file_name) {
+    autotune_cache = file_name;
+}
+
+void Solver::set_in_place(bool _in_place) {
+    in_place = _in_place;
+    has_parameters_changed = true;
+}
+
+void Solver::set_splitting_order(int order) {
+    if (order != 2 && order != 4) {
+        my_abort("Unknown order of the splitting, use 2 or 4.");
+    }
+    splitting_order = order;
+    has_parameters_changed = true;
+}
+
+void Solver::set_mixed_precision(double energy_tolerance) {
+    if (energy_tolerance < 0.) {
+        my_abort("The energy tolerance of the mixed precision must not be negative.");
+    }
+    mixed_precision_tolerance = energy_tolerance;
+    mixed_precision_converged = false;
+    mixed_precision_steps = 0;
+}
+
+size_t Solver::get_kernel_allocations(void) {
+    ITrotterKernel *active_kernel = kernel != NULL ? kernel : float_kernel;
+    if (active_kernel == NULL) {
+        return 0;
+    }
+    return active_kernel->get_allocation_count();
+}
+
 void Solver::init_kernel() {
     if (kernel != NULL) {
         delete kernel;
+        kernel = NULL;
     }
-    if (kernel_type == "cpu") {
-        if (single_component) {
-            kernel = new CPUBlock(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time);
+    // Temporal blocking: several time steps per halo exchange, as long as
+    // every step only depends on the state of the same component
+    if (grid->steps_per_block > 1) {
+        if (!single_component || kernel_type == "gpu") {
+            my_abort("Temporal blocking needs a single component, and the GPU kernel does not support it.");
+        }
+        if (splitting_order == 4 && !imag_time && kernel_type != "chebyshev") {
+            my_abort("Temporal blocking needs the splitting of order 2.");
+        }
+        if (hamiltonian->potential->depends_on_time()) {
+            my_abort("Temporal blocking needs a static potential.");
+        }
+        if (imag_time && (hamiltonian->coupling_a != 0. || hamiltonian->LeeHuangYang_coupling_a != 0. ||
+                          grid->coordinate_system == "cylindrical")) {
+            my_abort("Temporal blocking in imaginary time needs a linear Hamiltonian in cartesian coordinates.");
+        }
+    }
+    int accuracy = SINCOS_DOUBLE;
+    if (sincos_accuracy == "exact") {
+        accuracy = SINCOS_EXACT;
+    }
+    else if (sincos_accuracy == "single") {
+        accuracy = SINCOS_SINGLE;
+    }
+    if (kernel_type == "cpu" || kernel_type == "cpu-auto" || kernel_type == "cpu-float") {
+        if (kernel_type == "cpu-float") {
+            if (single_component) {
+                kernel = new CPUBlock<float>(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time, accuracy, in_place);
+            }
+            else {
+                kernel = new CPUBlock<float>(grid, state, state_b, static_cast<Hamiltonian2Component*>(hamiltonian), external_pot_real, external_pot_imag, delta_t, norm2, imag_time, accuracy, in_place);
+            }
+        }
+        else if (single_component) {
+            kernel = new CPUBlock<double>(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time, accuracy, in_place);
         }
         else {
-            kernel = new CPUBlock(grid, state, state_b, static_cast<Hamiltonian2Component*>(hamiltonian), external_pot_real, external_pot_imag, delta_t, norm2, imag_time);
+            kernel = new CPUBlock<double>(grid, state, state_b, static_cast<Hamiltonian2Component*>(hamiltonian), external_pot_real, external_pot_imag, delta_t, norm2, imag_time, accuracy, in_place);
+        }
+        if (kernel_type == "cpu-auto") {
+            static_cast<CPUBlock<double>*>(kernel)->start_autotuning(autotune_cache);
+        }
+    }
+    else if (kernel_type == "adi") {
+        if (!single_component || grid->coordinate_system != "cartesian" || hamiltonian->angular_velocity != 0.) {
+            my_abort("The ADI kernel needs a single component in cartesian coordinates, without rotation.");
+        }
+        if (grid->kinetic_order != 2) {
+            my_abort("The ADI kernel needs the kinetic term of second order: its implicit steps solve tridiagonal systems.");
+        }
+        kernel = new ADIKernel(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time, accuracy);
+    }
+    else if (kernel_type == "chebyshev") {
+        if (!single_component || hamiltonian->coupling_a != 0. || hamiltonian->LeeHuangYang_coupling_a != 0.) {
+            my_abort("The Chebyshev kernel needs a single component with a linear Hamiltonian.");
+        }
+        if (hamiltonian->potential->depends_on_time()) {
+            my_abort("The Chebyshev kernel needs a static potential.");
+        }
+        kernel = new ChebyshevKernel(grid, state, hamiltonian, delta_t, norm2[0], imag_time);
+    }
+    else if (kernel_type == "fft") {
+        if (!single_component || grid->coordinate_system != "cartesian" || hamiltonian->angular_velocity != 0.) {
+            my_abort("The FFT kernel needs a single component in cartesian coordinates, without rotation.");
+        }
+        if (grid->periods[1] == 0 || (grid->global_no_halo_dim_y > 1 && grid->periods[0] == 0)) {
+            my_abort("The FFT kernel needs periodic boundary conditions.");
         }
+        kernel = new FFTKernel(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time, accuracy);
     }
     else if (kernel_type == "gpu") {
 #ifdef CUDA
         if (hamiltonian->angular_velocity != 0) {
             my_abort("The GPU kernel does not work with nonzero angular velocity.");
         }
+        if (grid->kinetic_order != 2) {
+            my_abort("The GPU kernel only has the kinetic term of second order.");
+        }
+        if (splitting_order == 4 && !imag_time) {
+            my_abort("The GPU kernel does not support the splitting of order 4.");
+        }
         if (single_component) {
             kernel = new CC2Kernel(grid, state, hamiltonian, external_pot_real[0], external_pot_imag[0], delta_t, norm2[0], imag_time);
         }
@@ -149,86 +321,188 @@ void Solver::init_kernel() {
     }
 }
 
+/**
+ * The iterations run with the cpu-float kernel, which stores the wave
+ * functions in single precision, until the relative change of the total
+ * energy over MIXED_PRECISION_CHECK_STEPS single precision steps falls below
+ * the tolerance; the steps are counted across calls. Afterwards the solver
+ * stays with the double precision kernel until the parameters change. The
+ * single precision kernel waits in float_kernel between calls, so that each
+ * kernel is built once per phase.
+ */
+void Solver::evolve_mixed_precision(int iterations) {
+    if (has_parameters_changed) {
+        mixed_precision_converged = false;
+        mixed_precision_steps = 0;
+    }
+    int done = 0;
+    if (!mixed_precision_converged) {
+        if (mixed_precision_steps == 0) {
+            mixed_precision_energy = get_total_energy();
+        }
+        // The double precision kernel falls behind the state as soon as the
+        // single precision one evolves it
+        if (kernel != NULL) {
+            delete kernel;
+        }
+        kernel = float_kernel;
+        float_kernel = NULL;
+        string double_kernel_type = kernel_type;
+        kernel_type = "cpu-float";
+        while (done < iterations) {
+            int steps = min(MIXED_PRECISION_CHECK_STEPS - mixed_precision_steps, iterations - done);
+            evolve(steps, true);
+            done += steps;
+            mixed_precision_steps += steps;
+            if (mixed_precision_steps == MIXED_PRECISION_CHECK_STEPS) {
+                mixed_precision_steps = 0;
+                double previous_energy = mixed_precision_energy;
+                mixed_precision_energy = get_total_energy();
+                if (fabs(mixed_precision_energy - previous_energy) <= mixed_precision_tolerance * fabs(mixed_precision_energy)) {
+                    mixed_precision_converged = true;
+                    break;
+                }
+            }
+        }
+        kernel_type = double_kernel_type;
+        if (mixed_precision_converged) {
+            delete kernel;
+        }
+        else {
+            float_kernel = kernel;
+        }
+        kernel = NULL;
+    }
+    if (done < iterations) {
+        double tolerance = mixed_precision_tolerance;
+        mixed_precision_tolerance = 0.;
+        evolve(iterations - done, true);
+        mixed_precision_tolerance = tolerance;
+    }
+}
+
 void Solver::evolve(int iterations, bool _imag_time) {
+    // Restarting the evolution would change the splitting of the Rabi coupling
+    if (_imag_time && mixed_precision_tolerance > 0. && iterations > 0 &&
+            (kernel_type == "cpu" || kernel_type == "cpu-auto") &&
+            (single_component || (static_cast<Hamiltonian2Component*>(hamiltonian)->omega_r == 0. &&
+                                  static_cast<Hamiltonian2Component*>(hamiltonian)->omega_i == 0.))) {
+        evolve_mixed_precision(iterations);
+        return;
+    }
+    // The single precision kernel of the mixed precision falls behind the
+    // state as soon as another kernel evolves it
+    if (float_kernel != NULL) {
+        delete float_kernel;
+        float_kernel = NULL;
+    }
     if (_imag_time != imag_time || kernel == NULL || has_parameters_changed) {
         imag_time = _imag_time;
         if (imag_time) {
-            initialize_exp_potential(delta_t, 0);
+            initialize_exp_potentials(0);
             norm2[0] = state->get_squared_norm();
             if (!single_component) {
-                initialize_exp_potential(delta_t, 1);
+                initialize_exp_potentials(1);
                 norm2[1] = state_b->get_squared_norm();
             }
         }
         else {
             if (!is_python) {
-                initialize_exp_potential(delta_t, 0);
+                initialize_exp_potentials(0);
             }
             if (!single_component) {
-                initialize_exp_potential(delta_t, 1);
+                initialize_exp_potentials(1);
             }
         }
         init_kernel();
         has_parameters_changed = false;
     }
+    // Sub-steps of each time step: the second order splitting itself, or
+    // three of them with the weights of the fourth order Yoshida splitting
+    int sub_steps = 1;
+    double weights[3] = {1., 1., 1.};
+    // The Chebyshev expansion is exact at any time step
+    if (splitting_order == 4 && !imag_time && kernel_type != "chebyshev") {
+        if (is_python) {
+            my_abort("The fourth order splitting needs the solver to compute the evolution operator of the potential.");
+        }
+        sub_steps = 3;
+        weights[0] = weights[2] = YOSHIDA_OUTER;
+        weights[1] = YOSHIDA_MIDDLE;
+    }
+
     // Main loop
-    double var = 0.5;
     if ((!is_python && !single_component) ||
             (is_python && current_evolution_time == 0 && !single_component)) {
-        kernel->rabi_coupling(var, delta_t);
+        kernel->rabi_coupling(0.5 * weights[0], delta_t);
     }
-    var = 1.;
     bool soft_update = false;
     if (iterations < 0) {
         iterations = -iterations;
         soft_update = true;
     }
 
+    // Temporal blocking, checked by init_kernel()
+    int steps_per_call = grid->steps_per_block;
+
     // Main loop
-    for (int i = 0; i < iterations; ++i) {
+    for (int i = 0, steps = 1; i < iterations; i += steps) {
+        if (steps_per_call > 1) {
+            steps = min(steps_per_call, iterations - i);
+            kernel->set_steps_per_call(steps);
+        }
+        bool last = (i + steps == iterations);
         if (i > 0 && hamiltonian->potential->update(current_evolution_time)) {
             if (!is_python) {
-                initialize_exp_potential(delta_t, 0);
+                initialize_exp_potentials(0);
             }
             kernel->update_potential(external_pot_real[0], external_pot_imag[0], 0);
         }
         if (!single_component && i > 0) {
             if (static_cast<Hamiltonian2Component*>(hamiltonian)->potential_b->update(current_evolution_time)) {
                 if (!is_python) {
-                    initialize_exp_potential(delta_t, 1);
+                    initialize_exp_potentials(1);
                 }
                 kernel->update_potential(external_pot_real[1], external_pot_imag[1], 1);
             }
         }
-        //first wave function
-        kernel->run_kernel_on_halo();
-        if (i != iterations - 1) {
+        for (int sub_step = 0; sub_step < sub_steps; ++sub_step) {
+            bool last_sub_step = last && sub_step == sub_steps - 1;
+            if (sub_steps > 1) {
+                double **pot_real = sub_step == 1 ? middle_pot_real : external_pot_real;
+                double **pot_imag = sub_step == 1 ? middle_pot_imag : external_pot_imag;
+                kernel->set_time_step(weights[sub_step] * delta_t);
+                kernel->update_potential(pot_real[0], pot_imag[0], 0);
+                if (!single_component) {
+                    kernel->update_potential(pot_real[1], pot_imag[1], 1);
+                }
+            }
+            // The halos are exchanged after the last step too, since the
+            // next call to evolve starts from them
+            //first wave function
+            kernel->run_kernel_on_halo();
             kernel->start_halo_exchange();
-        }
-        kernel->run_kernel();
-        if (i != iterations - 1) {
+            kernel->run_kernel();
             kernel->finish_halo_exchange();
-        }
-        kernel->wait_for_completion();
-        if (!single_component) {
-            //second wave function
-            kernel->run_kernel_on_halo();
-            if (i != iterations - 1) {
+            kernel->wait_for_completion();
+            if (!single_component) {
+                //second wave function
+                kernel->run_kernel_on_halo();
                 kernel->start_halo_exchange();
-            }
-            kernel->run_kernel();
-            if (i != iterations - 1) {
+                kernel->run_kernel();
                 kernel->finish_halo_exchange();
+                kernel->wait_for_completion();
+                // Half of the Rabi coupling of this sub-step and half of that of the next one
+                double var = 0.5 * weights[sub_step];
+                if (!last_sub_step) {
+                    var += 0.5 * weights[(sub_step + 1) % sub_steps];
+                }
+                kernel->rabi_coupling(var, delta_t);
+                kernel->normalization();
             }
-            kernel->wait_for_completion();
-            if (i == iterations - 1) {
-                var = 0.5;
-            }
-            kernel->rabi_coupling(var, delta_t);
-            kernel->normalization();
         }
         kernel->cpy_first_positive_to_first_negative(); //only for cylindrical coordinates
-        current_evolution_time += delta_t;
+        current_evolution_time += delta_t * steps;
     }
     if (!soft_update) {
         if (single_component) {
@@ -243,6 +517,345 @@ void Solver::evolve(int iterations, bool _imag_time) {
     energy_expected_values_updated = false;
 }
 
+void Solver::set_delta_t(double _delta_t) {
+    if (_delta_t <= 0.) {
+        my_abort("The time step must be positive.");
+    }
+    delta_t = _delta_t;
+    if (kernel == NULL || has_parameters_changed || kernel_type == "gpu") {
+        has_parameters_changed = true;
+        return;
+    }
+    if (kernel_type == "chebyshev") {
+        kernel->set_time_step(delta_t);
+        return;
+    }
+    if (is_python && !imag_time) {
+        my_abort("Changing the time step needs the solver to compute the evolution operator of the potential.");
+    }
+    // The kernel keeps its buffers and only retabulates its coefficients
+    initialize_exp_potentials(0);
+    kernel->update_potential(external_pot_real[0], external_pot_imag[0], 0);
+    if (!single_component) {
+        initialize_exp_potentials(1);
+        kernel->update_potential(external_pot_real[1], external_pot_imag[1], 1);
+    }
+    kernel->set_time_step(delta_t);
+}
+
+double Solver::get_delta_t(void) {
+    return delta_t;
+}
+
+/**
+ * Return the squared norm of the difference between the normalized wave
+ * functions and the snapshot, and store the wave functions in the snapshot.
+ * The snapshot holds the real and imaginary parts of each component.
+ */
+double Solver::update_snapshot(double *snapshot) {
+    int tile_width = grid->end_x - grid->start_x;
+    size_t tile_size = grid->dim_x * grid->dim_y;
+    State *states[2] = {state, state_b};
+    double sums[2] = {0., 0.};    // squared norms of the difference and of the state
+    for (int k = 0; k < (single_component ? 1 : 2); k++) {
+        double *p_real = states[k]->p_real;
+        double *p_imag = states[k]->p_imag;
+        double *old_real = snapshot + 2 * k * tile_size;
+        double *old_imag = old_real + tile_size;
+        double sum_difference = 0., sum_norm2 = 0.;
+        #pragma omp parallel for reduction(+:sum_difference,sum_norm2)
+        for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
+            for (int j = grid->inner_start_x - grid->start_x; j < grid->inner_end_x - grid->start_x; ++j) {
+                size_t index = i * tile_width + j;
+                double delta_real = p_real[index] - old_real[index];
+                double delta_imag = p_imag[index] - old_imag[index];
+                sum_difference += delta_real * delta_real + delta_imag * delta_imag;
+                sum_norm2 += p_real[index] * p_real[index] + p_imag[index] * p_imag[index];
+                old_real[index] = p_real[index];
+                old_imag[index] = p_imag[index];
+            }
+        }
+        sums[0] += sum_difference;
+        sums[1] += sum_norm2;
+    }
+#ifdef HAVE_MPI
+    double *sums_mpi = new double[2 * grid->mpi_procs];
+    MPI_Allgather(sums, 2, MPI_DOUBLE, sums_mpi, 2, MPI_DOUBLE, grid->cartcomm);
+    sums[0] = sums[1] = 0.;
+    for(int i = 0; i < grid->mpi_procs; i++) {
+        sums[0] += sums_mpi[2 * i];
+        sums[1] += sums_mpi[2 * i + 1];
+    }
+    delete [] sums_mpi;
+#endif
+    return sums[1] > 0. ? sums[0] / sums[1] : 0.;
+}
+
+/**
+ * Imaginary time evolution converges to the ground state of the Trotter
+ * splitting, whose energy differs from the exact one by an error quadratic in
+ * the time step: the time step of the solver sets the accuracy. The schedule
+ * starts from a larger time step, which relaxes the state in fewer steps, and
+ * multiplies it by time_step_factor on each level down to that of the solver.
+ * Each level evolves until the state is stationary: the relative change of the
+ * energy over check_steps is below the tolerance, and so is the squared
+ * residual norm, estimated by the change of the normalized wave function over
+ * the imaginary time evolved, since d(psi)/d(tau) = -(H - E) psi. The larger
+ * time steps only need to bring the state close to the ground state, with the
+ * square root of the tolerance, and can be unstable with a strong
+ * nonlinearity: their level also ends as soon as the energy rises.
+ */
+int Solver::find_ground_state(double tolerance, int max_iterations, int check_steps,
+                              int time_step_levels, double time_step_factor) {
+    if (tolerance <= 0. || check_steps < 1 || time_step_levels < 1) {
+        my_abort("The tolerance, the steps between two checks and the levels of the time step must be positive.");
+    }
+    if (time_step_factor <= 0. || time_step_factor > 1.) {
+        my_abort("The factor of the time step schedule must be in (0, 1].");
+    }
+    double final_delta_t = delta_t;
+    double mixed_precision = mixed_precision_tolerance;
+    mixed_precision_tolerance = 0.;
+    if (time_step_levels > 1) {
+        set_delta_t(final_delta_t / pow(time_step_factor, time_step_levels - 1));
+    }
+    size_t tile_size = grid->dim_x * grid->dim_y;
+    double *snapshot = new double[(single_component ? 2 : 4) * tile_size];
+    update_snapshot(snapshot);
+    double energy = get_total_energy();
+    int level = 1;
+    bool converged = false;
+    int done = 0;
+    while (done < max_iterations) {
+        int steps = min(check_steps, max_iterations - done);
+        evolve(steps, true);
+        done += steps;
+        double previous_energy = energy;
+        energy = get_total_energy();
+        double residual2 = update_snapshot(snapshot) / (steps * delta_t * steps * delta_t);
+        double level_tolerance = level == time_step_levels ? tolerance : sqrt(tolerance);
+        bool stationary = fabs(energy - previous_energy) <= level_tolerance * fabs(energy) &&
+                          residual2 <= level_tolerance * energy * energy;
+        if (stationary && level == time_step_levels) {
+            converged = true;
+            break;
+        }
+        // A rising energy tells that the time step is too large to relax the state
+        if (level == time_step_levels || (!stationary && energy <= previous_energy)) {
+            continue;
+        }
+        ++level;
+        set_delta_t(level == time_step_levels ? final_delta_t : delta_t * time_step_factor);
+    }
+    delete [] snapshot;
+    mixed_precision_tolerance = mixed_precision;
+    if (delta_t != final_delta_t) {
+        set_delta_t(final_delta_t);
+    }
+    return converged ? done : -done;
+}
+
+/**
+ * Each coarser level halves the dimensions of the lattice, keeping its
+ * physical size and boundary conditions; each level creates its own lattice,
+ * and thereby its own MPI decomposition. The coarsest level starts from the
+ * average of the initial state over its cells, every finer level from the
+ * bilinear interpolation of the ground state of the coarser one, rescaled to
+ * the initial norms, which is already close to its ground state: only the
+ * coarsest level descends the schedule of the time step. The time step of a
+ * level grows with the square of its lattice spacing, four times per level,
+ * which keeps the kinetic step of a pair of dots the same on every level. The
+ * coarser levels only approximate the ground state of the lattice of the
+ * solver, up to their discretization error, so they stop at the square root
+ * of the tolerance. The Hamiltonian and its potentials are re-evaluated on
+ * each level, then restored on the lattice of the solver.
+ */
+int Solver::find_ground_state_multilevel(int levels, double tolerance, int max_iterations, int check_steps,
+                                         int time_step_levels, double time_step_factor) {
+    if (levels < 1) {
+        my_abort("The number of levels must be positive.");
+    }
+    int scale = 1 << (levels - 1);
+    if (levels > 1 && (grid->coordinate_system != "cartesian" || grid->global_no_halo_dim_y == 1)) {
+        my_abort("The multilevel ground state needs a 2D lattice in cartesian coordinates.");
+    }
+    if (grid->global_no_halo_dim_x % scale != 0 || grid->global_no_halo_dim_y % scale != 0) {
+        my_abort("The dimensions of the lattice must be divisible by 2^(levels - 1).");
+    }
+    int components = single_component ? 1 : 2;
+    State *states[2] = {state, state_b};
+    double norms[2];
+    for (int k = 0; k < components; k++) {
+        norms[k] = states[k]->get_squared_norm();
+    }
+    Lattice2D *coarse_grid = NULL;
+    State *coarse_states[2] = {NULL, NULL};
+    coarse_iterations = 0;
+    for (int level = levels - 1; level > 0; --level) {
+        Lattice2D *level_grid = new Lattice2D(grid->global_no_halo_dim_x >> level, grid->length_x,
+                                              grid->global_no_halo_dim_y >> level, grid->length_y,
+                                              grid->periods[1], grid->periods[0], hamiltonian->angular_velocity,
+                                              grid->coordinate_system, grid->steps_per_block, grid->kinetic_order);
+        State *level_states[2] = {NULL, NULL};
+        for (int k = 0; k < components; k++) {
+            level_states[k] = new State(level_grid, states[k]->angular_momentum);
+            if (coarse_grid == NULL) {
+                restrict_lattice(grid, states[k]->p_real, level_grid, level_states[k]->p_real);
+                restrict_lattice(grid, states[k]->p_imag, level_grid, level_states[k]->p_imag);
+            }
+            else {
+                prolong_lattice(coarse_grid, coarse_states[k]->p_real, level_grid, level_states[k]->p_real);
+                prolong_lattice(coarse_grid, coarse_states[k]->p_imag, level_grid, level_states[k]->p_imag);
+                delete coarse_states[k];
+            }
+            rescale_state(level_states[k], norms[k]);
+        }
+        delete_level_lattice(coarse_grid);
+        hamiltonian->set_lattice(level_grid);
+        double level_delta_t = delta_t * (1 << (2 * level));
+        Solver *level_solver;
+        if (single_component) {
+            level_solver = new Solver(level_grid, level_states[0], hamiltonian, level_delta_t, kernel_type);
+        }
+        else {
+            level_solver = new Solver(level_grid, level_states[0], level_states[1],
+                                      static_cast<Hamiltonian2Component*>(hamiltonian), level_delta_t, kernel_type);
+        }
+        level_solver->set_sincos_accuracy(sincos_accuracy);
+        level_solver->set_in_place(in_place);
+        coarse_iterations += abs(level_solver->find_ground_state(sqrt(tolerance), max_iterations, check_steps,
+                                                                 level == levels - 1 ? time_step_levels : 1, time_step_factor));
+        delete level_solver;
+        hamiltonian->set_lattice(grid);
+        coarse_grid = level_grid;
+        coarse_states[0] = level_states[0];
+        coarse_states[1] = level_states[1];
+    }
+    if (coarse_grid != NULL) {
+        for (int k = 0; k < components; k++) {
+            prolong_lattice(coarse_grid, coarse_states[k]->p_real, grid, states[k]->p_real);
+            prolong_lattice(coarse_grid, coarse_states[k]->p_imag, grid, states[k]->p_imag);
+            delete coarse_states[k];
+            rescale_state(states[k], norms[k]);
+        }
+        delete_level_lattice(coarse_grid);
+        // The kernel may hold the previous state in its own buffers
+        has_parameters_changed = true;
+        energy_expected_values_updated = false;
+    }
+    return find_ground_state(tolerance, max_iterations, check_steps,
+                             levels == 1 ? time_step_levels : 1, time_step_factor);
+}
+
+int Solver::get_coarse_iterations(void) {
+    return coarse_iterations;
+}
+
+/**
+ * The minimizer works on the states themselves, with the Hamiltonian
+ * discretized as in the energy; the kernel is rebuilt from the states by the
+ * next evolution.
+ */
+int Solver::minimize_energy(double tolerance, int max_iterations, int preconditioner_steps) {
+    if (tolerance <= 0. || max_iterations < 0 || preconditioner_steps < 0) {
+        my_abort("The tolerance must be positive, the iterations and the steps of the preconditioner nonnegative.");
+    }
+    if (grid->coordinate_system != "cartesian") {
+        my_abort("The energy minimizer needs a lattice in cartesian coordinates.");
+    }
+    EnergyMinimizer minimizer(grid, state, single_component ? NULL : state_b, hamiltonian, preconditioner_steps);
+    int iterations = minimizer.minimize(tolerance, max_iterations);
+    energy_expected_values_updated = false;
+    has_parameters_changed = true;
+    return iterations;
+}
+
+/**
+ * The energies are checked, and the states rotated to the eigenstates of the
+ * Hamiltonian within the block, every check_steps time steps; in between,
+ * the block is only orthonormalized. The exponentials of the potential are
+ * those of imaginary time, in buffers of their own: the solver keeps its
+ * kernel and its evolution operators.
+ */
+int Solver::find_eigenstates(vector<State*> &states, vector<double> &energies, double tolerance, int max_iterations,
+                             int orthogonalization_steps, int check_steps) {
+    int count = states.size();
+    if (count < 1) {
+        my_abort("The block of states is empty.");
+    }
+    if (tolerance <= 0. || orthogonalization_steps < 1 || check_steps < 1) {
+        my_abort("The tolerance and the steps between two orthonormalizations and two checks must be positive.");
+    }
+    if (!single_component || kernel_type == "gpu" || grid->coordinate_system != "cartesian") {
+        my_abort("The block eigenstates need a single-component system in cartesian coordinates and a CPU kernel.");
+    }
+    // The rotation term of imaginary time evolution has the opposite sign of that of the energy
+    if (hamiltonian->coupling_a != 0. || hamiltonian->LeeHuangYang_coupling_a != 0. || hamiltonian->angular_velocity != 0.) {
+        my_abort("The block eigenstates need a linear Hamiltonian without rotation.");
+    }
+    for (int k = 0; k < count; k++) {
+        if (states[k]->grid != grid) {
+            my_abort("The states of the block must be on the lattice of the solver.");
+        }
+    }
+    size_t tile_size = grid->dim_x * grid->dim_y;
+    double *pot_real = new double[tile_size];
+    double *pot_imag = new double[tile_size];
+    bool solver_imag_time = imag_time;
+    imag_time = true;
+    initialize_exp_potential(delta_t, 0, pot_real, pot_imag);
+    imag_time = solver_imag_time;
+
+    EigenstateBlock block(grid, states, hamiltonian, pot_real, pot_imag, delta_t);
+    double *energy = new double[count];
+    double *previous_energy = new double[count];
+    block.rotate_to_eigenstates(energy);
+    bool converged = false;
+    int done = 0;
+    while (done < max_iterations && !converged) {
+        int check = min(check_steps, max_iterations - done);
+        for (int i = 0; i < check; i += orthogonalization_steps) {
+            block.evolve(min(orthogonalization_steps, check - i));
+            block.orthonormalize();
+        }
+        done += check;
+        for (int k = 0; k < count; k++) {
+            previous_energy[k] = energy[k];
+        }
+        block.rotate_to_eigenstates(energy);
+        converged = true;
+        for (int k = 0; k < count; k++) {
+            converged = converged && fabs(energy[k] - previous_energy[k]) <= tolerance * fabs(energy[k]);
+        }
+    }
+    energies.assign(energy, energy + count);
+    delete [] energy;
+    delete [] previous_energy;
+    delete [] pot_real;
+    delete [] pot_imag;
+    return converged ? done : -done;
+}
+
+void Solver::delete_level_lattice(Lattice2D *level_grid) {
+    if (level_grid == NULL) {
+        return;
+    }
+#ifdef HAVE_MPI
+    MPI_Comm_free(&level_grid->cartcomm);
+#endif
+    delete level_grid;
+}
+
+void Solver::rescale_state(State *level_state, double norm2) {
+    level_state->expected_values_updated = false;
+    double factor = sqrt(norm2 / level_state->get_squared_norm());
+    for (int i = 0; i < level_state->grid->dim_x * level_state->grid->dim_y; i++) {
+        level_state->p_real[i] *= factor;
+        level_state->p_imag[i] *= factor;
+    }
+    level_state->expected_values_updated = false;
+}
+
 void Solver::calculate_energy_expected_values(void) {
 
     double delta_x = grid->delta_x;
@@ -302,7 +915,6 @@ void Solver::calculate_energy_expected_values(void) {
     complex<double> derivate1_1 = 1. / 6., derivate1_2 = - 1., derivate1_3 = 0.5, derivate1_4 = 1. / 3.;
     int xlim = (grid->coordinate_system == "cylindrical" ? 3 : 0);
 
-#ifndef HAVE_MPI
     #pragma omp parallel for reduction(+:sum_norm2_0,\
     sum_norm2_kin0,\
     sum_potential_energy_0,\
@@ -318,7 +930,6 @@ void Solver::calculate_energy_expected_values(void) {
     sum_intra_species_energy_1,\
     sum_kinetic_energy_1,\
     sum_rotational_energy_1) private(x,y)
-#endif
     for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
     complex<double> psi_up, psi_down, psi_center, psi_left, psi_right;
     complex<double> psi_up_b, psi_down_b, psi_center_b, psi_left_b, psi_right_b;
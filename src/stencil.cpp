@@ -0,0 +1,274 @@
+/**
+ * Massively Parallel Trotter-Suzuki Solver
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "common.h"
+#include "kernel.h"
+#include <cmath>
+#include <algorithm>
+
+// Coefficients of the fourth order stencils: second derivative, from the
+// center outwards, and first derivative, at distance one and two
+#define LAPLACIAN_0 (-2.5)
+#define LAPLACIAN_1 (4. / 3.)
+#define LAPLACIAN_2 (-1. / 12.)
+#define DERIVATIVE_1 (2. / 3.)
+#define DERIVATIVE_2 (-1. / 12.)
+
+// Value of a row at column j, zero beyond the edges of the tile, which are closed boundaries
+static inline double at(const double *row, int j, int width) {
+    return j >= 0 && j < width ? row[j] : 0.;
+}
+
+StencilHamiltonian::StencilHamiltonian(Lattice *_grid, Hamiltonian *hamiltonian, bool two_components): grid(_grid) {
+    if (grid->coordinate_system != "cartesian") {
+        my_abort("The stencil of the Hamiltonian needs cartesian coordinates.");
+    }
+    tile_width = grid->end_x - grid->start_x;
+    tile_height = grid->end_y - grid->start_y;
+    two_dimensional = grid->global_no_halo_dim_y > 1;
+    angular_velocity = hamiltonian->angular_velocity;
+    mass[0] = mass[1] = hamiltonian->mass;
+    Potential *potentials[2] = {hamiltonian->potential, NULL};
+    if (two_components) {
+        Hamiltonian2Component *hamiltonian2 = static_cast<Hamiltonian2Component *>(hamiltonian);
+        mass[1] = hamiltonian2->mass_b;
+        potentials[1] = hamiltonian2->potential_b;
+    }
+    for (int k = 0; k < 2; k++) {
+        potential[k] = NULL;
+        if (potentials[k] == NULL) {
+            continue;
+        }
+        potential[k] = new double[tile_width * tile_height];
+        for (int i = 0; i < tile_height; i++) {
+            for (int j = 0; j < tile_width; j++) {
+                potential[k][i * tile_width + j] = potentials[k]->get_value(j, i);
+            }
+        }
+    }
+    coordinate_x = new double[tile_width];
+    coordinate_y = new double[tile_height];
+    for (int i = 0; i < tile_height; i++) {
+        for (int j = 0; j < tile_width; j++) {
+            map_lattice_to_coordinate_space(grid, j, i, &coordinate_x[j], &coordinate_y[i]);
+        }
+    }
+    zeros = new double[tile_width];
+    for (int j = 0; j < tile_width; j++) {
+        zeros[j] = 0.;
+    }
+
+#ifdef HAVE_MPI
+    MPI_Cart_shift(grid->cartcomm, 0, 1, &neighbors[UP], &neighbors[DOWN]);
+    MPI_Cart_shift(grid->cartcomm, 1, 1, &neighbors[LEFT], &neighbors[RIGHT]);
+    MPI_Type_vector(grid->inner_end_y - grid->inner_start_y, grid->halo_x, tile_width, MPI_DOUBLE, &verticalBorder);
+    MPI_Type_commit(&verticalBorder);
+    MPI_Type_vector(grid->halo_y, tile_width, tile_width, MPI_DOUBLE, &horizontalBorder);
+    MPI_Type_commit(&horizontalBorder);
+#endif
+}
+
+StencilHamiltonian::~StencilHamiltonian() {
+    delete [] potential[0];
+    delete [] potential[1];
+    delete [] coordinate_x;
+    delete [] coordinate_y;
+    delete [] zeros;
+#ifdef HAVE_MPI
+    MPI_Type_free(&verticalBorder);
+    MPI_Type_free(&horizontalBorder);
+#endif
+}
+
+/**
+ * Same pattern as the halo exchange of the CPU kernel: the inner rows of the
+ * vertical halos first, then the full rows of the horizontal ones, which
+ * carry the corners.
+ */
+void StencilHamiltonian::exchange_halos(double *p_real, double *p_imag) {
+    int halo_x = grid->halo_x;
+    int halo_y = grid->halo_y;
+    int first_row = (grid->inner_start_y - grid->start_y) * tile_width;
+    double *buffers[2] = {p_real, p_imag};
+#ifdef HAVE_MPI
+    MPI_Request req[8];
+    MPI_Status statuses[8];
+    for (int k = 0; k < 2; k++) {
+        double *p = buffers[k];
+        MPI_Irecv(p + first_row, 1, verticalBorder, neighbors[LEFT], 1 + 2 * k, grid->cartcomm, req + 4 * k);
+        MPI_Irecv(p + first_row + grid->inner_end_x - grid->start_x, 1, verticalBorder, neighbors[RIGHT], 2 + 2 * k, grid->cartcomm, req + 4 * k + 1);
+        MPI_Isend(p + first_row + grid->inner_end_x - halo_x - grid->start_x, 1, verticalBorder, neighbors[RIGHT], 1 + 2 * k, grid->cartcomm, req + 4 * k + 2);
+        MPI_Isend(p + first_row + halo_x, 1, verticalBorder, neighbors[LEFT], 2 + 2 * k, grid->cartcomm, req + 4 * k + 3);
+    }
+    MPI_Waitall(8, req, statuses);
+    for (int k = 0; k < 2; k++) {
+        double *p = buffers[k];
+        MPI_Irecv(p, 1, horizontalBorder, neighbors[UP], 1 + 2 * k, grid->cartcomm, req + 4 * k);
+        MPI_Irecv(p + (grid->inner_end_y - grid->start_y) * tile_width, 1, horizontalBorder, neighbors[DOWN], 2 + 2 * k, grid->cartcomm, req + 4 * k + 1);
+        MPI_Isend(p + (grid->inner_end_y - halo_y - grid->start_y) * tile_width, 1, horizontalBorder, neighbors[DOWN], 1 + 2 * k, grid->cartcomm, req + 4 * k + 2);
+        MPI_Isend(p + halo_y * tile_width, 1, horizontalBorder, neighbors[UP], 2 + 2 * k, grid->cartcomm, req + 4 * k + 3);
+    }
+    MPI_Waitall(8, req, statuses);
+#else
+    int rows = grid->inner_end_y - grid->inner_start_y;
+    for (int k = 0; k < 2; k++) {
+        double *p = buffers[k];
+        if (grid->periods[1] != 0) {
+            memcpy2D(p + first_row, tile_width * sizeof(double), p + first_row + tile_width - 2 * halo_x, tile_width * sizeof(double), halo_x * sizeof(double), rows);
+            memcpy2D(p + first_row + tile_width - halo_x, tile_width * sizeof(double), p + first_row + halo_x, tile_width * sizeof(double), halo_x * sizeof(double), rows);
+        }
+        if (grid->periods[0] != 0) {
+            int last_row = (grid->inner_end_y - grid->start_y) * tile_width;
+            memcpy2D(p, tile_width * sizeof(double), p + last_row - halo_y * tile_width, tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+            memcpy2D(p + last_row, tile_width * sizeof(double), p + halo_y * tile_width, tile_width * sizeof(double), tile_width * sizeof(double), halo_y);
+        }
+    }
+#endif
+}
+
+double StencilHamiltonian::squared_norm(const double *p_real, const double *p_imag, bool global) const {
+    double norm2 = 0.;
+    #pragma omp parallel for reduction(+:norm2)
+    for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
+        for (int j = grid->inner_start_x - grid->start_x; j < grid->inner_end_x - grid->start_x; ++j) {
+            size_t index = i * tile_width + j;
+            norm2 += p_real[index] * p_real[index] + p_imag[index] * p_imag[index];
+        }
+    }
+#ifdef HAVE_MPI
+    if (global) {
+        MPI_Allreduce(MPI_IN_PLACE, &norm2, 1, MPI_DOUBLE, MPI_SUM, grid->cartcomm);
+    }
+#endif
+    return norm2 * grid->delta_x * grid->delta_y;
+}
+
+void StencilHamiltonian::normalize(double *p_real, double *p_imag, double norm) const {
+    double scale = sqrt(norm / squared_norm(p_real, p_imag, true));
+    #pragma omp parallel for
+    for (int i = 0; i < tile_height; ++i) {
+        for (int j = 0; j < tile_width; ++j) {
+            size_t index = i * tile_width + j;
+            p_real[index] *= scale;
+            p_imag[index] *= scale;
+        }
+    }
+}
+
+void StencilHamiltonian::get_sample(const double *p_real, const double *p_imag, size_t dest_stride, size_t x, size_t y, size_t width, size_t height, double *dest_real, double *dest_imag) const {
+    memcpy2D(dest_real, dest_stride * sizeof(double), &p_real[y * tile_width + x], tile_width * sizeof(double), width * sizeof(double), height);
+    memcpy2D(dest_imag, dest_stride * sizeof(double), &p_imag[y * tile_width + x], tile_width * sizeof(double), width * sizeof(double), height);
+}
+
+/**
+ * The rotation term is i Omega (y d/dx - x d/dy), the sign convention of the
+ * rotational energy of the Solver, with the first derivatives centered so
+ * that the discrete operator is Hermitian.
+ */
+double StencilHamiltonian::apply(int component, const double *p_real, const double *p_imag,
+                                 double *h_real, double *h_imag, bool kinetic_only) const {
+    double cost_x = -1. / (2. * mass[component] * grid->delta_x * grid->delta_x);
+    double cost_y = two_dimensional ? -1. / (2. * mass[component] * grid->delta_y * grid->delta_y) : 0.;
+    double rot_x = kinetic_only || !two_dimensional ? 0. : angular_velocity / grid->delta_x;
+    double rot_y = kinetic_only || !two_dimensional ? 0. : angular_velocity / grid->delta_y;
+    const double *pot = kinetic_only ? NULL : potential[component];
+    int inner_x = grid->inner_start_x - grid->start_x;
+    int inner_end_x = grid->inner_end_x - grid->start_x;
+    double kinetic = 0.;
+
+    #pragma omp parallel for reduction(+:kinetic)
+    for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
+        // Rows i - 2, ..., i + 2; zeros beyond closed boundaries, and along y for 1D chains
+        const double *rows_real[5], *rows_imag[5];
+        for (int k = -2; k <= 2; k++) {
+            bool inside = i + k >= 0 && i + k < tile_height && (k == 0 || two_dimensional);
+            rows_real[k + 2] = inside ? p_real + (i + k) * tile_width : zeros;
+            rows_imag[k + 2] = inside ? p_imag + (i + k) * tile_width : zeros;
+        }
+        const double *re = rows_real[2], *im = rows_imag[2];
+        double y = coordinate_y[i];
+        for (int j = inner_x; j < inner_end_x; ++j) {
+            double lap_real = cost_x * (LAPLACIAN_0 * re[j] + LAPLACIAN_1 * (at(re, j - 1, tile_width) + at(re, j + 1, tile_width)) +
+                                        LAPLACIAN_2 * (at(re, j - 2, tile_width) + at(re, j + 2, tile_width))) +
+                              cost_y * (LAPLACIAN_0 * re[j] + LAPLACIAN_1 * (rows_real[1][j] + rows_real[3][j]) +
+                                        LAPLACIAN_2 * (rows_real[0][j] + rows_real[4][j]));
+            double lap_imag = cost_x * (LAPLACIAN_0 * im[j] + LAPLACIAN_1 * (at(im, j - 1, tile_width) + at(im, j + 1, tile_width)) +
+                                        LAPLACIAN_2 * (at(im, j - 2, tile_width) + at(im, j + 2, tile_width))) +
+                              cost_y * (LAPLACIAN_0 * im[j] + LAPLACIAN_1 * (rows_imag[1][j] + rows_imag[3][j]) +
+                                        LAPLACIAN_2 * (rows_imag[0][j] + rows_imag[4][j]));
+            kinetic += re[j] * lap_real + im[j] * lap_imag;
+            size_t index = i * tile_width + j;
+            h_real[index] = lap_real;
+            h_imag[index] = lap_imag;
+            if (pot != NULL) {
+                h_real[index] += pot[index] * re[j];
+                h_imag[index] += pot[index] * im[j];
+            }
+            if (rot_x != 0.) {
+                double dx_real = DERIVATIVE_1 * (at(re, j + 1, tile_width) - at(re, j - 1, tile_width)) +
+                                 DERIVATIVE_2 * (at(re, j + 2, tile_width) - at(re, j - 2, tile_width));
+                double dx_imag = DERIVATIVE_1 * (at(im, j + 1, tile_width) - at(im, j - 1, tile_width)) +
+                                 DERIVATIVE_2 * (at(im, j + 2, tile_width) - at(im, j - 2, tile_width));
+                double dy_real = DERIVATIVE_1 * (rows_real[3][j] - rows_real[1][j]) + DERIVATIVE_2 * (rows_real[4][j] - rows_real[0][j]);
+                double dy_imag = DERIVATIVE_1 * (rows_imag[3][j] - rows_imag[1][j]) + DERIVATIVE_2 * (rows_imag[4][j] - rows_imag[0][j]);
+                double x = coordinate_x[j];
+                h_real[index] -= y * rot_x * dx_imag - x * rot_y * dy_imag;
+                h_imag[index] += y * rot_x * dx_real - x * rot_y * dy_real;
+            }
+        }
+    }
+    return kinetic;
+}
+
+double StencilHamiltonian::get_kinetic_bound(int component) const {
+    // The symbol of the five point stencil peaks at the highest wave number
+    double bound = 16. / 3. / (2. * mass[component] * grid->delta_x * grid->delta_x);
+    if (two_dimensional) {
+        bound += 16. / 3. / (2. * mass[component] * grid->delta_y * grid->delta_y);
+    }
+    return bound;
+}
+
+/**
+ * The kinetic term lies within [0, get_kinetic_bound()], the potential
+ * between its extrema, and the rotation term within the largest coordinates
+ * times the norm of the first derivative stencil, at most 3/2 over the
+ * lattice spacing.
+ */
+void StencilHamiltonian::get_spectral_bounds(int component, double *lower, double *upper) const {
+    // Opposite of the minimum and maximum of the potential, largest |x| and |y|
+    double extrema[4] = {-DBL_MAX, -DBL_MAX, 0., 0.};
+    for (int i = grid->inner_start_y - grid->start_y; i < grid->inner_end_y - grid->start_y; ++i) {
+        for (int j = grid->inner_start_x - grid->start_x; j < grid->inner_end_x - grid->start_x; ++j) {
+            double value = potential[component][i * tile_width + j];
+            extrema[0] = max(extrema[0], -value);
+            extrema[1] = max(extrema[1], value);
+            extrema[2] = max(extrema[2], fabs(coordinate_x[j]));
+        }
+        extrema[3] = max(extrema[3], fabs(coordinate_y[i]));
+    }
+#ifdef HAVE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, extrema, 4, MPI_DOUBLE, MPI_MAX, grid->cartcomm);
+#endif
+    double rotation = 0.;
+    if (two_dimensional) {
+        rotation = 1.5 * fabs(angular_velocity) * (extrema[3] / grid->delta_x + extrema[2] / grid->delta_y);
+    }
+    *lower = -extrema[0] - rotation;
+    *upper = extrema[1] + get_kinetic_bound(component) + rotation;
+}
@@ -19,6 +19,7 @@
 #define __TROTTERSUZUKI_H
 
 #include <string>
+#include <vector>
 #define _USE_MATH_DEFINES
 #include <cfloat>
 #include <complex>
@@ -45,6 +46,8 @@ public:
 
     // Computational topology
     int halo_x, halo_y;    ///< Halo length along the x and y halos.
+    int steps_per_block;    ///< Number of time steps applied to a cached block of the lattice before it is written back (temporal blocking).
+    int kinetic_order;    ///< Order of the finite differences of the kinetic term in the CPU kernels (2 or 4).
     int start_x, start_y;    ///< Spatial coordinates (not physical) of the first element of the tile.
     int end_x, end_y;    ///< Spatial coordinates (not physical) of the last element of the tile.
     int inner_start_x, inner_start_y;    ///< Spatial coordinates (not physical) of the first element of the tile, excluding the eventual surrounding halo.
@@ -70,8 +73,9 @@ public:
         @param [in] length            Physical length of the lattice.
         @param [in] periodic_x_axis   Boundary condition along the x axis (false=closed, true=periodic).
         @param [in] coordinate_system Type of the coordinate system used.
+        @param [in] kinetic_order     Order of the finite differences of the kinetic term in the CPU kernels: 2 or 4 (cartesian only, wider halos).
      */
-    Lattice1D(int dim, double length, bool periodic_x_axis = false, string coordinate_system = "cartesian");
+    Lattice1D(int dim, double length, bool periodic_x_axis = false, string coordinate_system = "cartesian", int kinetic_order = 2);
 };
 
 /**
@@ -91,10 +95,13 @@ public:
         @param [in] periodic_y_axis   Boundary condition along the y axis (false=closed, true=periodic).
         @param [in] angular_velocity  Angular velocity of the frame of reference.
         @param [in] coordinate_system Type of the coordinate system used.
+        @param [in] steps_per_block   Number of time steps evolved on a cached block between two halo exchanges; the halos grow accordingly. Above 1, the solver needs a single component, a static potential and the splitting of order 2, and in imaginary time a linear Hamiltonian in cartesian coordinates.
+        @param [in] kinetic_order     Order of the finite differences of the kinetic term in the CPU kernels: 2 or 4 (cartesian only, three times wider halos).
      */
     Lattice2D(int dim, double length,
               bool periodic_x_axis = false, bool periodic_y_axis = false,
-              double angular_velocity = 0., string coordinate_system = "cartesian");
+              double angular_velocity = 0., string coordinate_system = "cartesian",
+              int steps_per_block = 1, int kinetic_order = 2);
     /**
         Lattice constructor.
 
@@ -106,14 +113,18 @@ public:
         @param [in] periodic_y_axis   Boundary condition along the y axis (false=closed, true=periodic).
         @param [in] angular_velocity  Angular velocity of the frame of reference.
         @param [in] coordinate_system Type of the coordinate system used.
+        @param [in] steps_per_block   Number of time steps evolved on a cached block between two halo exchanges; the halos grow accordingly. Above 1, the solver needs a single component, a static potential and the splitting of order 2, and in imaginary time a linear Hamiltonian in cartesian coordinates.
+        @param [in] kinetic_order     Order of the finite differences of the kinetic term in the CPU kernels: 2 or 4 (cartesian only, three times wider halos).
      */
     Lattice2D(int dim_x, double length_x, int dim_y, double length_y,
               bool periodic_x_axis = false, bool periodic_y_axis = false,
-              double angular_velocity = 0., string coordinate_system = "cartesian");
+              double angular_velocity = 0., string coordinate_system = "cartesian",
+              int steps_per_block = 1, int kinetic_order = 2);
 private:
     void init(int dim_x, double length_x, int dim_y, double length_y,
               bool periodic_x_axis = false, bool periodic_y_axis = false,
-              double angular_velocity = 0., string coordinate_system = "cartesian");
+              double angular_velocity = 0., string coordinate_system = "cartesian",
+              int steps_per_block = 1, int kinetic_order = 2);
 };
 
 /**
@@ -381,6 +392,8 @@ public:
     virtual double get_value(int x); ///< Get the value at the coordinate x in a 1D model.
     virtual double get_value(int x, int y);    ///< Get the value at the coordinate (x,y) in a 2D model.
     bool update(double t);    ///< Update the potential matrix at time t.
+    bool depends_on_time() const;    ///< Whether the potential can change during the evolution.
+    void set_lattice(Lattice *grid);    ///< Evaluate the potential on another lattice of the same physical size; a matrix is averaged onto coarser lattices.
     bool updated_potential_matrix;
 protected:
     double current_evolution_time;    ///< Amount of time evolved since the beginning of the evolution.
@@ -388,6 +401,9 @@ protected:
     double (*evolving_potential)(double x, double y, double t);    ///< Function of the time-dependent external potential.
     bool self_init;    ///< Whether the external potential matrix has been initialized from the Potential constructor or not.
     bool is_static;    ///< Whether the external potential is static or time-dependent.
+    Lattice *matrix_grid;    ///< Lattice the matrix was given on, once the potential is evaluated on another lattice.
+    double *lattice_matrix;    ///< Matrix given on matrix_grid.
+    double *level_matrix;    ///< Matrix averaged onto the current lattice, when coarser than matrix_grid.
 };
 
 /**
@@ -447,6 +463,7 @@ public:
                 double angular_velocity = 0.,
                 double rot_coord_x = 0, double rot_coord_y = 0);
     ~Hamiltonian();
+    virtual void set_lattice(Lattice *grid);    ///< Evaluate the Hamiltonian and its potentials on another lattice of the same physical size.
 
 protected:
     bool self_init;    ///< Whether the potential is initialized in the Hamiltonian constructor or not.
@@ -494,6 +511,7 @@ public:
                           double rot_coord_x = 0,
                           double rot_coord_y = 0);
     ~Hamiltonian2Component();
+    void set_lattice(Lattice *grid);    ///< Evaluate the Hamiltonian and the potentials of both components on another lattice of the same physical size.
 };
 
 /**
@@ -513,6 +531,9 @@ public:
     virtual string get_name() const = 0;				///< Get kernel name.
     virtual void update_potential(double *_external_pot_real, double *_external_pot_imag, int which) = 0;    ///< Update the evolution matrix, regarding the external potential, at time t.
     virtual void cpy_first_positive_to_first_negative() = 0;    ///< Copy first points with positive radial coordinates to first points with negative coordinates.
+    virtual void set_steps_per_call(int steps) = 0;    ///< Set how many time steps the next calls to run_kernel_on_halo() and run_kernel() evolve (temporal blocking).
+    virtual void set_time_step(double delta_t) = 0;    ///< Set the time step of the next calls to run_kernel_on_halo() and run_kernel() (sub-steps of the higher order splittings).
+    virtual size_t get_allocation_count() const = 0;    ///< Get the number of buffers the kernel allocated on the heap since its construction.
 
     virtual void start_halo_exchange() = 0;					///< Exchange halos between processes.
     virtual void finish_halo_exchange() = 0;				///< Exchange halos between processes.
@@ -536,7 +557,7 @@ public:
     	@param [in] state               State of the system.
     	@param [in] hamiltonian         Hamiltonian of the system.
     	@param [in] delta_t             A single evolution iteration, evolves the state for this time.
-    	@param [in] kernel_type         Which kernel to use (either cpu or gpu).
+    	@param [in] kernel_type         Which kernel to use (cpu, cpu-auto, cpu-float, adi, chebyshev, fft or gpu).
      */
     Solver(Lattice *grid, State *state, Hamiltonian *hamiltonian, double delta_t,
            string kernel_type = "cpu");
@@ -548,7 +569,7 @@ public:
     	@param [in] state2              Second component's state of the system.
     	@param [in] hamiltonian         Hamiltonian of the two-component system.
     	@param [in] delta_t             A single evolution iteration, evolves the state for this time.
-    	@param [in] kernel_type         Which kernel to use (either cpu or gpu).
+    	@param [in] kernel_type         Which kernel to use (cpu, cpu-auto, cpu-float, adi, chebyshev, fft or gpu).
      */
     Solver(Lattice *grid, State *state1, State *state2,
            Hamiltonian2Component *hamiltonian,
@@ -567,6 +588,62 @@ public:
     double get_rabi_energy(void);    ///< Get the Rabi energy of the system.
     void set_exp_potential(double *real, int real_length, double *imag,
                            int imag_length, int which); ///< Set exponential potential directly from Python
+    void set_sincos_accuracy(string accuracy);    ///< Set the accuracy of the nonlinear phase in real time evolution: "double" (default, in-tree polynomial), "single" (faster polynomial) or "exact" (standard library).
+    size_t get_kernel_allocations(void);    ///< Get the number of buffers the kernel allocated on the heap; it does not change while evolving with the same parameters.
+    void set_autotune_cache(string file_name);    ///< Set the file storing the block geometries found by the cpu-auto kernel, by CPU model and tile shape (default: empty, not stored).
+    void set_in_place(bool in_place);    ///< Set whether the CPU kernel evolves the states in place, without a second buffer for each wave function (default: false).
+    void set_splitting_order(int order);    ///< Set the order of the splitting of the evolution operator in real time: 2 (default) or 4, which composes three steps of the second order one with the Yoshida weights.
+    void set_mixed_precision(double energy_tolerance);    ///< Evolve in imaginary time in single precision until the relative change of the energy every 100 steps falls below energy_tolerance, then in double precision until the parameters change (default: 0, always double); not applied with a Rabi coupling.
+    void set_delta_t(double delta_t);    ///< Set the time step of the next evolutions; the CPU kernel only rebuilds the evolution operators that depend on it.
+    double get_delta_t(void);    ///< Get the time step of the evolution.
+    /**
+        Evolve in imaginary time until the ground state is reached, shrinking the time step on a descending schedule down to that of the solver.
+
+        @param [in] tolerance           Relative change of the energy over check_steps, and relative squared residual norm, below which the state is stationary.
+        @param [in] max_iterations      Maximum number of time steps.
+        @param [in] check_steps         Time steps between two checks of the energy and of the residual norm.
+        @param [in] time_step_levels    Number of time steps of the schedule, each used until the state is stationary; the first is the time step of the solver divided by time_step_factor^(time_step_levels - 1).
+        @param [in] time_step_factor    Factor multiplying the time step from a level of the schedule to the next.
+        @return                         The number of time steps evolved, negative if the ground state was not reached within max_iterations.
+     */
+    int find_ground_state(double tolerance, int max_iterations, int check_steps = 100,
+                          int time_step_levels = 3, double time_step_factor = 0.5);
+    /**
+        Find the ground state on coarser lattices first: each level halves the dimensions of the lattice, and the ground state of a level, interpolated, is the initial state of the next finer one.
+
+        @param [in] levels              Number of levels, the lattice of the solver included; its dimensions must be divisible by 2^(levels - 1).
+        @param [in] tolerance           Tolerance of find_ground_state() on the lattice of the solver; the coarser levels stop at its square root.
+        @param [in] max_iterations      Maximum number of time steps on each level.
+        @param [in] check_steps         Time steps between two checks of the energy and of the residual norm.
+        @param [in] time_step_levels    Number of time steps of the schedule of find_ground_state() on the coarsest level.
+        @param [in] time_step_factor    Factor multiplying the time step from a level of the schedule to the next.
+        @return                         The number of time steps evolved on the lattice of the solver, negative if the ground state was not reached; get_coarse_iterations() returns those of the coarser levels.
+     */
+    int find_ground_state_multilevel(int levels, double tolerance, int max_iterations, int check_steps = 100,
+                                     int time_step_levels = 3, double time_step_factor = 0.5);
+    int get_coarse_iterations(void);    ///< Get the number of time steps evolved on the coarser levels by the last call of find_ground_state_multilevel().
+    /**
+        Find the ground state by minimizing the energy functional at fixed norms with the preconditioned nonlinear conjugate gradient (cartesian coordinates only).
+
+        @param [in] tolerance              Relative squared residual norm, |H psi - mu psi|^2 per particle over the squared energy per particle, below which the state is the ground state.
+        @param [in] max_iterations         Maximum number of iterations of the conjugate gradient.
+        @param [in] preconditioner_steps   Steps of the Chebyshev iteration approximating the inverse of the kinetic term, the preconditioner; 0 for none.
+        @return                            The number of iterations, negative if the ground state was not reached within max_iterations.
+     */
+    int minimize_energy(double tolerance, int max_iterations, int preconditioner_steps = 4);
+    /**
+        Find the lowest eigenstates of a linear single-component Hamiltonian without rotation by evolving a block of states together in imaginary time, orthonormalized against each other (cartesian coordinates only).
+
+        @param [in,out] states                   States of the block on the lattice of the solver, from the initial guesses, linearly independent, to the eigenstates, sorted by energy and normalized to one.
+        @param [out] energies                    Energies of the eigenstates, in ascending order.
+        @param [in] tolerance                    Relative change of every energy over check_steps below which the block is converged.
+        @param [in] max_iterations               Maximum number of time steps.
+        @param [in] orthogonalization_steps      Time steps between two orthonormalizations of the block.
+        @param [in] check_steps                  Time steps between two checks of the energies.
+        @return                                  The number of time steps evolved, negative if the block did not converge within max_iterations.
+     */
+    int find_eigenstates(vector<State*> &states, vector<double> &energies, double tolerance, int max_iterations,
+                         int orthogonalization_steps = 10, int check_steps = 100);
 private:
     bool imag_time;    ///< Whether the time of evolution is imaginary(true) or real(false).
     double **external_pot_real;    ///< Real part of the evolution operator regarding the external potential.
@@ -574,10 +651,27 @@ private:
     double delta_t;    ///< A single evolution iteration, evolves the state for this time.
     double norm2[2];    ///< Squared norms of the two wave function.
     bool single_component;    ///< Whether the system is single-component(true) or two-components(false).
-    string kernel_type;    ///< Which kernel are being used (cpu or gpu).
+    string kernel_type;    ///< Which kernel are being used (cpu, cpu-auto, cpu-float, adi, chebyshev, fft or gpu).
+    string sincos_accuracy;    ///< Accuracy of the nonlinear phase computed by the CPU kernel.
+    string autotune_cache;    ///< File storing the block geometries found by the cpu-auto kernel.
+    bool in_place;    ///< Whether the CPU kernel evolves the states in place.
+    double mixed_precision_tolerance;    ///< Relative change of the energy below which imaginary time evolution switches from single to double precision (0: double only).
+    bool mixed_precision_converged;    ///< Whether the single precision phase of the mixed precision has converged, so that imaginary time evolution stays in double precision until the parameters change.
+    int mixed_precision_steps;    ///< Single precision steps since the last check of the energy in mixed precision.
+    int coarse_iterations;    ///< Time steps evolved on the coarser levels by the last call of find_ground_state_multilevel().
+    double mixed_precision_energy;    ///< Total energy at the last check in mixed precision.
     ITrotterKernel * kernel;    ///< Pointer to the kernel object.
-    void initialize_exp_potential(double time_single_it, int which);    ///< Initialize the evolution operator regarding the external potential.
+    ITrotterKernel * float_kernel;    ///< Single precision kernel of the mixed precision, kept between calls to evolve until the energy converges.
+    int splitting_order;    ///< Order of the splitting of the evolution operator in real time (2 or 4).
+    double *middle_pot_real[2];    ///< Real part of the evolution operator regarding the external potential, for the middle sub-step of the fourth order splitting.
+    double *middle_pot_imag[2];    ///< Imaginary part of the evolution operator regarding the external potential, for the middle sub-step of the fourth order splitting.
+    void initialize_exp_potential(double time_single_it, int which, double *pot_real, double *pot_imag);    ///< Initialize the evolution operator regarding the external potential, for a time step time_single_it.
+    void initialize_exp_potentials(int which);    ///< Initialize the evolution operators regarding the external potential for the sub-steps of the splitting.
     void init_kernel();    ///< Initialize the kernel (cpu or gpu).
+    void evolve_mixed_precision(int iterations);    ///< Evolve in imaginary time in single precision until the energy converges, then in double precision.
+    double update_snapshot(double *snapshot);    ///< Return the squared norm of the change of the normalized wave functions since the snapshot, and update it.
+    void rescale_state(State *level_state, double norm2);    ///< Rescale the wave function of a state to the squared norm norm2.
+    void delete_level_lattice(Lattice2D *level_grid);    ///< Delete the lattice of a coarser level of find_ground_state_multilevel() and its communicator.
     double total_energy;    ///< Total energy of the system.
     double kinetic_energy[2];    ///< Kinetic energy for the single components.
     double tot_kinetic_energy;    ///< Total kinetic energy of the system.
@@ -600,4 +694,6 @@ double const_potential(double x);    ///< Defines the null potential function in
 double const_potential(double x, double y);    ///< Defines the null potential function in 2D.
 void map_lattice_to_coordinate_space(Lattice *grid, int x_in, double *x_out);  ///< Centers the coordinates in 1D.
 void map_lattice_to_coordinate_space(Lattice *grid, int x_in, int y_in, double *x_out, double *y_out); ///< Centers the coordinates in 2D.
+string pin_threads();    ///< Pin each OpenMP thread to a core, one NUMA node after the other, and return the placement; call it before creating the states.
+string get_thread_placement();    ///< Report the core and NUMA node each OpenMP thread runs on.
 #endif // __TROTTERSUZUKI_H
@@ -1,4 +1,7 @@
 #include <iostream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "kerneltest.h"
 
 #define DIM 250
@@ -6,10 +9,11 @@
 
 template<class F>
 void my_test<F>::free_particle_test() {
-	Lattice *grid = new Lattice2D(DIM, LENGTH, true, true);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, true, true);
 	State *state = new ExponentialState(grid);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, NULL);
 	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, this->kernel_type);
+	solver->set_in_place(this->in_place);
 	double ini_tot_energy = solver->get_total_energy();
 	double ini_norm = solver->get_squared_norm();
 	solver->evolve(100);
@@ -28,11 +32,12 @@ void my_test<F>::free_particle_test() {
 
 template<class F>
 void my_test<F>::harmonic_oscillator_test() {
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, this->periodic, this->periodic);
 	State *state = new GaussianState(grid, 1.);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
 	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, this->kernel_type);
+	solver->set_in_place(this->in_place);
 	double ini_tot_energy = solver->get_total_energy();
 	double ini_norm = solver->get_squared_norm();
 	solver->evolve(100);
@@ -52,11 +57,12 @@ void my_test<F>::harmonic_oscillator_test() {
 template<class F>
 void my_test<F>::imaginary_harmonic_oscillator_test() {
 	double std_energy = 1.00001;
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, this->periodic, this->periodic);
 	State *state = new GaussianState(grid, 0.5);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
 	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, this->kernel_type);
+	solver->set_in_place(this->in_place);
 	double ini_norm = solver->get_squared_norm();
 	solver->evolve(1000, true);
 	double tot_energy = solver->get_total_energy();
@@ -75,11 +81,12 @@ void my_test<F>::imaginary_harmonic_oscillator_test() {
 template<class F>
 void my_test<F>::intra_particle_interaction_test() {
 	double std_mean_XX = 1.02321; //1.05368;
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, this->periodic, this->periodic);
 	State *state = new GaussianState(grid, 1);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10);
 	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, this->kernel_type);
+	solver->set_in_place(this->in_place);
 	double ini_tot_energy = solver->get_total_energy();
 	double ini_norm = solver->get_squared_norm();
 	solver->evolve(1000);
@@ -92,7 +99,10 @@ void my_test<F>::intra_particle_interaction_test() {
 	delete grid;
 	//Check
 	CPPUNIT_ASSERT( std::abs(ini_tot_energy - tot_energy) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(std_mean_XX - mean_XX) < TOLERANCE );
+	// The reference of the wave packet comes from the discretization of the CPU kernel
+	if (this->cpu_reference) {
+		CPPUNIT_ASSERT( std::abs(std_mean_XX - mean_XX) < TOLERANCE );
+	}
 	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
 	std::cout << "TEST FUNCTION: intra_particle_interaction_test with " << this->kernel_type <<
             " kernel -> PASSED! " << std::endl;
@@ -102,11 +112,12 @@ template<class F>
 void my_test<F>::imaginary_intra_particle_interaction_test() {
 	double std_energy = 1.59273;
 	double std_mean_XX = 0.768148; // 0.780077;
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, this->periodic, this->periodic);
 	State *state = new GaussianState(grid, 1);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10);
 	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, this->kernel_type);
+	solver->set_in_place(this->in_place);
 	double ini_norm = solver->get_squared_norm();
 	solver->evolve(1000, true);
 	double tot_energy = solver->get_total_energy();
@@ -118,7 +129,10 @@ void my_test<F>::imaginary_intra_particle_interaction_test() {
 	delete grid;
 	//Check
 	CPPUNIT_ASSERT( std::abs(std_energy - tot_energy) < TOLERANCE );
-	CPPUNIT_ASSERT( std::abs(std_mean_XX - mean_XX) < TOLERANCE );
+	// The reference of the wave packet comes from the discretization of the CPU kernel
+	if (this->cpu_reference) {
+		CPPUNIT_ASSERT( std::abs(std_mean_XX - mean_XX) < TOLERANCE );
+	}
 	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
 	std::cout << "TEST FUNCTION: imaginary_intra_particle_interaction_test with " << this->kernel_type <<
             " kernel -> PASSED! " << std::endl;
@@ -127,11 +141,12 @@ void my_test<F>::imaginary_intra_particle_interaction_test() {
 template<class F>
 void my_test<F>::rotating_frame_of_reference_test() {
 	double angular_velocity = 0.7;
-	Lattice *grid = new Lattice2D(300, 20, false, false, angular_velocity);
+	Lattice2D *grid = new Lattice2D(300, 20, false, false, angular_velocity);
 	State *state = new GaussianState(grid, 1);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 100., angular_velocity);
 	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-4, this->kernel_type);
+	solver->set_in_place(this->in_place);
 	double ini_tot_energy = solver->get_total_energy();
 	double ini_norm = solver->get_squared_norm();
 	solver->evolve(1000);
@@ -153,11 +168,12 @@ template<class F>
 void my_test<F>::imaginary_rotating_frame_of_reference_test() {
 	double fin_energy = 4.89895;
 	double angular_velocity = 0.7;
-	Lattice *grid = new Lattice2D(300, 20, false, false, angular_velocity);
+	Lattice2D *grid = new Lattice2D(300, 20, false, false, angular_velocity);
 	State *state = new GaussianState(grid, 1);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 100., angular_velocity);
 	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-4, this->kernel_type);
+	solver->set_in_place(this->in_place);
 	double ini_norm = solver->get_squared_norm();
 	solver->evolve(1000, true);
 	double tot_energy = solver->get_total_energy();
@@ -176,12 +192,13 @@ void my_test<F>::imaginary_rotating_frame_of_reference_test() {
 
 template<class F>
 void my_test<F>::mixed_BEC_test() {
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, this->periodic, this->periodic);
 	State *state1 = new GaussianState(grid, 1);
 	State *state2 = new State(grid);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian2Component *hamiltonian = new Hamiltonian2Component(grid, potential, potential, 1., 1., 0., 0., 0., 2.*M_PI/10.);
 	Solver *solver = new Solver(grid, state1, state2, hamiltonian, 1.e-3, this->kernel_type);
+	solver->set_in_place(this->in_place);
 	double ini_tot_energy = solver->get_total_energy();
 	double ini_norm = solver->get_squared_norm();
 	double ini_norm1 = state1->get_squared_norm();
@@ -209,12 +226,13 @@ template<class F>
 void my_test<F>::imaginary_mixed_BEC_test() {
 	double std_norm1 = 0.915292;
 	double std_norm2 = 0.084708;
-	Lattice *grid = new Lattice2D(DIM, LENGTH);
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, this->periodic, this->periodic);
 	State *state1 = new GaussianState(grid, 1);
 	State *state2 = new State(grid);
 	Potential *potential = new HarmonicPotential(grid, 1., 1.);
 	Hamiltonian2Component *hamiltonian = new Hamiltonian2Component(grid, potential, potential, 1., 1., 0., 0., 0., 2.*M_PI/10.);
 	Solver *solver = new Solver(grid, state1, state2, hamiltonian, 1.e-3, this->kernel_type);
+	solver->set_in_place(this->in_place);
 	double ini_tot_energy = solver->get_total_energy();
 	double ini_norm = solver->get_squared_norm();
 	solver->evolve(1000, true);
@@ -236,10 +254,565 @@ void my_test<F>::imaginary_mixed_BEC_test() {
             " kernel -> PASSED! " << std::endl;
 }
 
+template<class F>
+void my_test<F>::steady_state_allocations_test() {
+	Lattice2D *grid = new Lattice2D(DIM, LENGTH, this->periodic, this->periodic);
+	State *state = new GaussianState(grid, 1.);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 1.);
+	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, this->kernel_type);
+	solver->set_in_place(this->in_place);
+	solver->evolve(1);
+	size_t ini_allocations = solver->get_kernel_allocations();
+	solver->evolve(100);
+	size_t allocations = solver->get_kernel_allocations();
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( ini_allocations == allocations );
+	std::cout << "TEST FUNCTION: steady_state_allocations_test with " << this->kernel_type <<
+            " kernel -> PASSED! " << std::endl;
+}
+
+template<class F>
+void my_test<F>::cpu_agreement_test() {
+	Lattice2D *grid = new Lattice2D(100, 10., this->periodic, this->periodic);
+	State *state = new GaussianState(grid, 1., 1., 1., 0.5);
+	State *cpu_state = new GaussianState(grid, 1., 1., 1., 0.5);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-4, this->kernel_type);
+	solver->set_in_place(this->in_place);
+	Solver *cpu_solver = new Solver(grid, cpu_state, hamiltonian, 5.e-4, "cpu");
+	solver->evolve(1000);
+	cpu_solver->evolve(1000);
+	double tot_energy = solver->get_total_energy();
+	double cpu_tot_energy = cpu_solver->get_total_energy();
+	double mean_X = state->get_mean_x();
+	double cpu_mean_X = cpu_state->get_mean_x();
+	double mean_Y = state->get_mean_y();
+	double cpu_mean_Y = cpu_state->get_mean_y();
+	delete solver;
+	delete cpu_solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete cpu_state;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( std::abs(tot_energy - cpu_tot_energy) < TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(mean_X - cpu_mean_X) < TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(mean_Y - cpu_mean_Y) < TOLERANCE );
+	std::cout << "TEST FUNCTION: cpu_agreement_test with " << this->kernel_type <<
+            " kernel -> PASSED! " << std::endl;
+}
+
+void SolverTest::mixed_precision_chunks_test() {
+	Lattice2D *grid = new Lattice2D(100, 20);
+	State *state = new GaussianState(grid, 0.5);
+	State *mixed_state = new GaussianState(grid, 0.5);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 5.);
+	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, "cpu");
+	Solver *mixed_solver = new Solver(grid, mixed_state, hamiltonian, 5.e-3, "cpu");
+	mixed_solver->set_mixed_precision(1.e-5);
+	solver->evolve(2000, true);
+	// Chunks shorter than the interval between two checks of the energy
+	for (int i = 0; i < 40; i++) {
+		mixed_solver->evolve(50, true);
+	}
+	double tot_energy = solver->get_total_energy();
+	double mixed_tot_energy = mixed_solver->get_total_energy();
+	double mean_XX = state->get_mean_xx();
+	double mixed_mean_XX = mixed_state->get_mean_xx();
+	delete solver;
+	delete mixed_solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete mixed_state;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( std::abs(tot_energy - mixed_tot_energy) < 1.e-8 );
+	CPPUNIT_ASSERT( std::abs(mean_XX - mixed_mean_XX) < 1.e-8 );
+	std::cout << "TEST FUNCTION: mixed_precision_chunks_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::multilevel_ground_state_test() {
+	Lattice2D *grid = new Lattice2D(128, 16.);
+	State *state = new GaussianState(grid, 0.3, 0.3, 1., 0.5);
+	State *multilevel_state = new GaussianState(grid, 0.3, 0.3, 1., 0.5);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, "cpu");
+	Solver *multilevel_solver = new Solver(grid, multilevel_state, hamiltonian, 5.e-3, "cpu");
+	int iterations = solver->find_ground_state(1.e-10, 100000);
+	int multilevel_iterations = multilevel_solver->find_ground_state_multilevel(3, 1.e-10, 100000);
+	int coarse_iterations = multilevel_solver->get_coarse_iterations();
+	double tot_energy = solver->get_total_energy();
+	double multilevel_tot_energy = multilevel_solver->get_total_energy();
+	double mean_XX = state->get_mean_xx();
+	double multilevel_mean_XX = multilevel_state->get_mean_xx();
+	delete solver;
+	delete multilevel_solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete multilevel_state;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( iterations > 0 && multilevel_iterations > 0 && coarse_iterations > 0 );
+	CPPUNIT_ASSERT( multilevel_iterations < iterations );
+	CPPUNIT_ASSERT( std::abs(tot_energy - multilevel_tot_energy) < NORM_TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(mean_XX - multilevel_mean_XX) < NORM_TOLERANCE );
+	std::cout << "TEST FUNCTION: multilevel_ground_state_test -> PASSED! " << std::endl;
+}
+
+/* Whether init_kernel() rejects the input, in real and in imaginary time,
+ * for the given reason. Without MPI, my_abort() throws.
+ */
+static bool rejects(Lattice2D *grid, Potential *potential, double coupling, double angular_velocity, std::string kernel_type,
+                    std::string reason) {
+	State *state = new GaussianState(grid, 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., coupling, 0., angular_velocity);
+	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, kernel_type);
+	int rejections = 0;
+	for (int imag_time = 0; imag_time < 2; imag_time++) {
+		try {
+			solver->evolve(1, imag_time == 1);
+		}
+		catch (const std::runtime_error &error) {
+			if (std::string(error.what()).find(reason) != std::string::npos) {
+				rejections++;
+			}
+		}
+	}
+	delete solver;
+	delete hamiltonian;
+	delete state;
+	return rejections == 2;
+}
+
+static double breathing_potential(double x, double y, double t) {
+	return 0.5 * (1. + 0.1 * sin(t)) * (x * x + y * y);
+}
+
+void ChebyshevKernelSuite::nonlinear_rejection_test() {
+#ifndef HAVE_MPI
+	Lattice2D *grid = new Lattice2D(64, 10.);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	bool rejected = rejects(grid, potential, 1., 0., this->kernel_type, "linear");
+	delete potential;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( rejected );
+#endif
+	std::cout << "TEST FUNCTION: nonlinear_rejection_test with " << this->kernel_type <<
+	          " kernel -> PASSED! " << std::endl;
+}
+
+void ChebyshevKernelSuite::time_dependent_rejection_test() {
+#ifndef HAVE_MPI
+	Lattice2D *grid = new Lattice2D(64, 10.);
+	Potential *potential = new Potential(grid, breathing_potential);
+	bool rejected = rejects(grid, potential, 0., 0., this->kernel_type, "static");
+	delete potential;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( rejected );
+#endif
+	std::cout << "TEST FUNCTION: time_dependent_rejection_test with " << this->kernel_type <<
+	          " kernel -> PASSED! " << std::endl;
+}
+
+void AdiKernelSuite::rotation_rejection_test() {
+#ifndef HAVE_MPI
+	Lattice2D *grid = new Lattice2D(64, 10., false, false, 0.7);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	bool rejected = rejects(grid, potential, 0., 0.7, this->kernel_type, "rotation");
+	delete potential;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( rejected );
+#endif
+	std::cout << "TEST FUNCTION: rotation_rejection_test with " << this->kernel_type <<
+	          " kernel -> PASSED! " << std::endl;
+}
+
+void FftKernelSuite::rotation_rejection_test() {
+#ifndef HAVE_MPI
+	// The Hamiltonian only rotates the frame of closed lattices
+	Lattice2D *grid = new Lattice2D(64, 10., false, false, 0.7);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	bool rejected = rejects(grid, potential, 0., 0.7, this->kernel_type, "rotation");
+	delete potential;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( rejected );
+#endif
+	std::cout << "TEST FUNCTION: rotation_rejection_test with " << this->kernel_type <<
+	          " kernel -> PASSED! " << std::endl;
+}
+
+void FftKernelSuite::closed_boundary_rejection_test() {
+#ifndef HAVE_MPI
+	Lattice2D *grid = new Lattice2D(64, 10., true, false);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	bool rejected = rejects(grid, potential, 0., 0., this->kernel_type, "periodic");
+	delete potential;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( rejected );
+#endif
+	std::cout << "TEST FUNCTION: closed_boundary_rejection_test with " << this->kernel_type <<
+	          " kernel -> PASSED! " << std::endl;
+}
+
+static double harmonic_potential(double x, double y) {
+	return 0.5 * (x * x + y * y);
+}
+
+// Evolve a state in a harmonic trap centered at the origin with the CPU kernel, in calls to evolve()
+static void evolve_in_trap(Lattice *grid, State *state, double coupling, double delta_t, int iterations,
+                           bool in_place = false, int splitting_order = 2, int calls = 1) {
+	Potential *potential = new Potential(grid, harmonic_potential);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., coupling);
+	Solver *solver = new Solver(grid, state, hamiltonian, delta_t, "cpu");
+	solver->set_in_place(in_place);
+	solver->set_splitting_order(splitting_order);
+	for (int i = 0; i < calls; i++) {
+		solver->evolve((i + 1) * iterations / calls - i * iterations / calls);
+	}
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+}
+
+// Distance between the inner dots of two states, on lattices that may differ in their halos
+static double distance(Lattice *grid1, State *state1, Lattice *grid2, State *state2) {
+	double sum = 0.;
+	for (int y = 0; y < grid1->inner_end_y - grid1->inner_start_y; y++) {
+		for (int x = 0; x < grid1->inner_end_x - grid1->inner_start_x; x++) {
+			int i = (y + grid1->inner_start_y - grid1->start_y) * grid1->dim_x + x + grid1->inner_start_x - grid1->start_x;
+			int j = (y + grid2->inner_start_y - grid2->start_y) * grid2->dim_x + x + grid2->inner_start_x - grid2->start_x;
+			sum += (state1->p_real[i] - state2->p_real[j]) * (state1->p_real[i] - state2->p_real[j]) +
+			       (state1->p_imag[i] - state2->p_imag[j]) * (state1->p_imag[i] - state2->p_imag[j]);
+		}
+	}
+	return sqrt(sum);
+}
+
+void SolverTest::mixed_precision_steps_test() {
+	// The energy never settles within the tolerance, so every step runs in single precision
+	Lattice2D *grid = new Lattice2D(100, 20);
+	State *state = new GaussianState(grid, 0.5);
+	State *stepped_state = new GaussianState(grid, 0.5);
+	State *double_state = new GaussianState(grid, 0.5);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 5.);
+	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, "cpu");
+	Solver *stepped_solver = new Solver(grid, stepped_state, hamiltonian, 5.e-3, "cpu");
+	Solver *double_solver = new Solver(grid, double_state, hamiltonian, 5.e-3, "cpu");
+	solver->set_mixed_precision(1.e-15);
+	stepped_solver->set_mixed_precision(1.e-15);
+	solver->evolve(50, true);
+	for (int i = 0; i < 50; i++) {
+		stepped_solver->evolve(1, true);
+	}
+	double_solver->evolve(50, true);
+	double stepped_distance = distance(grid, state, grid, stepped_state);
+	double double_distance = distance(grid, state, grid, double_state);
+	delete solver;
+	delete stepped_solver;
+	delete double_solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete stepped_state;
+	delete double_state;
+	delete grid;
+	//Check: single steps evolve as a single call, and in single precision too
+	CPPUNIT_ASSERT( stepped_distance < 1.e-12 );
+	CPPUNIT_ASSERT( double_distance > 1.e-10 );
+	std::cout << "TEST FUNCTION: mixed_precision_steps_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::temporal_blocking_test() {
+	// Periodic along x only, evolved in two calls, so that both the halos of the
+	// columns and those left by the first call are exercised
+	Lattice2D *grid = new Lattice2D(128, 10., true, false);
+	Lattice2D *blocked_grid = new Lattice2D(128, 10., 128, 10., true, false, 0., "cartesian", 3);
+	State *state = new GaussianState(grid, 1., 1., 1., 0.5);
+	State *blocked_state = new GaussianState(blocked_grid, 1., 1., 1., 0.5);
+	evolve_in_trap(grid, state, 10., 1.e-3, 201, false, 2, 2);
+	evolve_in_trap(blocked_grid, blocked_state, 10., 1.e-3, 201, false, 2, 2);
+	double blocked_distance = distance(grid, state, blocked_grid, blocked_state);
+	delete state;
+	delete blocked_state;
+	delete blocked_grid;
+	delete grid;
+	//Check: three time steps per cached block give the same state as one
+	CPPUNIT_ASSERT( blocked_distance < 1.e-12 );
+	std::cout << "TEST FUNCTION: temporal_blocking_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::temporal_blocking_fallback_test() {
+#ifndef HAVE_MPI
+	Lattice2D *grid = new Lattice2D(32, 10., 32, 10., true, true, 0., "cartesian", 3);
+	State *state = new GaussianState(grid, 1.);
+	Potential *potential = new Potential(grid, harmonic_potential);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 10.);
+	Solver *solver = new Solver(grid, state, hamiltonian, 1.e-3, "cpu");
+	double ini_norm = state->get_squared_norm();
+	//Check: the solver refuses to evolve several steps per block where they depend on the rest of the lattice
+	CPPUNIT_ASSERT_THROW( solver->evolve(1, true), std::runtime_error );
+	solver->set_splitting_order(4);
+	CPPUNIT_ASSERT_THROW( solver->evolve(1), std::runtime_error );
+	//Check: and still evolves where they do not
+	solver->set_splitting_order(2);
+	solver->evolve(1);
+	CPPUNIT_ASSERT( std::abs(state->get_squared_norm() - ini_norm) < NORM_TOLERANCE );
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete grid;
+#endif
+	std::cout << "TEST FUNCTION: temporal_blocking_fallback_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::sincos_accuracy_test() {
+	// The nonlinear phase g |psi|^2 dt reaches 3.2 at the center, so the argument
+	// reduction goes through the first two quadrants
+	string accuracies[3] = {"exact", "double", "single"};
+	int iterations = 10;
+	Lattice2D *grid = new Lattice2D(64, 10., false, false);
+	Potential *potential = new Potential(grid, harmonic_potential);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential, 1., 2000.);
+	State *states[3];
+	for (int i = 0; i < 3; i++) {
+		states[i] = new GaussianState(grid, 1.);
+		Solver *solver = new Solver(grid, states[i], hamiltonian, 5.e-3, "cpu");
+		solver->set_sincos_accuracy(accuracies[i]);
+		solver->evolve(iterations);
+		delete solver;
+	}
+	double scale = sqrt(states[0]->get_squared_norm() / (grid->delta_x * grid->delta_y));
+	double double_error = distance(grid, states[0], grid, states[1]) / scale;
+	double single_error = distance(grid, states[0], grid, states[2]) / scale;
+	for (int i = 0; i < 3; i++) {
+		delete states[i];
+	}
+	delete hamiltonian;
+	delete potential;
+	delete grid;
+	//Check: at each step, the double precision polynomial is accurate to a few ulp and the single precision one to single precision
+	CPPUNIT_ASSERT( double_error < iterations * 4 * DBL_EPSILON );
+	CPPUNIT_ASSERT( single_error < iterations * FLT_EPSILON );
+	std::cout << "TEST FUNCTION: sincos_accuracy_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::long_chain_test() {
+	// The wave packet straddles the first two segments of 4096 dots of the long chain
+	Lattice1D *grid = new Lattice1D(8192, 819.2);
+	Lattice1D *short_grid = new Lattice1D(2000, 200.);
+	State *state = new GaussianState(grid, 1., 1.);
+	State *threaded_state = new GaussianState(grid, 1., 1.);
+	State *short_state = new GaussianState(short_grid, 1., 1.);
+#ifdef _OPENMP
+	int max_threads = omp_get_max_threads();
+	omp_set_num_threads(1);
+#endif
+	evolve_in_trap(grid, state, 10., 1.e-3, 1000);
+	evolve_in_trap(short_grid, short_state, 10., 1.e-3, 1000);
+#ifdef _OPENMP
+	omp_set_num_threads(4);
+#endif
+	evolve_in_trap(grid, threaded_state, 10., 1.e-3, 1000);
+#ifdef _OPENMP
+	omp_set_num_threads(max_threads);
+#endif
+	double threaded_distance = distance(grid, state, grid, threaded_state);
+	double mean_x = threaded_state->get_mean_x();
+	double short_mean_x = short_state->get_mean_x();
+	delete state;
+	delete threaded_state;
+	delete short_state;
+	delete short_grid;
+	delete grid;
+	//Check: the segments evolve the same with several threads, and as a chain of a single segment
+	CPPUNIT_ASSERT( threaded_distance < 1.e-12 );
+	CPPUNIT_ASSERT( std::abs(mean_x - short_mean_x) < NORM_TOLERANCE );
+	std::cout << "TEST FUNCTION: long_chain_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::in_place_test() {
+	Lattice2D *grid = new Lattice2D(128, 10., true, true);
+	State *state = new GaussianState(grid, 1., 1., 1., 0.5);
+	State *in_place_state = new GaussianState(grid, 1., 1., 1., 0.5);
+	evolve_in_trap(grid, state, 10., 1.e-3, 201);
+	evolve_in_trap(grid, in_place_state, 10., 1.e-3, 201, true);
+	double in_place_distance = distance(grid, state, grid, in_place_state);
+	delete state;
+	delete in_place_state;
+	delete grid;
+	//Check: evolving in place gives the same state as with a second buffer
+	CPPUNIT_ASSERT( in_place_distance < 1.e-12 );
+	std::cout << "TEST FUNCTION: in_place_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::fourth_order_splitting_test() {
+	Lattice2D *grid = new Lattice2D(64, 12.);
+	State *reference = new GaussianState(grid, 1., 1., 1., 0.5);
+	State *state = new GaussianState(grid, 1., 1., 1., 0.5);
+	State *half_step_state = new GaussianState(grid, 1., 1., 1., 0.5);
+	evolve_in_trap(grid, reference, 1., 1.e-4, 10000, false, 4);
+	evolve_in_trap(grid, state, 1., 1.e-2, 100, false, 4);
+	evolve_in_trap(grid, half_step_state, 1., 5.e-3, 200, false, 4);
+	double error = distance(grid, state, grid, reference);
+	double half_step_error = distance(grid, half_step_state, grid, reference);
+	delete reference;
+	delete state;
+	delete half_step_state;
+	delete grid;
+	//Check: the error of the Yoshida splitting falls 16 times when the time step halves
+	CPPUNIT_ASSERT( error / half_step_error > 12. );
+	std::cout << "TEST FUNCTION: fourth_order_splitting_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::ground_state_test() {
+	double std_energy = 1.;
+	Lattice2D *grid = new Lattice2D(64, 12.);
+	State *state = new GaussianState(grid, 0.5, 0.5, 0.5, 0.3);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, "cpu");
+	double ini_norm = solver->get_squared_norm();
+	int iterations = solver->find_ground_state(1.e-8, 100000);
+	double tot_energy = solver->get_total_energy();
+	double norm = solver->get_squared_norm();
+	double delta_t = solver->get_delta_t();
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( iterations > 0 );
+	CPPUNIT_ASSERT( delta_t == 5.e-3 );
+	CPPUNIT_ASSERT( std::abs(std_energy - tot_energy) < TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
+	std::cout << "TEST FUNCTION: ground_state_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::minimize_energy_test() {
+	double std_energy = 1.;
+	Lattice2D *grid = new Lattice2D(64, 12.);
+	State *state = new GaussianState(grid, 0.5, 0.5, 0.5, 0.3);
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Solver *solver = new Solver(grid, state, hamiltonian, 5.e-3, "cpu");
+	double ini_norm = solver->get_squared_norm();
+	int iterations = solver->minimize_energy(1.e-8, 1000);
+	double tot_energy = solver->get_total_energy();
+	double norm = solver->get_squared_norm();
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	delete state;
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( iterations > 0 );
+	CPPUNIT_ASSERT( std::abs(std_energy - tot_energy) < TOLERANCE );
+	CPPUNIT_ASSERT( std::abs(ini_norm - norm) < NORM_TOLERANCE );
+	std::cout << "TEST FUNCTION: minimize_energy_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::eigenstates_test() {
+	// The three lowest shells of the 2D harmonic oscillator
+	double std_energies[6] = {1., 2., 2., 3., 3., 3.};
+	double mean_x[6] = {0., 0.6, -0.2, 0.4, -0.5, 0.3};
+	double mean_y[6] = {0., 0.1, 0.7, -0.4, -0.3, 0.5};
+	Lattice2D *grid = new Lattice2D(64, 12.);
+	std::vector<State*> states;
+	for (int k = 0; k < 6; k++) {
+		states.push_back(new GaussianState(grid, 1., 1., mean_x[k], mean_y[k]));
+	}
+	Potential *potential = new HarmonicPotential(grid, 1., 1.);
+	Hamiltonian *hamiltonian = new Hamiltonian(grid, potential);
+	Solver *solver = new Solver(grid, states[0], hamiltonian, 5.e-3, "cpu");
+	std::vector<double> energies;
+	int iterations = solver->find_eigenstates(states, energies, 1.e-7, 100000);
+	double norm = states[5]->get_squared_norm();
+	delete solver;
+	delete hamiltonian;
+	delete potential;
+	for (int k = 0; k < 6; k++) {
+		delete states[k];
+	}
+	delete grid;
+	//Check
+	CPPUNIT_ASSERT( iterations > 0 );
+	CPPUNIT_ASSERT( energies.size() == 6 );
+	for (int k = 0; k < 6; k++) {
+		CPPUNIT_ASSERT( std::abs(std_energies[k] - energies[k]) < TOLERANCE );
+	}
+	CPPUNIT_ASSERT( std::abs(1. - norm) < NORM_TOLERANCE );
+	std::cout << "TEST FUNCTION: eigenstates_test -> PASSED! " << std::endl;
+}
+
+void SolverTest::fourth_order_kinetic_test() {
+	// <x> of a wave packet displaced in a harmonic trap oscillates as cos(t)
+	double errors[2];
+	for (int k = 0; k < 2; k++) {
+		Lattice2D *grid = new Lattice2D(32 << k, 12., false, false, 0., "cartesian", 1, 4);
+		State *state = new GaussianState(grid, 1., 1., 1.);
+		evolve_in_trap(grid, state, 0., 1.25e-4, 16000);
+		errors[k] = std::abs(state->get_mean_x() - cos(2.));
+		delete state;
+		delete grid;
+	}
+	//Check: the error of the fourth order kinetic term falls 16 times when the resolution doubles
+	CPPUNIT_ASSERT( errors[0] / errors[1] > 12. );
+	std::cout << "TEST FUNCTION: fourth_order_kinetic_test -> PASSED! " << std::endl;
+}
+
 void CpuKernelTest::setUp() {
     this->kernel_type = "cpu";
 }
 
+void CpuAutoKernelTest::setUp() {
+    this->kernel_type = "cpu-auto";
+}
+
+void CpuInPlaceKernelTest::setUp() {
+    this->kernel_type = "cpu";
+    this->in_place = true;
+}
+
+void CpuFloatKernelTest::setUp() {
+    this->kernel_type = "cpu-float";
+}
+
+void ChebyshevKernelTest::setUp() {
+    this->kernel_type = "chebyshev";
+    this->cpu_reference = false;
+}
+
+void AdiKernelTest::setUp() {
+    this->kernel_type = "adi";
+    this->cpu_reference = false;
+}
+
+void FftKernelTest::setUp() {
+    this->kernel_type = "fft";
+    this->periodic = true;
+    this->cpu_reference = false;
+}
+
 #ifdef CUDA
 void GpuKernelTest::setUp() {
     this->kernel_type = "gpu";
@@ -10,7 +10,11 @@
 
 class KernelTest: public CppUnit::TestFixture {
 public:
+    KernelTest(): periodic(false), cpu_reference(true), in_place(false) {}
     std::string kernel_type;
+    bool periodic;
+    bool cpu_reference;
+    bool in_place;
 };
 
 class CpuKernelTest: public KernelTest {
@@ -18,6 +22,36 @@ public:
     void setUp();
 };
 
+class CpuAutoKernelTest: public KernelTest {
+public:
+    void setUp();
+};
+
+class CpuInPlaceKernelTest: public KernelTest {
+public:
+    void setUp();
+};
+
+class CpuFloatKernelTest: public KernelTest {
+public:
+    void setUp();
+};
+
+class ChebyshevKernelTest: public KernelTest {
+public:
+    void setUp();
+};
+
+class AdiKernelTest: public KernelTest {
+public:
+    void setUp();
+};
+
+class FftKernelTest: public KernelTest {
+public:
+    void setUp();
+};
+
 
 template<class F>
 class my_test: public F {
@@ -31,8 +65,11 @@ class my_test: public F {
     CPPUNIT_TEST( imaginary_rotating_frame_of_reference_test );
     CPPUNIT_TEST( mixed_BEC_test );
     CPPUNIT_TEST( imaginary_mixed_BEC_test );
+    CPPUNIT_TEST( steady_state_allocations_test );
+    CPPUNIT_TEST( cpu_agreement_test );
     CPPUNIT_TEST_SUITE_END();
 
+public:
     void free_particle_test();
     void harmonic_oscillator_test();
     void imaginary_harmonic_oscillator_test();
@@ -42,9 +79,101 @@ class my_test: public F {
     void imaginary_rotating_frame_of_reference_test();
     void mixed_BEC_test();
     void imaginary_mixed_BEC_test();
+    void steady_state_allocations_test();
+    void cpu_agreement_test();
+};
+
+// The kernels for restricted Hamiltonians run the tests within their reach,
+// and check that the others are rejected
+class ChebyshevKernelSuite: public my_test<ChebyshevKernelTest> {
+    CPPUNIT_TEST_SUITE(ChebyshevKernelSuite);
+    CPPUNIT_TEST( free_particle_test );
+    CPPUNIT_TEST( harmonic_oscillator_test );
+    CPPUNIT_TEST( imaginary_harmonic_oscillator_test );
+    CPPUNIT_TEST( cpu_agreement_test );
+    CPPUNIT_TEST( nonlinear_rejection_test );
+    CPPUNIT_TEST( time_dependent_rejection_test );
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void nonlinear_rejection_test();
+    void time_dependent_rejection_test();
+};
+
+class AdiKernelSuite: public my_test<AdiKernelTest> {
+    CPPUNIT_TEST_SUITE(AdiKernelSuite);
+    CPPUNIT_TEST( free_particle_test );
+    CPPUNIT_TEST( harmonic_oscillator_test );
+    CPPUNIT_TEST( imaginary_harmonic_oscillator_test );
+    CPPUNIT_TEST( intra_particle_interaction_test );
+    CPPUNIT_TEST( imaginary_intra_particle_interaction_test );
+    CPPUNIT_TEST( steady_state_allocations_test );
+    CPPUNIT_TEST( cpu_agreement_test );
+    CPPUNIT_TEST( rotation_rejection_test );
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void rotation_rejection_test();
+};
+
+class FftKernelSuite: public my_test<FftKernelTest> {
+    CPPUNIT_TEST_SUITE(FftKernelSuite);
+    CPPUNIT_TEST( free_particle_test );
+    CPPUNIT_TEST( harmonic_oscillator_test );
+    CPPUNIT_TEST( imaginary_harmonic_oscillator_test );
+    CPPUNIT_TEST( intra_particle_interaction_test );
+    CPPUNIT_TEST( imaginary_intra_particle_interaction_test );
+    CPPUNIT_TEST( steady_state_allocations_test );
+    CPPUNIT_TEST( cpu_agreement_test );
+    CPPUNIT_TEST( rotation_rejection_test );
+    CPPUNIT_TEST( closed_boundary_rejection_test );
+    CPPUNIT_TEST_SUITE_END();
+
+public:
+    void rotation_rejection_test();
+    void closed_boundary_rejection_test();
+};
+
+class SolverTest: public CppUnit::TestFixture {
+    CPPUNIT_TEST_SUITE(SolverTest);
+    CPPUNIT_TEST( mixed_precision_chunks_test );
+    CPPUNIT_TEST( mixed_precision_steps_test );
+    CPPUNIT_TEST( multilevel_ground_state_test );
+    CPPUNIT_TEST( temporal_blocking_test );
+    CPPUNIT_TEST( temporal_blocking_fallback_test );
+    CPPUNIT_TEST( sincos_accuracy_test );
+    CPPUNIT_TEST( long_chain_test );
+    CPPUNIT_TEST( in_place_test );
+    CPPUNIT_TEST( fourth_order_splitting_test );
+    CPPUNIT_TEST( ground_state_test );
+    CPPUNIT_TEST( minimize_energy_test );
+    CPPUNIT_TEST( eigenstates_test );
+    CPPUNIT_TEST( fourth_order_kinetic_test );
+    CPPUNIT_TEST_SUITE_END();
+
+    void mixed_precision_chunks_test();
+    void mixed_precision_steps_test();
+    void multilevel_ground_state_test();
+    void temporal_blocking_test();
+    void temporal_blocking_fallback_test();
+    void sincos_accuracy_test();
+    void long_chain_test();
+    void in_place_test();
+    void fourth_order_splitting_test();
+    void ground_state_test();
+    void minimize_energy_test();
+    void eigenstates_test();
+    void fourth_order_kinetic_test();
 };
 
+CPPUNIT_TEST_SUITE_REGISTRATION(SolverTest);
 CPPUNIT_TEST_SUITE_REGISTRATION(my_test<CpuKernelTest>);
+CPPUNIT_TEST_SUITE_REGISTRATION(my_test<CpuAutoKernelTest>);
+CPPUNIT_TEST_SUITE_REGISTRATION(my_test<CpuInPlaceKernelTest>);
+CPPUNIT_TEST_SUITE_REGISTRATION(my_test<CpuFloatKernelTest>);
+CPPUNIT_TEST_SUITE_REGISTRATION(ChebyshevKernelSuite);
+CPPUNIT_TEST_SUITE_REGISTRATION(AdiKernelSuite);
+CPPUNIT_TEST_SUITE_REGISTRATION(FftKernelSuite);
 #ifdef CUDA
 class GpuKernelTest: public KernelTest {
 public:
@@ -27,7 +27,8 @@
 int main(int argc, char** argv) {
 
 #ifdef HAVE_MPI
-    MPI_Init(&argc, &argv);
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 #endif
 
 	// Get the top level suite from the registry